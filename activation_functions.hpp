@@ -1,7 +1,14 @@
 #pragma once
 #include <valarray>
 #include <functional>
+#include <cassert>
+#include <span>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <stdexcept>
 #include "traits.hpp"
+#include "simd.hpp"
 #define EXP_700_ 1.0142320547350045094553295952313e+304
 #define EXP_N700_ 9.8596765437597708567053729478495e-305
 
@@ -36,185 +43,372 @@ enum class ActivationFunctions {
     SGNEXP,
 };
 
-struct ActivationFunction {
-    virtual std::valarray<double> operator() (const std::valarray<double>& x) = 0;
-    virtual std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) = 0;
+template <class T>
+struct BasicActivationFunction {
+    virtual std::valarray<T> operator() (const std::valarray<T>& x) = 0;
+    virtual std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) = 0;
+    // out = f(in) without allocating; in and out may be the same buffer
+    virtual void apply(std::span<const T> in, std::span<T> out) {
+        assert(in.size() == out.size());       //assertion
+        std::valarray<T> y = (*this)(std::valarray<T>(in.data(), in.size()));
+        std::copy(std::begin(y), std::end(y), out.begin());
+    }
+    // out = derivative(y, usGrad) without allocating; out may be the buffer of usGrad
+    virtual void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) {
+        assert(y.size() == usGrad.size() && y.size() == out.size());       //assertion
+        std::valarray<T> d = derivative(std::valarray<T>(y.data(), y.size()), std::valarray<T>(usGrad.data(), usGrad.size()));
+        std::copy(std::begin(d), std::end(d), out.begin());
+    }
 };
 
-struct Sigmoid: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        return 1 / (1 + std::exp(-x));
+// out /= sum(out)
+template <class T>
+inline void normalize(std::span<T> out) {
+    const T sum = std::accumulate(out.begin(), out.end(), T(0));
+    for (T& v: out)
+        v /= sum;
+}
+
+// sum(y) and sum(y * usGrad), the two reductions of the softmax derivatives, summed in order as valarray::sum does
+template <class T>
+inline std::pair<T, T> softmaxSums(std::span<const T> y, std::span<const T> usGrad) {
+    T ySum = y[0];
+    T dot = y[0] * usGrad[0];
+    for (size_t i = 1; i < y.size(); ++i) {
+        ySum += y[i];
+        dot += y[i] * usGrad[i];
+    }
+    return {ySum, dot};
+}
+
+using ActivationFunction = BasicActivationFunction<double>;
+
+template <class T>
+struct Sigmoid: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        std::valarray<T> r(x.size());
+        simd::kernels<T>().sigmoid(x.size(), simd::data(x), simd::data(r));
+        return r;
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
+    void apply(std::span<const T> in, std::span<T> out) override {
+        simd::kernels<T>().sigmoid(in.size(), in.data(), out.data());
+    }
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
         return y * (1 - y) * usGrad;
     }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        for (size_t i = 0; i < y.size(); ++i)
+            out[i] = y[i] * (1 - y[i]) * usGrad[i];
+    }
 };
 
-struct Tanh: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        return std::tanh(x);
+template <class T>
+struct Tanh: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        std::valarray<T> r(x.size());
+        simd::kernels<T>().tanh(x.size(), simd::data(x), simd::data(r));
+        return r;
+    }
+    void apply(std::span<const T> in, std::span<T> out) override {
+        simd::kernels<T>().tanh(in.size(), in.data(), out.data());
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
         return (1 - y * y) * usGrad;
     }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        for (size_t i = 0; i < y.size(); ++i)
+            out[i] = (1 - y[i] * y[i]) * usGrad[i];
+    }
 };
 
-struct Relu: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        std::valarray<double> r(x.size());
-        std::transform(std::cbegin(x), std::cend(x), std::begin(r), [](const double& e) {
-            return std::max(0.0, e);
-        });
+template <class T>
+struct Relu: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        std::valarray<T> r(x.size());
+        simd::kernels<T>().leakyRelu(x.size(), T(0), simd::data(x), simd::data(r));
         return r;
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
-        std::valarray<double> r(y.size());
-        std::transform(std::cbegin(y), std::cend(y), std::begin(r), [](const double& e) {
-            return e > 0 ? 1.0 : 0.0;
-        });
-        return r * usGrad;
+    void apply(std::span<const T> in, std::span<T> out) override {
+        simd::kernels<T>().leakyRelu(in.size(), T(0), in.data(), out.data());
+    }
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
+        std::valarray<T> r(y.size());
+        simd::kernels<T>().leakyReluDerivative(y.size(), T(0), simd::data(y), simd::data(usGrad), simd::data(r));
+        return r;
+    }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        simd::kernels<T>().leakyReluDerivative(y.size(), T(0), y.data(), usGrad.data(), out.data());
     }
 };
 
-struct LeakyRelu: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        std::valarray<double> r(x.size());
-        std::transform(std::cbegin(x), std::cend(x), std::begin(r), [](const double& e) {
-            return (e > 0)? e: .02 * e;
-        });
+template <class T>
+struct LeakyRelu: BasicActivationFunction<T> {
+    static constexpr double slope = .02;
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        std::valarray<T> r(x.size());
+        simd::kernels<T>().leakyRelu(x.size(), slope, simd::data(x), simd::data(r));
         return r;
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
-        std::valarray<double> r(y.size());
-        std::transform(std::cbegin(y), std::cend(y), std::begin(r), [](const double& e) {
-            return e > 0 ? 1.0 : 0.02;
-        });
-        return r * usGrad;
+    void apply(std::span<const T> in, std::span<T> out) override {
+        simd::kernels<T>().leakyRelu(in.size(), slope, in.data(), out.data());
+    }
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
+        std::valarray<T> r(y.size());
+        simd::kernels<T>().leakyReluDerivative(y.size(), slope, simd::data(y), simd::data(usGrad), simd::data(r));
+        return r;
+    }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        simd::kernels<T>().leakyReluDerivative(y.size(), slope, y.data(), usGrad.data(), out.data());
     }
 };
 
-struct PrRelu: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        std::valarray<double> r(x.size());
-        std::transform(std::cbegin(x), std::cend(x), std::begin(r), [](const double& e) {
-            return (e > 0)? e: .2 * e;
-        });
+template <class T>
+struct PrRelu: BasicActivationFunction<T> {
+    static constexpr double slope = .2;
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        std::valarray<T> r(x.size());
+        simd::kernels<T>().leakyRelu(x.size(), slope, simd::data(x), simd::data(r));
         return r;
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
-        std::valarray<double> r(y.size());
-        std::transform(std::cbegin(y), std::cend(y), std::begin(r), [](const double& e) {
-            return (e > 0)? 1. : .2;
-        });
-        return r * usGrad;
+    void apply(std::span<const T> in, std::span<T> out) override {
+        simd::kernels<T>().leakyRelu(in.size(), slope, in.data(), out.data());
+    }
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
+        std::valarray<T> r(y.size());
+        simd::kernels<T>().leakyReluDerivative(y.size(), slope, simd::data(y), simd::data(usGrad), simd::data(r));
+        return r;
+    }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        simd::kernels<T>().leakyReluDerivative(y.size(), slope, y.data(), usGrad.data(), out.data());
     }
 };
 
-struct Softmax: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        auto expX = std::exp(x);
-        double expSum = expX.sum();
+template <class T>
+struct Softmax: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        std::valarray<T> expX(x.size());
+        simd::kernels<T>().exp(x.size(), simd::data(x), simd::data(expX));
+        T expSum = expX.sum();
         return std::move(expX) / expSum;
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
+    void apply(std::span<const T> in, std::span<T> out) override {
+        simd::kernels<T>().exp(in.size(), in.data(), out.data());
+        normalize(out);
+    }
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
         // double sum = (y * usGrad).sum();
         // return -y * (sum - usGrad);                                                      // wrong
         return y * (y.sum() * usGrad - (y * usGrad).sum());
     }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        const auto [ySum, dot] = softmaxSums(y, usGrad);
+        for (size_t i = 0; i < y.size(); ++i)
+            out[i] = y[i] * (ySum * usGrad[i] - dot);
+    }
 };
 
-struct StableSoftmax: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        auto expX = std::exp(x - x.max());
-        double expSum = expX.sum();
+template <class T>
+struct StableSoftmax: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        std::valarray<T> expX = x - x.max();
+        simd::kernels<T>().exp(expX.size(), simd::data(expX), simd::data(expX));
+        T expSum = expX.sum();
         return std::move(expX) / expSum;
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {                                                     // wrong
+    void apply(std::span<const T> in, std::span<T> out) override {
+        const T max = *std::max_element(in.begin(), in.end());
+        std::transform(in.begin(), in.end(), out.begin(), [max](T v) { return v - max; });
+        simd::kernels<T>().exp(out.size(), out.data(), out.data());
+        normalize(out);
+    }
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {                                                     // wrong
         return y * (y.sum() * usGrad - (y * usGrad).sum());
         // return (y.sum() * usGrad - (y * usGrad).sum()) / std::pow(y.sum(), 2) * y;       // redundant
     }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        const auto [ySum, dot] = softmaxSums(y, usGrad);
+        for (size_t i = 0; i < y.size(); ++i)
+            out[i] = y[i] * (ySum * usGrad[i] - dot);
+    }
 };
 
-struct[[deprecated]] StableSoftmaxV2: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        auto clampedX = x.apply([](double d) ->double { return std::clamp(d, -700., 700.); });
+template <class T>
+struct [[deprecated]] StableSoftmaxV2: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        auto clampedX = x.apply([](T d) -> T { return std::clamp(d, T(-700), T(700)); });
         auto expX = std::exp(clampedX - clampedX.max());
-        double expSum = expX.sum();
+        T expSum = expX.sum();
         return std::move(expX) / expSum;
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
-        return (y * (y.sum() * usGrad - (y * usGrad).sum())).apply([](double d) ->double { return (d > EXP_700_ || d < EXP_N700_)? 0.0: d; });
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
+        return (y * (y.sum() * usGrad - (y * usGrad).sum())).apply([](T d) -> T { return (d > EXP_700_ || d < EXP_N700_)? 0.0: d; });
         // return (y.sum() * usGrad - (y * usGrad).sum()) / std::pow(y.sum(), 2) * y;       // redundant
     }
 };
 
-struct StableSoftmaxV3: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        auto clampedX = std::tanh(x / 200) * 200;
-        auto expX = std::exp(clampedX - clampedX.max());
-        double expSum = expX.sum();
+template <class T>
+struct StableSoftmaxV3: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        std::valarray<T> clampedX = x / 200;
+        simd::kernels<T>().tanh(clampedX.size(), simd::data(clampedX), simd::data(clampedX));
+        clampedX *= 200;
+        std::valarray<T> expX = clampedX - clampedX.max();
+        simd::kernels<T>().exp(expX.size(), simd::data(expX), simd::data(expX));
+        T expSum = expX.sum();
         return std::move(expX) / expSum;
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
+    void apply(std::span<const T> in, std::span<T> out) override {
+        std::transform(in.begin(), in.end(), out.begin(), [](T v) { return v / 200; });
+        simd::kernels<T>().tanh(out.size(), out.data(), out.data());
+        for (T& v: out)
+            v *= 200;
+        const T max = *std::max_element(out.begin(), out.end());
+        for (T& v: out)
+            v -= max;
+        simd::kernels<T>().exp(out.size(), out.data(), out.data());
+        normalize(out);
+    }
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
         // printValarray(usGrad);
         return y * (y.sum() * usGrad - (y * usGrad).sum()) * (-std::pow(std::log(y) / 200, 2) + 1);
         // return (y.sum() * usGrad - (y * usGrad).sum()) / std::pow(y.sum(), 2) * y;       // redundant
     }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        const auto [ySum, dot] = softmaxSums(y, usGrad);
+        for (size_t i = 0; i < y.size(); ++i)
+            out[i] = y[i] * (ySum * usGrad[i] - dot) * (-std::pow(std::log(y[i]) / 200, 2) + 1);
+    }
 };
 
-struct[[deprecated]] TaylorSoftmax: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
+template <class T>
+struct [[deprecated]] TaylorSoftmax: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
         auto taylor = 0.5 * std::pow(x, 2) + x + 1;
-        double taylorSum = taylor.sum();
+        T taylorSum = taylor.sum();
         return std::move(taylor) / std::move(taylorSum);
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
+    void apply(std::span<const T> in, std::span<T> out) override {
+        std::transform(in.begin(), in.end(), out.begin(), [](T v) { return T(0.5) * v * v + v + 1; });
+        normalize(out);
+    }
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
         return (y.sum() * usGrad - (y * usGrad).sum()) / std::pow(y.sum(), 2) * std::sqrt(2 * y - 1);
     }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        const auto [ySum, dot] = softmaxSums(y, usGrad);
+        for (size_t i = 0; i < y.size(); ++i)
+            out[i] = (ySum * usGrad[i] - dot) / std::pow(ySum, 2) * std::sqrt(2 * y[i] - 1);
+    }
 };
 
-struct CubeRoot: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        return std::pow(std::abs(x), 1. / 3) * x.apply([](double v) -> double { return v < 0? -1: 1; });
+template <class T>
+struct CubeRoot: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        return std::pow(std::abs(x), 1. / 3) * x.apply([](T v) -> T { return v < 0? -1: 1; });
+    }
+    void apply(std::span<const T> in, std::span<T> out) override {
+        std::transform(in.begin(), in.end(), out.begin(), [](T v) -> T { return std::pow(std::abs(v), T(1. / 3)) * (v < 0? -1: 1); });
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
         return usGrad / (y * y * 3 + 1e-5);
     }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        for (size_t i = 0; i < y.size(); ++i)
+            out[i] = usGrad[i] / (y[i] * y[i] * 3 + 1e-5);
+    }
 };
 
-struct SgnExp: ActivationFunction {
-    std::valarray<double> operator() (const std::valarray<double>& x) override {
-        return (1 - std::exp(-std::abs(x))) * x.apply([](double v) -> double { return v < 0? -1: 1; });
+template <class T>
+struct SgnExp: BasicActivationFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& x) override {
+        std::valarray<T> expX = -std::abs(x);
+        simd::kernels<T>().exp(expX.size(), simd::data(expX), simd::data(expX));
+        return (1 - expX) * x.apply([](T v) -> T { return v < 0? -1: 1; });
     }
-    std::valarray<double> derivative(const std::valarray<double>& y, const std::valarray<double>& usGrad) override {
+    void apply(std::span<const T> in, std::span<T> out) override {
+        // e^-|x| of a chunk goes through a stack buffer, as out may be in and the signs are still needed
+        static constexpr size_t chunk = 64;
+        T expX[chunk];
+        for (size_t i = 0; i < in.size(); i += chunk) {
+            const size_t n = std::min(chunk, in.size() - i);
+            for (size_t j = 0; j < n; ++j)
+                expX[j] = -std::abs(in[i + j]);
+            simd::kernels<T>().exp(n, expX, expX);
+            for (size_t j = 0; j < n; ++j)
+                out[i + j] = (1 - expX[j]) * (in[i + j] < 0? -1: 1);
+        }
+    }
+    std::valarray<T> derivative(const std::valarray<T>& y, const std::valarray<T>& usGrad) override {
         return (1 - std::abs(y)) * usGrad;
     }
+    void applyDerivative(std::span<const T> y, std::span<const T> usGrad, std::span<T> out) override {
+        for (size_t i = 0; i < y.size(); ++i)
+            out[i] = (1 - std::abs(y[i])) * usGrad[i];
+    }
 };
 
-static std::unique_ptr<ActivationFunction> buildActivationFunction(const ActivationFunctions& n) {
+template <class T = double>
+static std::unique_ptr<BasicActivationFunction<T>> buildActivationFunction(const ActivationFunctions& n) {
+    switch (n) {
+        case ActivationFunctions::SIGMOID:
+            return std::make_unique<Sigmoid<T>>();
+        case ActivationFunctions::TANH:
+            return std::make_unique<Tanh<T>>();
+        case ActivationFunctions::RELU:
+            return std::make_unique<Relu<T>>();
+        case ActivationFunctions::LEAKYRELU:
+            return std::make_unique<LeakyRelu<T>>();
+        case ActivationFunctions::PRRELU:
+            return std::make_unique<PrRelu<T>>();
+        case ActivationFunctions::SOFTMAX:
+            return std::make_unique<Softmax<T>>();
+        case ActivationFunctions::STABLE_SOFTMAX:
+            return std::make_unique<StableSoftmax<T>>();
+        case ActivationFunctions::STABLE_SOFTMAX_V3:
+            return std::make_unique<StableSoftmaxV3<T>>();
+        case ActivationFunctions::TAYLOR_SOFTMAX:
+            return std::make_unique<TaylorSoftmax<T>>();
+        case ActivationFunctions::CUBEROOT:
+            return std::make_unique<CubeRoot<T>>();
+        case ActivationFunctions::SGNEXP:
+            return std::make_unique<SgnExp<T>>();
+        case ActivationFunctions::INVALID:
+        default:
+            throw std::runtime_error{"cannot build ActivationFunction"};
+    }
+}
+
+// calls f with a concrete activation function object of kind n, so that a layer switches once and the loops behind f
+// make direct, inlinable calls (f.F::apply, f.F::applyDerivative) instead of one virtual call per row
+template <class T = double, class F>
+decltype(auto) visitActivationFunction(ActivationFunctions n, F&& f) {
     switch (n) {
         case ActivationFunctions::SIGMOID:
-            return std::make_unique<Sigmoid>();
+            return f(Sigmoid<T>{});
         case ActivationFunctions::TANH:
-            return std::make_unique<Tanh>();
+            return f(Tanh<T>{});
         case ActivationFunctions::RELU:
-            return std::make_unique<Relu>();
+            return f(Relu<T>{});
         case ActivationFunctions::LEAKYRELU:
-            return std::make_unique<LeakyRelu>();
+            return f(LeakyRelu<T>{});
         case ActivationFunctions::PRRELU:
-            return std::make_unique<PrRelu>();
+            return f(PrRelu<T>{});
         case ActivationFunctions::SOFTMAX:
-            return std::make_unique<Softmax>();
+            return f(Softmax<T>{});
         case ActivationFunctions::STABLE_SOFTMAX:
-            return std::make_unique<StableSoftmax>();
+            return f(StableSoftmax<T>{});
         case ActivationFunctions::STABLE_SOFTMAX_V3:
-            return std::make_unique<StableSoftmaxV3>();
+            return f(StableSoftmaxV3<T>{});
         case ActivationFunctions::TAYLOR_SOFTMAX:
-            return std::make_unique<TaylorSoftmax>();
+// still selectable by enum like everything else; the deprecation is for direct uses
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+            return f(TaylorSoftmax<T>{});
+#pragma GCC diagnostic pop
         case ActivationFunctions::CUBEROOT:
-            return std::make_unique<CubeRoot>();
+            return f(CubeRoot<T>{});
         case ActivationFunctions::SGNEXP:
-            return std::make_unique<SgnExp>();
+            return f(SgnExp<T>{});
         case ActivationFunctions::INVALID:
         default:
             throw std::runtime_error{"cannot build ActivationFunction"};
@@ -1,6 +1,7 @@
 #pragma once
 #include <wx/wx.h>
 #include "network.hpp"
+#include "checkpoint.hpp"
 #include "mnist.hpp"
 
 class MainPanel: public wxPanel {
@@ -9,7 +10,8 @@ class MainPanel: public wxPanel {
     wxCoord xOffset{40};
     wxCoord yOffset{200};
     int gridLength{20};
-    Network n{};
+    // read-only once loaded; inference goes through the const run(), so the model may be shared with other threads
+    std::shared_ptr<const Network> n;
     bool networkValid{false};
     std::valarray<double> result = std::valarray<double>(10);
 
@@ -37,7 +39,7 @@ class MainPanel: public wxPanel {
                         return v / 255.;
                     });
                     // std::valarray<double> classifiedResult = n.run(in);
-                    result = n.run(in);
+                    n->run(std::span<const double>(simd::data(in), in.size()), std::span<double>(simd::data(result), result.size()));
                 }
             }
         }
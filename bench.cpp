@@ -0,0 +1,189 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <new>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include "benchmark_suite.hpp"
+
+// heap allocations made by the current thread, counted by the replaced global operator new below
+thread_local size_t allocationCounts = 0;
+
+// GCC cannot see that these operator new return malloc'd memory, so it flags every free() in the deletes
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t size) {
+    ++allocationCounts;
+    if (void *p = std::malloc(size? size: 1))
+        return p;
+    throw std::bad_alloc{};
+}
+void *operator new(size_t size, std::align_val_t alignment) {
+    ++allocationCounts;
+    const size_t a = static_cast<size_t>(alignment);
+    if (void *p = std::aligned_alloc(a, (size + a - 1) / a * a))
+        return p;
+    throw std::bad_alloc{};
+}
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+#pragma GCC diagnostic pop
+
+// Network::run(span, span, workspace) must not touch the heap once the workspace has grown to fit, whatever the
+// activations; throws std::runtime_error naming the first activation that allocates
+void checkAllocationFreeRun() {
+    for (const auto& [e, name]: benchmarkedActivationFunctions) {
+        const Network network(64, 10, std::vector{48, 32}, std::vector{e, e}, e, LossFunctions::MSE);
+        std::valarray<double> input(64);
+        for (size_t i = 0; i < input.size(); ++i)
+            input[i] = (i % 17) / 2. - 4;
+        std::valarray<double> output(10);
+        Network::Workspace workspace;
+        network.run(std::span<const double>(simd::data(input), 64), std::span<double>(simd::data(output), 10), workspace);
+        const size_t before = allocationCounts;
+        for (int i = 0; i < 100; ++i)
+            network.run(std::span<const double>(simd::data(input), 64), std::span<double>(simd::data(output), 10), workspace);
+        if (allocationCounts != before)
+            throw std::runtime_error{"Network::run allocated "s + std::to_string(allocationCounts - before) + " times in 100 calls with "s + name};
+    }
+}
+
+// every entry of the selected simd::kernels<T>() table against scalarKernels<T>() on random data, within the error
+// bounds simd.hpp documents (float results evaluated in double are allowed one float rounding) and the usual
+// summation bounds for dot/axpy/gemm; throws std::runtime_error naming the first entry that is off
+template <class T>
+void checkKernels() {
+    const simd::BasicKernels<T>& k = simd::kernels<T>();
+    const simd::BasicKernels<T>& r = simd::scalarKernels<T>();
+    if (&k == &r)
+        return;
+    constexpr bool isDouble = std::is_same_v<T, double>;
+    constexpr double eps = std::numeric_limits<T>::epsilon();
+    const double expTolerance = isDouble? 4.5e-16: eps;
+    const double tanhTolerance = isDouble? 5e-16: eps;
+    // odd, so the vector tails run too
+    constexpr ssize_t n = 1003;
+    std::mt19937 gen(42);
+    auto random = [&](double low, double high) {
+        std::uniform_real_distribution<double> d(low, high);
+        std::vector<T> v(n);
+        for (T& x: v)
+            x = d(gen);
+        return v;
+    };
+    auto check = [&](const char *entry, ssize_t i, double error, double bound) {
+        if (!(error <= bound))
+            throw std::runtime_error{k.name + " "s + entry + " is off the scalar reference by "s + std::to_string(error) + " at "s + std::to_string(i)};
+    };
+    std::vector<T> y(n), yRef(n);
+
+    // the finite range of exp in T
+    const std::vector<T> wide = isDouble? random(-700, 700): random(-80, 80);
+    k.exp(n, wide.data(), y.data());
+    r.exp(n, wide.data(), yRef.data());
+    for (ssize_t i = 0; i < n; ++i)
+        check("exp", i, std::abs(y[i] - yRef[i]), expTolerance * std::abs(yRef[i]));
+    const std::vector<T> x = random(-20, 20);
+    k.tanh(n, x.data(), y.data());
+    r.tanh(n, x.data(), yRef.data());
+    for (ssize_t i = 0; i < n; ++i)
+        check("tanh", i, std::abs(y[i] - yRef[i]), tanhTolerance);
+    k.sigmoid(n, x.data(), y.data());
+    r.sigmoid(n, x.data(), yRef.data());
+    for (ssize_t i = 0; i < n; ++i)
+        check("sigmoid", i, std::abs(y[i] - yRef[i]), (expTolerance + eps) * std::abs(yRef[i]));
+    k.leakyRelu(n, T(0.01), x.data(), y.data());
+    r.leakyRelu(n, T(0.01), x.data(), yRef.data());
+    for (ssize_t i = 0; i < n; ++i)
+        check("leakyRelu", i, std::abs(y[i] - yRef[i]), 0);
+    const std::vector<T> usGrad = random(-1, 1);
+    k.leakyReluDerivative(n, T(0.01), x.data(), usGrad.data(), y.data());
+    r.leakyReluDerivative(n, T(0.01), x.data(), usGrad.data(), yRef.data());
+    for (ssize_t i = 0; i < n; ++i)
+        check("leakyReluDerivative", i, std::abs(y[i] - yRef[i]), 0);
+
+    double absDot = 0;
+    for (ssize_t i = 0; i < n; ++i)
+        absDot += std::abs(x[i] * usGrad[i]);
+    check("dot", 0, std::abs(k.dot(n, x.data(), usGrad.data()) - r.dot(n, x.data(), usGrad.data())), n * eps * absDot);
+    y = usGrad;
+    yRef = usGrad;
+    k.axpy(n, T(0.3), x.data(), y.data());
+    r.axpy(n, T(0.3), x.data(), yRef.data());
+    for (ssize_t i = 0; i < n; ++i)
+        check("axpy", i, std::abs(y[i] - yRef[i]), 2 * eps * (std::abs(T(0.3) * x[i]) + std::abs(usGrad[i])));
+
+    simd::UpdateCoefficients c;
+    c.gScale = 0.5;
+    c.learningRate = 1e-3;
+    c.a1 = 0.9, c.b1 = 0.1;
+    c.a2 = 0.999, c.b2 = 0.001;
+    c.eps = 1e-8;
+    c.l2 = 1e-4;
+    c.decay = 1e-5;
+    const std::vector<T> w0 = random(-1, 1), m0 = random(-0.1, 0.1), v0 = random(0, 0.01);
+    std::vector<T> w = w0, m = m0, v = v0, wRef = w0, mRef = m0, vRef = v0;
+    k.optimizerUpdate(n, w.data(), m.data(), v.data(), usGrad.data(), c);
+    r.optimizerUpdate(n, wRef.data(), mRef.data(), vRef.data(), usGrad.data(), c);
+    for (ssize_t i = 0; i < n; ++i) {
+        check("optimizerUpdate m", i, std::abs(m[i] - mRef[i]), 8 * eps * (std::abs(m0[i]) + std::abs(mRef[i])));
+        check("optimizerUpdate v", i, std::abs(v[i] - vRef[i]), 8 * eps * (std::abs(v0[i]) + std::abs(vRef[i])));
+        check("optimizerUpdate w", i, std::abs(w[i] - wRef[i]), 8 * eps * (std::abs(w0[i]) + std::abs(wRef[i] - w0[i])));
+    }
+
+    // sizes off every tile and block multiple
+    constexpr ssize_t rows = 37, cols = 41, depth = 27;
+    const std::vector<T> a = random(-1, 1), b = random(-1, 1);
+    std::vector<T> absA(rows * depth), absB(depth * cols), bound(rows * cols, 0), g(rows * cols, 0), gRef(rows * cols, 0);
+    for (ssize_t i = 0; i < rows * depth; ++i)
+        absA[i] = std::abs(a[i]);
+    for (ssize_t i = 0; i < depth * cols; ++i)
+        absB[i] = std::abs(b[i]);
+    k.gemm(rows, cols, depth, a.data(), depth, b.data(), cols, g.data(), cols);
+    r.gemm(rows, cols, depth, a.data(), depth, b.data(), cols, gRef.data(), cols);
+    r.gemm(rows, cols, depth, absA.data(), depth, absB.data(), cols, bound.data(), cols);
+    for (ssize_t i = 0; i < rows * cols; ++i)
+        check("gemm", i, std::abs(g[i] - gRef[i]), 2 * depth * eps * bound[i]);
+}
+
+// bench [--quick] [--out results.json] [group...]; groups: layer, activation, loss, network, io
+int main(int argc, char *argv[]) {
+    BenchmarkConfig config;
+    std::string out = "benchmark-results.json";
+    std::vector<std::string> groups;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--quick")
+            config = BenchmarkConfig::quick();
+        else if (arg == "--out" && i + 1 < argc)
+            out = argv[++i];
+        else
+            groups.push_back(arg);
+    }
+    try {
+        checkKernels<double>();
+        checkKernels<float>();
+        checkAllocationFreeRun();
+        BenchmarkSuite suite(config);
+        suite.run(groups);
+        suite.writeJson(out);
+        std::cout << suite.getResults().size() << " results written to " << out << "\r\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\r\n";
+        return 1;
+    }
+}
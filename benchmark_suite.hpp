@@ -0,0 +1,318 @@
+#pragma once
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include <string>
+#include <utility>
+#include <thread>
+#include <memory>
+#include <span>
+#include <cmath>
+#include <ctime>
+#include <cstdio>
+#include <filesystem>
+#include "network.hpp"
+#include "layer.hpp"
+#include "activation_functions.hpp"
+#include "loss_functions.hpp"
+#include "checkpoint.hpp"
+#include "thread_pool.hpp"
+#include "simd.hpp"
+
+using namespace std::literals;
+
+// keeps a benchmarked computation from being dropped as dead: v's address escapes into an empty asm that may read any
+// memory, so whatever v holds or points to must be written by then
+template <class T>
+inline void doNotOptimize(const T& v) {
+    asm volatile("" : : "g"(&v) : "memory");
+}
+
+// every valid ActivationFunctions value with the name results use for it
+inline constexpr std::pair<ActivationFunctions, const char *> benchmarkedActivationFunctions[] = {
+    {ActivationFunctions::SIGMOID, "sigmoid"}, {ActivationFunctions::TANH, "tanh"}, {ActivationFunctions::RELU, "relu"},
+    {ActivationFunctions::LEAKYRELU, "leakyRelu"}, {ActivationFunctions::PRRELU, "prRelu"}, {ActivationFunctions::SOFTMAX, "softmax"},
+    {ActivationFunctions::STABLE_SOFTMAX, "stableSoftmax"}, {ActivationFunctions::STABLE_SOFTMAX_V3, "stableSoftmaxV3"},
+    {ActivationFunctions::TAYLOR_SOFTMAX, "taylorSoftmax"}, {ActivationFunctions::CUBEROOT, "cubeRoot"}, {ActivationFunctions::SGNEXP, "sgnExp"},
+};
+
+// Reproducible micro and end-to-end benchmarks on synthetic data (fixed seed, no dataset needed), over a matrix of
+// layer widths, batch sizes and thread counts. Every case is first calibrated to an iteration count that takes at
+// least minRepetitionTime, warmed up warmups times, then timed repetitions times; its per-iteration mean, standard
+// deviation, min and median go to writeJson, one file per commit to compare.
+struct BenchmarkConfig {
+    std::vector<ssize_t> widths{64, 256, 1024};
+    std::vector<ssize_t> batchSizes{1, 32, 256};
+    std::vector<size_t> threadCounts{1, std::max(std::thread::hardware_concurrency(), 1u)};
+    size_t warmups{3};
+    size_t repetitions{15};
+    std::chrono::duration<double> minRepetitionTime{10ms};
+    unsigned seed{42};
+
+    static BenchmarkConfig quick() {
+        BenchmarkConfig config;
+        config.widths = {64, 256};
+        config.batchSizes = {1, 64};
+        config.warmups = 1;
+        config.repetitions = 5;
+        config.minRepetitionTime = 2ms;
+        return config;
+    }
+};
+
+struct BenchmarkResult {
+    std::string group;
+    std::string name;
+    // e.g. {"width", 256}, {"batch", 32}, {"threads", 4}
+    std::vector<std::pair<std::string, double>> parameters;
+    size_t iterations;
+    // per iteration
+    double meanNs;
+    double stddevNs;
+    double minNs;
+    double medianNs;
+    // samples, elements, ... processed per iteration; 0 when not meaningful
+    double items;
+};
+
+class BenchmarkSuite {
+private:
+    using Clock = std::chrono::steady_clock;
+    using Layer = BasicLayer<double>;
+    BenchmarkConfig config;
+    std::vector<BenchmarkResult> results;
+    std::mt19937 gen;
+
+    std::valarray<double> randomValues(size_t n, double low = -1, double high = 1) {
+        std::uniform_real_distribution<double> urd(low, high);
+        std::valarray<double> values(n);
+        for (double& v: values)
+            v = urd(gen);
+        return values;
+    }
+    Matrix randomMatrix(ssize_t rows, ssize_t cols) {
+        Matrix m(rows, cols);
+        std::uniform_real_distribution<double> urd(-1, 1);
+        for (ssize_t i = 0; i < m.size(); ++i)
+            m.data()[i] = urd(gen);
+        return m;
+    }
+    Network makeNetwork(ssize_t width) {
+        return Network(width, 10, std::vector{width}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    }
+    template <class F>
+    double timeIterations(size_t iterations, F& f) {
+        const auto start = Clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+            f();
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+    }
+    template <class F>
+    void measure(const std::string& group, const std::string& name, std::vector<std::pair<std::string, double>> parameters, double items, F&& f) {
+        size_t iterations = 1;
+        while (timeIterations(iterations, f) * iterations < std::chrono::duration<double, std::nano>(config.minRepetitionTime).count() && iterations < (1u << 30))
+            iterations *= 2;
+        for (size_t w = 0; w < config.warmups; ++w)
+            timeIterations(iterations, f);
+        std::vector<double> samples(config.repetitions);
+        for (double& sample: samples)
+            sample = timeIterations(iterations, f);
+        const double mean = std::accumulate(samples.begin(), samples.end(), 0.) / samples.size();
+        double variance = 0;
+        for (double sample: samples)
+            variance += (sample - mean) * (sample - mean);
+        variance /= std::max<size_t>(samples.size() - 1, 1);
+        std::sort(samples.begin(), samples.end());
+        const double median = (samples.size() % 2)? samples[samples.size() / 2]: (samples[samples.size() / 2 - 1] + samples[samples.size() / 2]) / 2;
+        results.push_back({group, name, std::move(parameters), iterations, mean, std::sqrt(variance), samples.front(), median, items});
+        const BenchmarkResult& r = results.back();
+        std::cout << group << "/" << name;
+        for (const auto& [key, value]: r.parameters)
+            std::cout << " " << key << "=" << value;
+        std::cout << ": " << r.meanNs << " ns +- " << 100 * r.stddevNs / r.meanNs << "%";
+        if (items)
+            std::cout << ", " << items / r.meanNs * 1e9 << " items/s";
+        std::cout << "\r\n";
+    }
+
+    void benchmarkLayers() {
+        for (ssize_t width: config.widths) {
+            Layer prev(width, width);
+            Layer layer(width, width, ActivationFunctions::LEAKYRELU);
+            Layer next(width, 0, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+            const std::valarray<double> input = randomValues(width, 0, 1);
+            std::valarray<double> output(width);
+            measure("layer", "forward", {{"width", width}}, 2. * width * width, [&] {
+                layer.forward(prev, simd::data(input), simd::data(output));
+                doNotOptimize(output);
+            });
+            layer.forward(prev);
+            next.forward(layer);
+            next.outputBackward(randomValues(width, 0, 1), 1e-4);
+            measure("layer", "backward", {{"width", width}}, 4. * width * width, [&] {
+                layer.backward(next, 1e-12);
+                doNotOptimize(layer);
+            });
+            for (ssize_t batchSize: config.batchSizes) {
+                const Matrix values = randomMatrix(batchSize, width);
+                const Matrix nextDeltas = randomMatrix(batchSize, width);
+                for (size_t threadCounts: config.threadCounts) {
+                    std::unique_ptr<ThreadPool> threadPool = (threadCounts > 1)? std::make_unique<ThreadPool>(threadCounts): nullptr;
+                    measure("layer", "batchedBackward", {{"width", width}, {"batch", batchSize}, {"threads", threadCounts}}, 4. * batchSize * width * width, [&] {
+                        doNotOptimize(layer.batchedBackward(values, nextDeltas, next, 1e-12, Optimizer{}, threadPool.get()));
+                    });
+                }
+            }
+        }
+    }
+    void benchmarkActivationFunctions() {
+        for (const auto& [e, name]: benchmarkedActivationFunctions) {
+            std::unique_ptr<BasicActivationFunction<double>> f = buildActivationFunction<double>(e);
+            for (ssize_t width: config.widths) {
+                const std::valarray<double> x = randomValues(width, -4, 4);
+                const std::valarray<double> y = (*f)(x);
+                const std::valarray<double> usGrad = randomValues(width);
+                std::valarray<double> out(width);
+                measure("activation", "apply/"s + name, {{"width", width}}, width, [&] {
+                    f->apply(std::span<const double>(simd::data(x), width), std::span<double>(simd::data(out), width));
+                    doNotOptimize(out);
+                });
+                measure("activation", "derivative/"s + name, {{"width", width}}, width, [&] {
+                    doNotOptimize(f->derivative(y, usGrad));
+                });
+                measure("activation", "applyDerivative/"s + name, {{"width", width}}, width, [&] {
+                    f->applyDerivative(std::span<const double>(simd::data(y), width), std::span<const double>(simd::data(usGrad), width), std::span<double>(simd::data(out), width));
+                    doNotOptimize(out);
+                });
+            }
+        }
+    }
+    void benchmarkLossFunctions() {
+        static const std::pair<LossFunctions, const char *> all[] = {
+            {LossFunctions::MSE, "mse"}, {LossFunctions::CROSS_ENTROPY_LOSS, "crossEntropy"}, {LossFunctions::CROSS_ENTROPY_LOSS_V2, "crossEntropyV2"},
+            {LossFunctions::TAN, "tan"}, {LossFunctions::POLICY_GRADIENT_LOSS, "policyGradient"}, {LossFunctions::CUSTOM, "custom"},
+            {LossFunctions::SOFTMAX_CROSS_ENTROPY, "softmaxCrossEntropy"},
+        };
+        for (const auto& [e, name]: all) {
+            std::unique_ptr<BasicLossFunction<double>> f = buildLossFunction<double>(e);
+            for (ssize_t width: config.widths) {
+                std::valarray<double> actual(0., width);
+                actual[0] = 1;
+                const std::valarray<double> predicted = randomValues(width, .01, .99);
+                measure("loss", name, {{"width", width}}, width, [&] {
+                    doNotOptimize((*f)(actual, predicted));
+                });
+            }
+        }
+    }
+    void benchmarkNetworks() {
+        for (ssize_t width: config.widths) {
+            Network n = makeNetwork(width);
+            const std::valarray<double> input = randomValues(width, 0, 1);
+            std::valarray<double> output(10);
+            Network::Workspace workspace;
+            measure("network", "run", {{"width", width}}, 1, [&] {
+                n.run(std::span<const double>(simd::data(input), width), std::span<double>(simd::data(output), 10), workspace);
+                doNotOptimize(output);
+            });
+            for (ssize_t batchSize: config.batchSizes) {
+                const Matrix inputs = randomMatrix(batchSize, width);
+                Matrix outputs(batchSize, 10);
+                for (ssize_t b = 0; b < batchSize; ++b)
+                    outputs(b, b % 10) = 1;
+                for (size_t threadCounts: config.threadCounts) {
+                    n.setThreadCounts(threadCounts);
+                    measure("network", "batchedTrain", {{"width", width}, {"batch", batchSize}, {"threads", threadCounts}}, batchSize, [&] {
+                        n.batchedTrain(inputs, outputs, 1e-12);
+                        doNotOptimize(n);
+                    });
+                }
+                n.setThreadCounts(1);
+            }
+        }
+    }
+    void benchmarkSerialization() {
+        const std::filesystem::path dir = std::filesystem::temp_directory_path();
+        const std::string checkpointLoc = (dir / "nn-benchmark.ckpt").string();
+        const std::string textLoc = (dir / "nn-benchmark.dat").string();
+        for (ssize_t width: config.widths) {
+            const Network n = makeNetwork(width);
+            const double parameters = width * width + width * 10. + 2 * width + 10;
+            measure("io", "checkpoint.save", {{"width", width}}, parameters, [&] {
+                Checkpoint::save(n, checkpointLoc);
+                doNotOptimize(n);
+            });
+            measure("io", "checkpoint.load", {{"width", width}}, parameters, [&] {
+                doNotOptimize(loadNetwork(checkpointLoc));
+            });
+            measure("io", "text.save", {{"width", width}}, parameters, [&] {
+                std::ofstream ofs(textLoc, std::ios::binary);
+                ofs << n;
+                doNotOptimize(ofs);
+            });
+            measure("io", "text.load", {{"width", width}}, parameters, [&] {
+                doNotOptimize(loadNetwork(textLoc));
+            });
+        }
+        std::remove(checkpointLoc.c_str());
+        std::remove(textLoc.c_str());
+    }
+public:
+    explicit BenchmarkSuite(BenchmarkConfig config = {}): config(std::move(config)), gen(this->config.seed) {
+        std::sort(this->config.threadCounts.begin(), this->config.threadCounts.end());
+        this->config.threadCounts.erase(std::unique(this->config.threadCounts.begin(), this->config.threadCounts.end()), this->config.threadCounts.end());
+    }
+
+    // groups: layer, activation, loss, network, io; empty runs them all
+    void run(const std::vector<std::string>& groups = {}) {
+        auto selected = [&groups](const char *group) {
+            return groups.empty() || std::find(groups.begin(), groups.end(), group) != groups.end();
+        };
+        if (selected("layer"))
+            benchmarkLayers();
+        if (selected("activation"))
+            benchmarkActivationFunctions();
+        if (selected("loss"))
+            benchmarkLossFunctions();
+        if (selected("network"))
+            benchmarkNetworks();
+        if (selected("io"))
+            benchmarkSerialization();
+    }
+    const std::vector<BenchmarkResult>& getResults() const noexcept {
+        return results;
+    }
+    void writeJson(std::ostream& os) const {
+        const std::time_t now = std::time(nullptr);
+        char timestamp[32];
+        std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+#ifdef __VERSION__
+        const char *compiler = __VERSION__;
+#else
+        const char *compiler = "unknown";
+#endif
+        os.precision(9);
+        os << "{\n  \"context\": {\"timestamp\": \"" << timestamp << "\", \"compiler\": \"" << compiler << "\", \"kernels\": \"" << simd::kernels<double>().name
+            << "\", \"hardwareThreads\": " << std::thread::hardware_concurrency() << ", \"seed\": " << config.seed << ", \"warmups\": " << config.warmups
+            << ", \"repetitions\": " << config.repetitions << ", \"minRepetitionSeconds\": " << config.minRepetitionTime.count() << "},\n  \"results\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchmarkResult& r = results[i];
+            os << (i? ",\n": "\n") << "    {\"group\": \"" << r.group << "\", \"name\": \"" << r.name << "\", \"parameters\": {";
+            for (size_t p = 0; p < r.parameters.size(); ++p)
+                os << (p? ", ": "") << "\"" << r.parameters[p].first << "\": " << r.parameters[p].second;
+            os << "}, \"iterations\": " << r.iterations << ", \"meanNs\": " << r.meanNs << ", \"stddevNs\": " << r.stddevNs
+                << ", \"minNs\": " << r.minNs << ", \"medianNs\": " << r.medianNs << ", \"itemsPerSecond\": " << (r.items? r.items / r.meanNs * 1e9: 0) << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+    void writeJson(const std::string& loc) const {
+        std::ofstream ofs(loc);
+        if (!ofs)
+            throw std::runtime_error{"can't open "s + loc + " to write the benchmark results"s};
+        writeJson(ofs);
+    }
+};
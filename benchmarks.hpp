@@ -0,0 +1,581 @@
+#pragma once
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <span>
+#include <array>
+#include <iomanip>
+#include "network.hpp"
+#include "idx.hpp"
+#include "mnist.hpp"
+#include "checkpoint.hpp"
+#include "quantized.hpp"
+#include "inference_server.hpp"
+#include "data_loader.hpp"
+#include "sharded_dataset.hpp"
+#include "static_network.hpp"
+#include "utils.hpp"
+
+using namespace std::literals;
+
+inline std::valarray<std::valarray<double>> syntheticImages(size_t counts, size_t size = 28*28, unsigned seed = 42) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> urd(0., 1.);
+    std::valarray<std::valarray<double>> images(std::valarray<double>(size), counts);
+    for (auto& image: images)
+        for (auto& pixel: image)
+            pixel = (urd(gen) < .8)? 0.: urd(gen);
+    return images;
+}
+
+// forward-pass latency of the 784-128-10 topology used by samples.hpp::mnist()
+inline void benchmarkMnistForward(size_t iterations = 20'000) {
+    Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    auto images = syntheticImages(256);
+    double sink = 0;
+    for (size_t i = 0; i < images.size(); ++i)
+        sink += n.run(images[i])[0];
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        sink += n.run(images[i % images.size()])[0];
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "mnist forward (784-128-10): " << elapsed.count() / iterations << " us/run" << " (checksum " << sink << ")" << "\r\n";
+}
+
+// single-sample latency of run(valarray), which returns a fresh valarray, against the allocation-free run(span, span)
+inline void benchmarkMnistAllocationFreeRun(size_t iterations = 20'000) {
+    Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    auto images = syntheticImages(256);
+    std::valarray<double> output(10);
+    double sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        sink += n.run(images[i % images.size()])[0];
+    std::chrono::duration<double, std::micro> allocating = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        const std::valarray<double>& image = images[i % images.size()];
+        n.run(std::span<const double>(simd::data(image), image.size()), std::span<double>(simd::data(output), output.size()));
+        sink += output[0];
+    }
+    std::chrono::duration<double, std::micro> arena = std::chrono::steady_clock::now() - start;
+    std::cout << "run(valarray): " << allocating.count() / iterations << " us/run, run(span): " << arena.count() / iterations << " us/run" << " (checksum " << sink << ")" << "\r\n";
+}
+
+// Concurrent serving: 1, 2, 4, ... threads up to maxThreadCounts share one read-only network, each scoring
+// samplesPerThread samples through the const run() with its own workspace; samples/s and speedup over one thread
+inline void benchmarkMnistConcurrentInference(size_t maxThreadCounts = std::thread::hardware_concurrency(), size_t samplesPerThread = 20'000) {
+    const Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    const auto images = syntheticImages(256);
+    double baseline = 0;
+    for (size_t threadCounts = 1; threadCounts <= std::max<size_t>(maxThreadCounts, 1); threadCounts *= 2) {
+        std::vector<double> sinks(threadCounts);
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < threadCounts; ++t) {
+            threads.emplace_back([&n, &images, &sinks, t, samplesPerThread] {
+                Network::Workspace workspace;
+                std::valarray<double> output(10);
+                for (size_t i = 0; i < samplesPerThread; ++i) {
+                    const std::valarray<double>& image = images[(i + t) % images.size()];
+                    n.run(std::span<const double>(simd::data(image), image.size()), std::span<double>(simd::data(output), output.size()), workspace);
+                    sinks[t] += output[0];
+                }
+            });
+        }
+        for (std::thread& thread: threads)
+            thread.join();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const double throughput = threadCounts * samplesPerThread / elapsed.count();
+        if (threadCounts == 1)
+            baseline = throughput;
+        std::cout << "concurrent run() (" << threadCounts << " threads): " << throughput << " samples/s, speedup " << throughput / baseline << " (checksum " << std::accumulate(sinks.begin(), sinks.end(), 0.) << ")" << "\r\n";
+    }
+}
+
+// scoring throughput of run() one sample at a time against runBatch() on the same inputs
+inline void benchmarkMnistBatchInference(size_t counts = 8192, size_t batchSize = 256) {
+    Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    Matrix images(syntheticImages(counts));
+    double sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (ssize_t i = 0; i < images.rows(); ++i)
+        sink += n.run(images.row(i).toValarray())[0];
+    std::chrono::duration<double> single = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (ssize_t i = 0; i + batchSize <= images.rows(); i += batchSize) {
+        Matrix inputs(batchSize, images.cols());
+        std::copy(images.rowData(i), images.rowData(i + batchSize), inputs.data());
+        sink += n.runBatch(inputs)(0, 0);
+    }
+    std::chrono::duration<double> batched = std::chrono::steady_clock::now() - start;
+    std::cout << "run(): " << counts / single.count() << " samples/s, runBatch(" << batchSize << "): " << counts / batched.count() << " samples/s" << " (checksum " << sink << ")" << "\r\n";
+}
+
+// mini-batch training throughput of the mnist topology; the network keeps one pool for all batches
+inline void benchmarkMnistBatchedTrain(size_t threadCounts = std::thread::hardware_concurrency(), size_t batchSize = 64, size_t batches = 200) {
+    Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    n.setThreadCounts(threadCounts);
+    Matrix images(syntheticImages(batchSize));
+    Matrix labels(batchSize, 10);
+    for (ssize_t i = 0; i < labels.rows(); ++i)
+        labels(i, i % 10) = 1;
+    n.batchedTrain(images, labels, .000'1);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t b = 0; b < batches; ++b)
+        n.batchedTrain(images, labels, .000'1);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "batchedTrain (" << threadCounts << " threads, batch " << batchSize << "): " << batches * batchSize / elapsed.count() << " samples/s" << "\r\n";
+}
+
+// external: the benchmark thread adds every task; nested: one producer task per thread adds them from inside the pool
+template <class Pool>
+void benchmarkThreadPool(const char *name, size_t threadCounts, size_t taskCounts, bool nested) {
+    using Clock = std::chrono::steady_clock;
+    Pool pool(threadCounts);
+    std::vector<double> latencies(taskCounts);
+    auto produce = [&pool, &latencies](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            pool.addTasks([](Clock::time_point submitted, double *latency) {
+                *latency = std::chrono::duration<double, std::micro>(Clock::now() - submitted).count();
+            }, Clock::now(), &latencies[i]);
+        }
+    };
+    auto start = Clock::now();
+    if (nested) {
+        const size_t share = (taskCounts + threadCounts - 1) / threadCounts;
+        for (size_t begin = 0; begin < taskCounts; begin += share)
+            pool.addTasks(produce, begin, std::min(begin + share, taskCounts));
+    } else {
+        produce(0, taskCounts);
+    }
+    pool.wait();
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+    };
+    std::cout << name << (nested? " nested": " external") << " (" << threadCounts << " threads): " << taskCounts / elapsed.count() << " tasks/s, latency p50 " << percentile(.5) << " us, p99 " << percentile(.99) << " us, p99.9 " << percentile(.999) << " us" << "\r\n";
+}
+
+// throughput and add-to-start latency of tiny tasks, work-stealing ThreadPool against the old shared-queue pool
+inline void benchmarkThreadPools(size_t taskCounts = 200'000) {
+    for (bool nested: {false, true}) {
+        for (size_t threadCounts: {1, 2, 4, 8, 16, 32, 64}) {
+            benchmarkThreadPool<SharedQueueThreadPool>("shared queue", threadCounts, taskCounts, nested);
+            benchmarkThreadPool<ThreadPool>("work stealing", threadCounts, taskCounts, nested);
+        }
+    }
+}
+
+// Data-parallel scaling of batchedTrain on the mnist topology: samples/s and speedup over one thread for
+// 1, 2, 4, ... threads up to maxThreadCounts
+inline void benchmarkMnistDataParallelTrain(size_t maxThreadCounts = std::thread::hardware_concurrency(), size_t batchSize = 256, size_t batches = 50) {
+    Matrix images(syntheticImages(batchSize));
+    Matrix labels(batchSize, 10);
+    for (ssize_t i = 0; i < labels.rows(); ++i)
+        labels(i, i % 10) = 1;
+    double baseline = 0;
+    for (size_t threadCounts = 1; threadCounts <= std::max<size_t>(maxThreadCounts, 1); threadCounts *= 2) {
+        Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+        n.setThreadCounts(threadCounts);
+        n.batchedTrain(images, labels, .000'1);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t b = 0; b < batches; ++b)
+            n.batchedTrain(images, labels, .000'1);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const double throughput = batches * batchSize / elapsed.count();
+        if (threadCounts == 1)
+            baseline = throughput;
+        std::cout << "data-parallel batchedTrain (" << threadCounts << " threads, batch " << batchSize << "): " << throughput << " samples/s, speedup " << throughput / baseline << "\r\n";
+    }
+}
+
+// resident set size of this process in bytes, 0 where /proc is unavailable
+inline size_t residentBytes() {
+    size_t pages = 0;
+    size_t resident = 0;
+    if (std::ifstream ifs{"/proc/self/statm"})
+        ifs >> pages >> resident;
+#ifdef _SC_PAGESIZE
+    return resident * ::sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+// startup time and resident memory of the train and t10k sets: IdxFile maps the bytes and converts one batch on demand,
+// loadImages/loadLabels widen every pixel to double up front
+inline void benchmarkMnistLoad(const std::string& dir = "", size_t batchSize = 64) {
+    for (const char *set: {"train", "t10k"}) {
+        const std::string imagesLoc = dir + set + "-images.idx3-ubyte"s;
+        const std::string labelsLoc = dir + set + "-labels.idx1-ubyte"s;
+        size_t before = residentBytes();
+        auto start = std::chrono::steady_clock::now();
+        IdxFile images{imagesLoc, 3};
+        IdxFile labels{labelsLoc, 1};
+        std::chrono::duration<double, std::milli> opened = std::chrono::steady_clock::now() - start;
+        std::vector<size_t> indices(images.counts());
+        std::iota(indices.begin(), indices.end(), 0);
+        Matrix batchedImages;
+        Matrix batchedLabels;
+        double sink = 0;
+        start = std::chrono::steady_clock::now();
+        for (size_t b = 0; b + batchSize <= indices.size(); b += batchSize) {
+            images.gather(&indices[b], batchSize, batchedImages, 1. / 255);
+            labels.gatherOneHot(&indices[b], batchSize, batchedLabels, 10);
+            sink += batchedImages(0, 0) + batchedLabels(0, 0);
+        }
+        std::chrono::duration<double, std::milli> converted = std::chrono::steady_clock::now() - start;
+        const size_t mappedResident = residentBytes() - before;
+
+        before = residentBytes();
+        start = std::chrono::steady_clock::now();
+        std::valarray<std::valarray<double>> eagerImages{loadImages(imagesLoc)};
+        std::valarray<double> eagerLabels{loadLabels(labelsLoc)};
+        std::chrono::duration<double, std::milli> loaded = std::chrono::steady_clock::now() - start;
+        const size_t eagerResident = residentBytes() - before;
+        sink += eagerImages[0][0] + eagerLabels[0];
+
+        std::cout << set << " (" << images.counts() << " images): mapped in " << opened.count() << " ms, every batch of " << batchSize << " converted in " << converted.count() << " ms, " << mappedResident / (1 << 20) << " MiB resident; "
+                  << "loadImages/loadLabels " << loaded.count() << " ms, " << eagerResident / (1 << 20) << " MiB resident" << " (checksum " << sink << ")" << "\r\n";
+    }
+}
+
+template <class T, class M>
+void benchmarkMnistPrecisionOf(const char *name, size_t batchSize, size_t batches) {
+    BasicNetwork<T, M> n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    const Matrix wide(syntheticImages(batchSize));
+    BasicMatrix<T> images(wide.rows(), wide.cols());
+    std::copy(wide.data(), wide.data() + wide.size(), images.data());
+    BasicMatrix<T> labels(batchSize, 10);
+    for (ssize_t i = 0; i < labels.rows(); ++i)
+        labels(i, i % 10) = 1;
+    double sink = 0;
+    n.batchedTrain(images, labels, .000'1);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t b = 0; b < batches; ++b)
+        sink += n.runBatch(images)(0, 0);
+    std::chrono::duration<double> inference = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (size_t b = 0; b < batches; ++b)
+        n.batchedTrain(images, labels, .000'1);
+    std::chrono::duration<double> training = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": runBatch(" << batchSize << ") " << batches * batchSize / inference.count() << " samples/s, batchedTrain " << batches * batchSize / training.count() << " samples/s" << " (checksum " << sink << ")" << "\r\n";
+}
+
+// inference and training throughput of the mnist topology at each precision: fp64, fp32, and fp32 with fp64 master weights
+inline void benchmarkMnistPrecision(size_t batchSize = 256, size_t batches = 100) {
+    benchmarkMnistPrecisionOf<double, double>("double", batchSize, batches);
+    benchmarkMnistPrecisionOf<float, float>("float", batchSize, batches);
+    benchmarkMnistPrecisionOf<float, double>("mixed (float, double master)", batchSize, batches);
+}
+
+// int8 post-training quantization of a trained mnist network: accuracy on t10k through test(), and single-sample latency
+// of both, one image at a time through Network::predict and QuantizedNetwork::run, with calibrationCounts t10k images
+// as the calibration set
+inline void benchmarkMnistQuantization(const std::string& networkLoc = "mnist-v4.dat", const std::string& dir = "", size_t calibrationCounts = 1000) {
+    Network n = loadNetwork(networkLoc);
+    IdxFile calibrationImages{dir + "t10k-images.idx3-ubyte"s, 3};
+    Matrix calibration;
+    calibrationImages.rows(0, std::min(calibrationCounts, calibrationImages.counts()), calibration, 1. / 255);
+    auto start = std::chrono::steady_clock::now();
+    QuantizedNetwork q(n, calibration);
+    std::chrono::duration<double, std::milli> quantizing = std::chrono::steady_clock::now() - start;
+
+    std::valarray<double> testLabels{loadLabels(dir + "t10k-labels.idx1-ubyte"s)};
+    std::valarray<std::valarray<double>> testImages{loadImages(dir + "t10k-images.idx3-ubyte"s)};
+    for (std::valarray<double>& image: testImages)
+        image /= 255;
+    auto predicts = [](const std::valarray<double>& predicted, const double& actual) {
+        return getGreatestLabel(predicted) == actual;
+    };
+    const double accuracy = n.test(testImages, testLabels, predicts);
+    const double quantizedAccuracy = q.test(testImages, testLabels, predicts);
+    double sink = 0;
+    start = std::chrono::steady_clock::now();
+    for (const std::valarray<double>& image: testImages)
+        sink += n.predict(image)[0];
+    std::chrono::duration<double, std::micro> fp64 = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (const std::valarray<double>& image: testImages)
+        sink += q.run(image)[0];
+    std::chrono::duration<double, std::micro> int8 = std::chrono::steady_clock::now() - start;
+    std::cout << "int8 quantization (" << simd::int8Kernels().name << ", " << quantizing.count() << " ms on " << calibration.rows() << " samples): "
+        << "accuracy " << accuracy << " -> " << quantizedAccuracy << " (delta " << quantizedAccuracy - accuracy << "), "
+        << "latency " << fp64.count() / testImages.size() << " -> " << int8.count() / testImages.size() << " us/run, "
+        << "parameters " << q.parameterCounts() * sizeof(double) << " -> " << q.parameterBytes() << " bytes" << " (checksum " << sink << ")" << "\r\n";
+}
+
+// Open-loop load generator against an InferenceServer: clientCounts connections together send qps requests per second
+// for duration, and each latency runs from the request's scheduled send time, so a backed-up server is not hidden
+// behind a slower send rate. Reports p50/p99 latency against QPS for one batching setting per line.
+inline void benchmarkMicroBatchingServer(const std::vector<double>& qpsList = {1000, 2000, 4000, 8000}, size_t maxBatchSize = 32, std::chrono::microseconds maxWait = 500us, size_t clientCounts = 16, std::chrono::milliseconds duration = 2000ms, const std::string& path = "/tmp/nn-inference.sock") {
+    using Clock = std::chrono::steady_clock;
+    const Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    std::vector<std::array<uint8_t, 28*28>> images(256);
+    std::mt19937 gen(42);
+    for (auto& image: images)
+        for (uint8_t& pixel: image)
+            pixel = (gen() % 5)? 0: gen() % 256;
+    for (double qps: qpsList) {
+        MicroBatcher batcher(n, maxBatchSize, maxWait);
+        InferenceServer server(batcher, path);
+        std::vector<std::vector<double>> latencies(clientCounts);
+        std::vector<std::thread> clients;
+        const auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(clientCounts / qps));
+        const auto start = Clock::now();
+        for (size_t c = 0; c < clientCounts; ++c) {
+            clients.emplace_back([&, c] {
+                InferenceClient client(path);
+                // clients start staggered over one interval
+                auto scheduled = start + interval * c / clientCounts;
+                for (size_t i = 0; scheduled < start + duration; ++i, scheduled += interval) {
+                    std::this_thread::sleep_until(scheduled);
+                    client.classify(images[(i * clientCounts + c) % images.size()].data());
+                    latencies[c].push_back(std::chrono::duration<double, std::micro>(Clock::now() - scheduled).count());
+                }
+            });
+        }
+        for (std::thread& client: clients)
+            client.join();
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        std::vector<double> all;
+        for (const auto& l: latencies)
+            all.insert(all.end(), l.begin(), l.end());
+        std::sort(all.begin(), all.end());
+        auto percentile = [&all](double p) {
+            return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))];
+        };
+        std::cout << "micro-batching (max batch " << maxBatchSize << ", max wait " << maxWait.count() << " us) at " << qps << " qps: served " << all.size() / elapsed.count() << " qps, "
+            << "latency p50 " << percentile(.5) << " us, p99 " << percentile(.99) << " us, mean batch " << batcher.meanBatchSize() << "\r\n";
+    }
+}
+
+// one epoch of batchedTrain on synthetic mnist-sized data: batches built the way utils.hpp::train used to, by shuffled
+// copies of the whole set through reorder() and batch(), against DataLoader gathering the next batch in the background
+inline void benchmarkDataLoader(size_t counts = 20'000, size_t batchSize = 64) {
+    const auto images = syntheticImages(counts);
+    std::valarray<std::valarray<double>> labels(std::valarray<double>(10), counts);
+    for (size_t i = 0; i < counts; ++i)
+        labels[i][i % 10] = 1;
+    Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<size_t> indices = generateShuffledIndices(counts);
+        auto batchedInputs = batch(reorder(images, indices), batchSize);
+        auto batchedOutputs = batch(reorder(labels, indices), batchSize);
+        for (size_t b = 0; b < batchedInputs.size(); ++b)
+            n.batchedTrain(batchedInputs[b], batchedOutputs[b], .000'1 * batchSize);
+    }
+    std::chrono::duration<double> copied = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    {
+        DataLoader loader(counts, batchSize, gatherFrom(images, labels));
+        loader.startEpoch();
+        const Matrix *batchInputs, *batchOutputs;
+        while (loader.next(batchInputs, batchOutputs))
+            n.batchedTrain(*batchInputs, *batchOutputs, .000'1 * batchSize);
+    }
+    std::chrono::duration<double> loaded = std::chrono::steady_clock::now() - start;
+    std::cout << "epoch of " << counts << " samples: reorder/batch copies " << copied.count() << " s, DataLoader " << loaded.count() << " s" << "\r\n";
+}
+
+// one training epoch of the mnist topology over the IDX train set: DataLoader on the whole mapped set (the in-memory
+// case, once its pages are resident) against ShardedIdxDataset streaming it in chunks; samples/s and resident growth
+inline void benchmarkOutOfCoreTrain(const std::string& dir = "", size_t batchSize = 64, size_t chunkSamples = 4096, size_t windowChunks = 4) {
+    const std::string imagesLoc = dir + "train-images.idx3-ubyte"s;
+    const std::string labelsLoc = dir + "train-labels.idx1-ubyte"s;
+    auto epoch = [batchSize](auto& batches, size_t counts) {
+        Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+        const size_t before = residentBytes();
+        const auto start = std::chrono::steady_clock::now();
+        batches.startEpoch();
+        const Matrix *batchInputs, *batchOutputs;
+        while (batches.next(batchInputs, batchOutputs))
+            n.batchedTrain(*batchInputs, *batchOutputs, .000'1 * batchSize);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return std::make_pair(counts / elapsed.count(), (residentBytes() - std::min(before, residentBytes())) / 1e6);
+    };
+    IdxFile images{imagesLoc, 3};
+    IdxFile labels{labelsLoc, 1};
+    DataLoader inMemory(images.counts(), batchSize, gatherFrom(images, labels));
+    // touch every page first so the baseline is really resident
+    epoch(inMemory, images.counts());
+    const auto [memoryThroughput, memoryGrowth] = epoch(inMemory, images.counts());
+    ShardedIdxDataset streamed({{imagesLoc, labelsLoc}}, batchSize, chunkSamples, windowChunks);
+    const auto [streamedThroughput, streamedGrowth] = epoch(streamed, streamed.counts());
+    std::cout << "epoch over " << imagesLoc << ": in memory " << memoryThroughput << " samples/s, streamed (" << chunkSamples << "-sample chunks, window " << windowChunks << ") "
+        << streamedThroughput << " samples/s (" << 100 * streamedThroughput / memoryThroughput << "%), resident growth " << memoryGrowth << " MB / " << streamedGrowth << " MB" << "\r\n";
+}
+
+// t10k evaluation of a trained mnist network: the serial per-sample loop test() used to be against evaluate() for each
+// thread count, which also yields the confusion matrix and the mean loss
+inline void benchmarkMnistEvaluation(const std::string& networkLoc = "mnist-v4.dat", const std::string& dir = "", const std::vector<size_t>& threadCountsList = {1, 2, 4, 8}) {
+    Network n = loadNetwork(networkLoc);
+    std::valarray<double> testLabels{loadLabels(dir + "t10k-labels.idx1-ubyte"s)};
+    std::valarray<std::valarray<double>> testImages{loadImages(dir + "t10k-images.idx3-ubyte"s)};
+    for (std::valarray<double>& image: testImages)
+        image /= 255;
+    auto start = std::chrono::steady_clock::now();
+    size_t correctCounts = 0;
+    for (size_t i = 0; i < testImages.size(); ++i)
+        correctCounts += getGreatestLabel(n.run(testImages[i])) == testLabels[i];
+    std::chrono::duration<double, std::milli> serial = std::chrono::steady_clock::now() - start;
+    std::cout << "serial run() loop: accuracy " << correctCounts / static_cast<double>(testImages.size()) << ", " << serial.count() << " ms" << "\r\n";
+    for (size_t threadCounts: threadCountsList) {
+        n.setThreadCounts(threadCounts);
+        start = std::chrono::steady_clock::now();
+        const Evaluation evaluation = n.evaluate(testImages, testLabels);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "evaluate() on " << threadCounts << " threads: accuracy " << evaluation.accuracy() << ", mean loss " << evaluation.meanLoss
+            << ", " << elapsed.count() << " ms (" << serial.count() / elapsed.count() << "x)" << "\r\n";
+    }
+    const Evaluation evaluation = n.evaluate(testImages, testLabels);
+    std::cout << "confusion (rows actual, columns predicted):" << "\r\n";
+    for (size_t actual = 0; actual < evaluation.classCounts; ++actual) {
+        for (size_t predicted = 0; predicted < evaluation.classCounts; ++predicted)
+            std::cout << std::setw(6) << evaluation.confusionOf(actual, predicted);
+        std::cout << "\r\n";
+    }
+}
+
+// single-sample latency of the mnist topology: Network::run with a workspace against the compile-time StaticNetwork
+// copied from it
+inline void benchmarkMnistStaticNetwork(size_t iterations = 20'000) {
+    const Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    const StaticNetwork<28*28, 128, 10, LeakyRelu, StableSoftmaxV3> s(n);
+    auto images = syntheticImages(256);
+    std::valarray<double> output(10);
+    Network::Workspace workspace;
+    double sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        n.run(std::span<const double>(simd::data(images[i % images.size()]), 28*28), std::span<double>(simd::data(output), 10), workspace);
+        sink += output[0];
+    }
+    std::chrono::duration<double, std::micro> dynamic = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        s.run(std::span<const double, 28*28>(simd::data(images[i % images.size()]), 28*28), std::span<double, 10>(simd::data(output), 10));
+        sink += output[0];
+    }
+    std::chrono::duration<double, std::micro> fixed = std::chrono::steady_clock::now() - start;
+    double maxDiff = 0;
+    for (const std::valarray<double>& image: images)
+        maxDiff = std::max(maxDiff, std::abs(n.predict(image) - s.run(image)).max());
+    std::cout << "mnist run (" << simd::kernels().name << "): Network " << dynamic.count() / iterations << " us, StaticNetwork " << fixed.count() / iterations
+        << " us (" << dynamic.count() / fixed.count() << "x), max output difference " << maxDiff << " (checksum " << sink << ")" << "\r\n";
+}
+
+// the output layer of the MNIST network as STABLE_SOFTMAX_V3 + CROSS_ENTROPY_LOSS_V2 and as STABLE_SOFTMAX +
+// SOFTMAX_CROSS_ENTROPY: training throughput, and accuracy on a learnable synthetic task (the class is the brightest of
+// the first 10 pixels)
+inline void benchmarkMnistSoftmaxCrossEntropy(size_t batchSize = 64, size_t epochs = 5, size_t counts = 4096) {
+    auto images = syntheticImages(counts);
+    std::valarray<double> labels(counts);
+    Matrix inputs(images);
+    Matrix outputs(counts, 10);
+    for (size_t i = 0; i < counts; ++i) {
+        labels[i] = std::max_element(std::begin(images[i]), std::begin(images[i]) + 10) - std::begin(images[i]);
+        outputs(i, static_cast<size_t>(labels[i])) = 1;
+    }
+    auto run = [&](const char *name, ActivationFunctions activation, LossFunctions loss) {
+        Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, activation, loss);
+        n.setOptimizer(buildOptimizer(Optimizers::ADAM));
+        Matrix batchInputs(batchSize, 28*28);
+        Matrix batchOutputs(batchSize, 10);
+        std::chrono::duration<double> elapsed{0};
+        for (size_t e = 0; e < epochs; ++e) {
+            for (size_t b = 0; b + batchSize <= counts; b += batchSize) {
+                std::copy(inputs.rowData(b), inputs.rowData(b + batchSize), batchInputs.data());
+                std::copy(outputs.rowData(b), outputs.rowData(b + batchSize), batchOutputs.data());
+                auto start = std::chrono::steady_clock::now();
+                n.batchedTrain(batchInputs, batchOutputs, .001);
+                elapsed += std::chrono::steady_clock::now() - start;
+            }
+        }
+        const Evaluation evaluation = n.evaluate(images, labels);
+        std::cout << name << ": batchedTrain " << epochs * (counts / batchSize) * batchSize / elapsed.count() << " samples/s, accuracy "
+            << evaluation.accuracy() << ", mean loss " << evaluation.meanLoss << "\r\n";
+    };
+    run("stableSoftmaxV3 + crossEntropyV2", ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
+    run("stableSoftmax + softmaxCrossEntropy", ActivationFunctions::STABLE_SOFTMAX, LossFunctions::SOFTMAX_CROSS_ENTROPY);
+}
+
+// training through a DataLoader on classCounts classes, with one-hot target rows and with the class indices as sparse
+// targets; the two update the weights identically
+inline void benchmarkSparseLabels(size_t classCounts = 2000, size_t counts = 8192, size_t batchSize = 64, size_t batches = 100) {
+    auto images = syntheticImages(counts);
+    std::valarray<double> labels(counts);
+    std::mt19937 gen(42);
+    for (double& label: labels)
+        label = std::uniform_int_distribution<size_t>(0, classCounts - 1)(gen);
+    auto run = [&](const char *name, const auto& targets, size_t targetBytes) {
+        Network n(28*28, classCounts, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX, LossFunctions::SOFTMAX_CROSS_ENTROPY);
+        DataLoader loader(counts, batchSize, gatherFrom(images, targets), true, 7);
+        const Matrix *batchInputs, *batchOutputs;
+        size_t trained = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (trained < batches) {
+            loader.startEpoch();
+            for (; trained < batches && loader.next(batchInputs, batchOutputs); ++trained)
+                n.batchedTrain(*batchInputs, *batchOutputs, .001);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << name << " labels, " << classCounts << " classes: " << batches * batchSize / elapsed.count() << " samples/s, targets "
+            << targetBytes / 1e6 << " MB" << "\r\n";
+    };
+    {
+        std::valarray<std::valarray<double>> oneHot(std::valarray<double>(classCounts), counts);
+        for (size_t i = 0; i < counts; ++i)
+            oneHot[i][static_cast<size_t>(labels[i])] = 1;
+        run("one-hot", oneHot, counts * classCounts * sizeof(double));
+    }
+    run("sparse", labels, counts * sizeof(double));
+}
+
+// bag-of-words style training, features wide with nonZeros ones per sample: dense batches against CSR batches, the
+// latter with SGD (only the active weight rows stepped, exactly) and with lazy Adam
+inline void benchmarkSparseInputs(size_t features = 100'000, size_t nonZeros = 8, size_t batchSize = 64, size_t batches = 20) {
+    std::mt19937 gen(42);
+    Matrix dense(batchSize, features);
+    SparseMatrix sparse(features);
+    Matrix labels(batchSize, 1);
+    for (size_t i = 0; i < batchSize; ++i) {
+        std::vector<uint32_t> columns;
+        while (columns.size() < nonZeros) {
+            const uint32_t c = std::uniform_int_distribution<uint32_t>(0, features - 1)(gen);
+            if (std::find(columns.begin(), columns.end(), c) == columns.end())
+                columns.push_back(c);
+        }
+        const std::vector<double> values(nonZeros, 1.);
+        sparse.addRow(columns, values);
+        for (uint32_t c: columns)
+            dense(i, c) = 1;
+        labels(i, 0) = i % 10;
+    }
+    auto run = [&](const char *name, const auto& inputs, Optimizer optimizer) {
+        Network n(features, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX, LossFunctions::SOFTMAX_CROSS_ENTROPY);
+        n.setOptimizer(optimizer);
+        n.batchedTrain(inputs, labels, .01);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t b = 0; b < batches; ++b)
+            n.batchedTrain(inputs, labels, .01);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << name << " (" << features << " features, " << nonZeros << " non-zeros): " << batches * batchSize / elapsed.count() << " samples/s" << "\r\n";
+    };
+    Optimizer lazyAdam = buildOptimizer(Optimizers::ADAM);
+    lazyAdam.lazy = true;
+    run("dense batchedTrain, sgd", dense, buildOptimizer(Optimizers::SGD));
+    run("sparse batchedTrain, sgd", sparse, buildOptimizer(Optimizers::SGD));
+    run("dense batchedTrain, adam", dense, buildOptimizer(Optimizers::ADAM));
+    run("sparse batchedTrain, adam", sparse, buildOptimizer(Optimizers::ADAM));
+    run("sparse batchedTrain, lazy adam", sparse, lazyAdam);
+}
@@ -0,0 +1,375 @@
+#pragma once
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "network.hpp"
+#include "mapped_file.hpp"
+#include "gemm.hpp"
+#include "traits.hpp"
+
+using namespace std::literals;
+
+// Binary Network checkpoint, little-endian:
+//   CheckpointHeader (128 bytes)
+//   CheckpointLayer for every layer, input first
+//   tensor sections, each starting on a 64-byte boundary: biases, weights (row-major) and, with the optimizer state
+//   flag, the momentum and rmsprop buffers of both
+// dataType is the parameter precision (FLOAT64 or FLOAT32): the master precision M of a BasicNetwork<T, M>, which
+// load() converts from as needed. checksum covers everything after the header, zero-padded to 8-byte words. A mapped checkpoint is 64-byte aligned throughout, so its weights can
+// be used in place (Checkpoint::runBatch) as well as copied into a Network (Checkpoint::load).
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t dataType;
+    uint32_t layerCounts;
+    uint32_t flags;
+    uint32_t optimizerKind;
+    double beta1;
+    double beta2;
+    double eps;
+    double weightDecay;
+    uint64_t optimizerSteps;
+    // bytes after the header
+    uint64_t payloadSize;
+    uint64_t checksum;
+    uint8_t reserved[40];
+};
+
+struct CheckpointLayer {
+    uint64_t layerSize;
+    uint64_t nextLayerSize;
+    uint32_t activationFunction;
+    uint32_t lossFunction;
+    // file offsets of the tensor sections, 0 when absent
+    uint64_t biases;
+    uint64_t weights;
+    uint64_t momentumBiases;
+    uint64_t momentumWeights;
+    uint64_t rmspropBiases;
+    uint64_t rmspropWeights;
+    uint64_t reserved;
+};
+
+static_assert(sizeof(CheckpointHeader) == 128 && sizeof(CheckpointLayer) == 80);
+
+class Checkpoint {
+private:
+    static constexpr char magic[8] = {'N', 'N', 'C', 'K', 'P', 'T', '\0', '\0'};
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t byteOrder = 0x01020304;
+    static constexpr uint32_t optimizerStateFlag = 1;
+    static constexpr size_t alignment = 64;
+
+    MappedFile file;
+    CheckpointHeader header;
+    std::vector<CheckpointLayer> layers;
+
+    static uint64_t align(uint64_t offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+    // FNV-1a over 64-bit words; every part of the payload is a multiple of 8 bytes
+    static void hash(uint64_t& h, const void *p, size_t n) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(p);
+        for (size_t i = 0; i < n; i += sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, sizeof(word));
+            h = (h ^ word) * 0x100000001b3;
+        }
+    }
+    static constexpr uint64_t hashBasis = 0xcbf29ce484222325;
+    static size_t elementSize(uint32_t dataType) noexcept {
+        switch (static_cast<DataTypes>(dataType)) {
+            case DataTypes::FLOAT64:
+                return sizeof(double);
+            case DataTypes::FLOAT32:
+                return sizeof(float);
+            default:
+                return 0;
+        }
+    }
+    template <class T>
+    const T *tensor(uint64_t offset) const noexcept {
+        return offset? reinterpret_cast<const T *>(file.data() + offset): nullptr;
+    }
+    // counts elements of the section at offset, converted from the stored data type
+    template <class D>
+    void copyTensor(uint64_t offset, size_t counts, D *dst) const {
+        if (dataType() == DataTypes::FLOAT64)
+            std::copy(tensor<double>(offset), tensor<double>(offset) + counts, dst);
+        else
+            std::copy(tensor<float>(offset), tensor<float>(offset) + counts, dst);
+    }
+    template <class T, class M>
+    static std::vector<const BasicLayer<T, M> *> layersOf(const BasicNetwork<T, M>& network) {
+        std::vector<const BasicLayer<T, M> *> all{&network.inputLayer};
+        for (const BasicLayer<T, M>& layer: network.hiddenLayers)
+            all.push_back(&layer);
+        all.push_back(&network.outputLayer);
+        return all;
+    }
+    void validate(const std::string& loc) {
+        if (file.size() < sizeof(header))
+            throw std::runtime_error{loc + " is too short for a checkpoint"s};
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)))
+            throw std::runtime_error{loc + " is not a checkpoint"s};
+        if (header.version != version)
+            throw std::runtime_error{loc + " is checkpoint version "s + std::to_string(header.version) + ", expected "s + std::to_string(version)};
+        if (header.byteOrder != byteOrder)
+            throw std::runtime_error{loc + " was written with another byte order"s};
+        if (!elementSize(header.dataType))
+            throw std::runtime_error{loc + " holds an unsupported data type"s};
+        if (header.payloadSize != file.size() - sizeof(header) || header.layerCounts < 2 || sizeof(header) + header.layerCounts * sizeof(CheckpointLayer) > file.size())
+            throw std::runtime_error{loc + " is truncated"s};
+        uint64_t h = hashBasis;
+        hash(h, file.data() + sizeof(header), header.payloadSize);
+        if (h != header.checksum)
+            throw std::runtime_error{loc + " fails its checksum"s};
+        layers.resize(header.layerCounts);
+        std::memcpy(layers.data(), file.data() + sizeof(header), layers.size() * sizeof(CheckpointLayer));
+        const bool optimizerState = hasOptimizerState();
+        for (size_t l = 0; l < layers.size(); ++l) {
+            const CheckpointLayer& layer = layers[l];
+            if (layer.nextLayerSize != ((l + 1 < layers.size())? layers[l + 1].layerSize: 0))
+                throw std::runtime_error{loc + " has mismatched layer sizes"s};
+            auto fits = [this](uint64_t offset, uint64_t counts, bool required) {
+                if (!offset)
+                    return !required;
+                return offset % alignment == 0 && offset <= file.size() && counts <= (file.size() - offset) / elementSize(header.dataType);
+            };
+            if (!fits(layer.biases, layer.layerSize, true) || !fits(layer.weights, layer.layerSize * layer.nextLayerSize, layer.nextLayerSize)
+                    || !fits(layer.momentumBiases, layer.layerSize, optimizerState) || !fits(layer.momentumWeights, layer.layerSize * layer.nextLayerSize, optimizerState && layer.nextLayerSize)
+                    || !fits(layer.rmspropBiases, layer.layerSize, optimizerState) || !fits(layer.rmspropWeights, layer.layerSize * layer.nextLayerSize, optimizerState && layer.nextLayerSize))
+                throw std::runtime_error{loc + " has a tensor section out of bounds"s};
+        }
+    }
+public:
+    // maps and validates loc; throws std::runtime_error when it is not a readable checkpoint
+    explicit Checkpoint(const std::string& loc): file(loc) {
+        validate(loc);
+    }
+
+    static bool isCheckpoint(const std::string& loc) {
+        char buffer[sizeof(magic)]{};
+        std::ifstream ifs{loc, std::ios::binary};
+        return ifs.read(buffer, sizeof(buffer)) && !std::memcmp(buffer, magic, sizeof(magic));
+    }
+    // stores the parameters at the master precision M: a mixed precision network saves its fp64 master weights
+    template <class T, class M>
+    static void save(const BasicNetwork<T, M>& network, const std::string& loc, bool optimizerState = true) {
+        using Layer = BasicLayer<T, M>;
+        const std::vector<const Layer *> all = layersOf(network);
+        CheckpointHeader h{};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.byteOrder = byteOrder;
+        h.dataType = static_cast<uint32_t>(dataTypeOf<M>);
+        h.layerCounts = all.size();
+        h.flags = optimizerState? optimizerStateFlag: 0;
+        h.optimizerKind = static_cast<uint32_t>(network.optimizer.kind);
+        h.beta1 = network.optimizer.beta1;
+        h.beta2 = network.optimizer.beta2;
+        h.eps = network.optimizer.eps;
+        h.weightDecay = network.optimizer.weightDecay;
+        h.optimizerSteps = network.optimizer.steps;
+
+        // lay the sections out after the layer table
+        std::vector<CheckpointLayer> table(all.size());
+        uint64_t offset = sizeof(h) + table.size() * sizeof(CheckpointLayer);
+        auto place = [&offset](uint64_t counts) {
+            offset = align(offset);
+            const uint64_t placed = offset;
+            offset += counts * sizeof(M);
+            return placed;
+        };
+        for (size_t l = 0; l < all.size(); ++l) {
+            const Layer& layer = *all[l];
+            const uint64_t weightCounts = layer.layerSize * layer.nextLayerSize;
+            table[l] = CheckpointLayer{};
+            table[l].layerSize = layer.layerSize;
+            table[l].nextLayerSize = layer.nextLayerSize;
+            table[l].activationFunction = static_cast<uint32_t>(layer.activationFunctionEnum);
+            table[l].lossFunction = static_cast<uint32_t>(layer.lossFunctionEnum);
+            table[l].biases = place(layer.layerSize);
+            table[l].weights = weightCounts? place(weightCounts): 0;
+            if (optimizerState) {
+                table[l].momentumBiases = place(layer.layerSize);
+                table[l].momentumWeights = weightCounts? place(weightCounts): 0;
+                table[l].rmspropBiases = place(layer.layerSize);
+                table[l].rmspropWeights = weightCounts? place(weightCounts): 0;
+            }
+        }
+        h.payloadSize = align(offset) - sizeof(h);
+
+        std::ofstream ofs{loc, std::ios::binary | std::ios::trunc};
+        if (!ofs)
+            throw std::runtime_error{"can't open "s + loc + " to save a checkpoint"s};
+        uint64_t checksum = hashBasis;
+        uint64_t written = sizeof(h);
+        auto put = [&](uint64_t at, const void *p, uint64_t n) {
+            static constexpr char zeros[alignment]{};
+            hash(checksum, zeros, at - written);
+            ofs.write(zeros, at - written);
+            // a float section of odd length ends half way through a word: pad it with zeros
+            const uint64_t whole = n / sizeof(uint64_t) * sizeof(uint64_t);
+            hash(checksum, p, whole);
+            ofs.write(static_cast<const char *>(p), n);
+            written = at + n;
+            if (whole != n) {
+                uint64_t tail = 0;
+                std::memcpy(&tail, static_cast<const char *>(p) + whole, n - whole);
+                hash(checksum, &tail, sizeof(tail));
+                ofs.write(zeros, sizeof(tail) - (n - whole));
+                written = at + whole + sizeof(tail);
+            }
+        };
+        ofs.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        put(written, table.data(), table.size() * sizeof(CheckpointLayer));
+        for (size_t l = 0; l < all.size(); ++l) {
+            const Layer& layer = *all[l];
+            const M *biases, *weights;
+            if constexpr (Layer::mixedPrecision) {
+                biases = simd::data(layer.masterBiases);
+                weights = layer.masterWeights.data();
+            } else {
+                biases = simd::data(layer.biases);
+                weights = layer.weights.data();
+            }
+            put(table[l].biases, biases, layer.layerSize * sizeof(M));
+            if (table[l].weights)
+                put(table[l].weights, weights, layer.weights.size() * sizeof(M));
+            if (optimizerState) {
+                put(table[l].momentumBiases, simd::data(layer.momentumBiases), layer.layerSize * sizeof(M));
+                if (table[l].momentumWeights)
+                    put(table[l].momentumWeights, layer.momentumWeights.data(), layer.momentumWeights.size() * sizeof(M));
+                put(table[l].rmspropBiases, simd::data(layer.rmspropBiases), layer.layerSize * sizeof(M));
+                if (table[l].rmspropWeights)
+                    put(table[l].rmspropWeights, layer.rmspropWeights.data(), layer.rmspropWeights.size() * sizeof(M));
+            }
+        }
+        put(sizeof(h) + h.payloadSize, nullptr, 0);
+        h.checksum = checksum;
+        ofs.seekp(0);
+        ofs.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        if (!ofs)
+            throw std::runtime_error{"can't write the checkpoint "s + loc};
+    }
+
+    size_t layerCounts() const noexcept {
+        return layers.size();
+    }
+    DataTypes dataType() const noexcept {
+        return static_cast<DataTypes>(header.dataType);
+    }
+    bool hasOptimizerState() const noexcept {
+        return header.flags & optimizerStateFlag;
+    }
+    ssize_t layerSize(size_t l) const noexcept {
+        return layers[l].layerSize;
+    }
+    ssize_t nextLayerSize(size_t l) const noexcept {
+        return layers[l].nextLayerSize;
+    }
+    ActivationFunctions activationFunction(size_t l) const noexcept {
+        return static_cast<ActivationFunctions>(layers[l].activationFunction);
+    }
+    LossFunctions lossFunction(size_t l) const noexcept {
+        return static_cast<LossFunctions>(layers[l].lossFunction);
+    }
+    // in place in the mapping: layerSize(l) biases, layerSize(l) x nextLayerSize(l) row-major weights; T must be the
+    // stored data type
+    template <class T = double>
+    const T *biases(size_t l) const noexcept {
+        assert(dataType() == dataTypeOf<T>);       //assertion
+        return tensor<T>(layers[l].biases);
+    }
+    template <class T = double>
+    const T *weights(size_t l) const noexcept {
+        assert(dataType() == dataTypeOf<T>);       //assertion
+        return tensor<T>(layers[l].weights);
+    }
+
+    // copies the parameters, and the optimizer state when saved with it, into a trainable network of any precision,
+    // e.g. load<float>() for a FloatNetwork or load<float, double>() for a MixedPrecisionNetwork
+    template <class T = double, class M = T>
+    BasicNetwork<T, M> load() const {
+        using Layer = BasicLayer<T, M>;
+        std::vector<Layer> all;
+        for (size_t l = 0; l < layers.size(); ++l) {
+            const ssize_t size = layerSize(l);
+            const ssize_t nextSize = nextLayerSize(l);
+            std::valarray<T> b(size);
+            copyTensor(layers[l].biases, size, std::begin(b));
+            BasicMatrix<T> w(size, nextSize);
+            if (nextSize)
+                copyTensor(layers[l].weights, w.size(), w.data());
+            Layer layer(b, std::move(w), activationFunction(l), lossFunction(l));
+            if constexpr (Layer::mixedPrecision) {
+                copyTensor(layers[l].biases, size, std::begin(layer.masterBiases));
+                if (nextSize)
+                    copyTensor(layers[l].weights, layer.masterWeights.size(), layer.masterWeights.data());
+            }
+            if (hasOptimizerState()) {
+                copyTensor(layers[l].momentumBiases, size, std::begin(layer.momentumBiases));
+                copyTensor(layers[l].rmspropBiases, size, std::begin(layer.rmspropBiases));
+                if (nextSize) {
+                    copyTensor(layers[l].momentumWeights, layer.momentumWeights.size(), layer.momentumWeights.data());
+                    copyTensor(layers[l].rmspropWeights, layer.rmspropWeights.size(), layer.rmspropWeights.data());
+                }
+            }
+            all.push_back(std::move(layer));
+        }
+        Layer inputLayer = std::move(all.front());
+        Layer outputLayer = std::move(all.back());
+        BasicNetwork<T, M> network(std::move(inputLayer), std::vector<Layer>(std::make_move_iterator(all.begin() + 1), std::make_move_iterator(all.end() - 1)), std::move(outputLayer));
+        if (hasOptimizerState()) {
+            network.optimizer.kind = static_cast<Optimizers>(header.optimizerKind);
+            network.optimizer.beta1 = header.beta1;
+            network.optimizer.beta2 = header.beta2;
+            network.optimizer.eps = header.eps;
+            network.optimizer.weightDecay = header.weightDecay;
+            network.optimizer.steps = header.optimizerSteps;
+        }
+        return network;
+    }
+    // Network::runBatch on the mapped weights, without copying them; T must be the stored data type
+    template <class T>
+    BasicMatrix<T> runBatch(const BasicMatrix<T>& inputs) const {
+        using Matrix = BasicMatrix<T>;
+        assert(inputs.cols() == layerSize(0));       //assertion
+        if (dataType() != dataTypeOf<T>)
+            throw std::runtime_error{"cannot run a checkpoint in place at another precision than it was saved in"};
+        Matrix prev;
+        Matrix out = inputs;
+        for (size_t l = 1; l < layers.size(); ++l) {
+            prev = std::move(out);
+            out = Matrix(prev.rows(), layerSize(l));
+            for (ssize_t b = 0; b < out.rows(); ++b)
+                std::copy(biases<T>(l), biases<T>(l) + layerSize(l), out.rowData(b));
+            gemm(out.rows(), out.cols(), prev.cols(), prev.data(), prev.cols(), weights<T>(l - 1), nextLayerSize(l - 1), out.data(), out.cols());
+            visitActivationFunction<T>(activationFunction(l), [&](auto f) {
+                using F = decltype(f);
+                for (ssize_t b = 0; b < out.rows(); ++b)
+                    f.F::apply(std::span<const T>(out.rowData(b), out.cols()), std::span<T>(out.rowData(b), out.cols()));
+            });
+        }
+        return out;
+    }
+};
+
+// a network from either a binary checkpoint or the text format of operator>>, converted to its precision
+template <class T = double, class M = T>
+BasicNetwork<T, M> loadNetwork(const std::string& loc) {
+    if (Checkpoint::isCheckpoint(loc))
+        return Checkpoint(loc).load<T, M>();
+    if (std::ifstream ifs{loc, std::ios::binary}) {
+        BasicNetwork<T, M> network;
+        ifs >> network;
+        return network;
+    }
+    throw std::runtime_error{"can't open "s + loc + " to load a network"s};
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include <vector>
+#include <valarray>
+#include <numeric>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <type_traits>
+#include <cassert>
+#include "matrix.hpp"
+#include "idx.hpp"
+#include "telemetry.hpp"
+
+// Mini-batches of a dataset in shuffled order without copying the dataset: an epoch shuffles a permutation of the
+// sample indices only, and gather() copies the rows of one batch straight into one of two reusable, 64-byte aligned
+// buffers. A background thread gathers batch k + 1 into the other buffer while the caller trains on batch k.
+template <class T = double>
+class BasicDataLoader {
+public:
+    using Matrix = BasicMatrix<T>;
+    // inputs and outputs row r <- sample indices[r], r in [0, counts); resizing them is up to gather
+    using Gather = std::function<void(const size_t *indices, size_t counts, Matrix& inputs, Matrix& outputs)>;
+private:
+    Gather gather;
+    size_t batchSize;
+    size_t batchCounts;
+    std::vector<size_t> order;
+    std::mt19937 gen;
+    Matrix inputs[2];
+    Matrix outputs[2];
+    // batch indices within the epoch: the next to hand out, the last asked of the worker and the last it finished
+    ssize_t current{0};
+    ssize_t requested{-1};
+    ssize_t filled{-1};
+    std::exception_ptr failure;
+    bool stopping{false};
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread worker;
+
+    void fill() {
+        std::unique_lock lock(mutex);
+        for (;;) {
+            changed.wait(lock, [this] { return stopping || requested > filled; });
+            if (stopping)
+                return;
+            const ssize_t b = requested;
+            lock.unlock();
+            try {
+                TELEMETRY_SCOPE("loader.gather");
+                const size_t begin = b * batchSize;
+                gather(order.data() + begin, std::min(batchSize, order.size() - begin), inputs[b % 2], outputs[b % 2]);
+            } catch (...) {
+                lock.lock();
+                failure = std::current_exception();
+                filled = b;
+                changed.notify_all();
+                continue;
+            }
+            lock.lock();
+            filled = b;
+            changed.notify_all();
+        }
+    }
+    void request(ssize_t b) {
+        {
+            std::lock_guard lock(mutex);
+            requested = b;
+        }
+        changed.notify_all();
+    }
+public:
+    // dropLast leaves out the final sampleCounts % batchSize samples of an epoch, as utils.hpp::batch did
+    BasicDataLoader(size_t sampleCounts, size_t batchSize, Gather gather, bool dropLast = true, unsigned seed = std::random_device{}()):
+        gather(std::move(gather)),
+        batchSize(batchSize),
+        batchCounts(dropLast? sampleCounts / batchSize: (sampleCounts + batchSize - 1) / batchSize),
+        order(sampleCounts),
+        gen(seed),
+        worker(&BasicDataLoader::fill, this)
+    {
+        assert(batchSize > 0);       //assertion
+        std::iota(order.begin(), order.end(), 0);
+    }
+    BasicDataLoader(const BasicDataLoader&) = delete;
+    BasicDataLoader& operator=(const BasicDataLoader&) = delete;
+    ~BasicDataLoader() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        worker.join();
+    }
+
+    size_t getBatchCounts() const noexcept {
+        return batchCounts;
+    }
+    // reshuffles the permutation and starts gathering the first batch of the epoch
+    void startEpoch() {
+        {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [this] { return filled == requested; });
+            failure = nullptr;
+            filled = requested = -1;
+        }
+        {
+            TELEMETRY_SCOPE("loader.shuffle");
+            std::shuffle(order.begin(), order.end(), gen);
+        }
+        current = 0;
+        if (batchCounts)
+            request(0);
+    }
+    // the next batch of the epoch, or false past its end; inputs and outputs stay valid until the next call
+    bool next(const Matrix *& batchInputs, const Matrix *& batchOutputs) {
+        if (current >= batchCounts)
+            return false;
+        {
+            TELEMETRY_SCOPE("loader.wait");
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [this] { return filled >= current; });
+            if (failure)
+                std::rethrow_exception(failure);
+        }
+        // the other buffer held the batch handed out last, which the caller has given back by calling again
+        if (current + 1 < batchCounts)
+            request(current + 1);
+        batchInputs = &inputs[current % 2];
+        batchOutputs = &outputs[current % 2];
+        ++current;
+        return true;
+    }
+};
+
+using DataLoader = BasicDataLoader<double>;
+
+namespace data_loader {
+    template <class T>
+    void copyRow(const std::valarray<T>& sample, T *row) {
+        std::copy(std::begin(sample), std::end(sample), row);
+    }
+    template <class T, class U, typename = std::enable_if_t<std::is_arithmetic_v<U>>>
+    void copyRow(U sample, T *row) {
+        *row = sample;
+    }
+    template <class U>
+    size_t widthOf(const std::valarray<U>& sample) {
+        return sample.size();
+    }
+    template <class U, typename = std::enable_if_t<std::is_arithmetic_v<U>>>
+    size_t widthOf(U) {
+        return 1;
+    }
+}
+
+// gathers rows of in-memory samples, e.g. the valarrays of mnist.hpp::loadImages and classifyLabels; an output that is
+// a single number, such as a class of mnist.hpp::loadLabels, becomes one column. Both sets are referenced, not copied,
+// and must outlive the loader
+template <class T, class U>
+typename BasicDataLoader<T>::Gather gatherFrom(const std::valarray<std::valarray<T>>& inputs, const std::valarray<U>& outputs) {
+    assert(inputs.size() == outputs.size() && inputs.size());       //assertion
+    return [&inputs, &outputs](const size_t *indices, size_t counts, BasicMatrix<T>& batchInputs, BasicMatrix<T>& batchOutputs) {
+        batchInputs.resize(counts, inputs[0].size());
+        batchOutputs.resize(counts, data_loader::widthOf(outputs[0]));
+        for (size_t r = 0; r < counts; ++r) {
+            data_loader::copyRow(inputs[indices[r]], batchInputs.rowData(r));
+            data_loader::copyRow(outputs[indices[r]], batchOutputs.rowData(r));
+        }
+    };
+}
+
+// gathers straight from mapped IDX files: images scaled by scale, labels one-hot over classCounts, or with classCounts 0
+// one column of class indices, which BasicNetwork::batchedTrain takes as sparse targets
+template <class T = double>
+typename BasicDataLoader<T>::Gather gatherFrom(const IdxFile& images, const IdxFile& labels, double scale = 1. / 255, size_t classCounts = 10) {
+    assert(images.counts() == labels.counts());       //assertion
+    return [&images, &labels, scale, classCounts](const size_t *indices, size_t counts, BasicMatrix<T>& batchInputs, BasicMatrix<T>& batchOutputs) {
+        images.gather(indices, counts, batchInputs, scale);
+        if (classCounts)
+            labels.gatherOneHot(indices, counts, batchOutputs, classCounts);
+        else
+            labels.gatherLabels(indices, counts, batchOutputs);
+    };
+}
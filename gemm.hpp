@@ -0,0 +1,23 @@
+#pragma once
+#include <algorithm>
+#include <sys/types.h>
+#include <type_traits>
+#include "matrix.hpp"
+#include "simd.hpp"
+
+// C += A * B with A: m x k, B: k x n, C: m x n, all row-major with leading dimensions lda/ldb/ldc.
+// double and float run on the CPUID-selected simd::BasicKernels::gemm: register-tiled (simd::tiledGemm) on
+// avx2/avx512, blockedGemm compiled for the baseline otherwise.
+template <class T>
+void gemm(ssize_t m, ssize_t n, ssize_t k, const T *a, ssize_t lda, const T *b, ssize_t ldb, T *c, ssize_t ldc) {
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>)
+        simd::kernels<T>().gemm(m, n, k, a, lda, b, ldb, c, ldc);
+    else
+        simd::blockedGemm(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+template <class T>
+void gemm(const BasicMatrix<T>& a, const BasicMatrix<T>& b, BasicMatrix<T>& c) {
+    assert(a.cols() == b.rows() && c.rows() == a.rows() && c.cols() == b.cols());      //assertion
+    gemm(a.rows(), b.cols(), a.cols(), a.data(), a.cols(), b.data(), b.cols(), c.data(), c.cols());
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <valarray>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include "matrix.hpp"
+#include "simd.hpp"
+
+// Gradients of one Layer's parameters summed (not averaged) over `samples` samples.
+// Layer::accumulateGradients adds into it, Layer::applyGradients divides by samples and takes one optimizer step;
+// buffers filled from different slices of a batch are combined with operator+= (or addRows for one row range).
+template <class T>
+struct BasicGradientBuffer {
+    BasicMatrix<T> weights;
+    std::valarray<T> biases;
+    size_t samples{0};
+    // while sparse, the weight rows outside activeRows (sorted) are zero: only gradients of sparse inputs were added,
+    // and clear() and Layer::applyGradients may skip the other rows. Any dense gradient clears the flag
+    bool sparse{true};
+    std::vector<ssize_t> activeRows;
+
+    BasicGradientBuffer() = default;
+    BasicGradientBuffer(ssize_t layerSize, ssize_t nextLayerSize): weights(layerSize, nextLayerSize), biases(layerSize) {}
+
+    void clear() {
+        if (sparse)
+            for (ssize_t r: activeRows)
+                std::fill(weights.rowData(r), weights.rowData(r) + weights.cols(), T(0));
+        else
+            weights.fill(0);
+        biases = 0;
+        samples = 0;
+        sparse = true;
+        activeRows.clear();
+    }
+    // records rows as possibly non-zero in a sparse buffer
+    void addActiveRows(std::vector<ssize_t> rows) {
+        if (!sparse)
+            return;
+        rows.insert(rows.end(), activeRows.begin(), activeRows.end());
+        std::sort(rows.begin(), rows.end());
+        rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+        activeRows = std::move(rows);
+    }
+    // adds weight rows [rowBegin, rowEnd) and the biases of the same nodes; samples and sparse are left to the caller
+    void addRows(const BasicGradientBuffer& g, ssize_t rowBegin, ssize_t rowEnd) {
+        assert(g.weights.rows() == weights.rows() && g.weights.cols() == weights.cols());      //assertion
+        const simd::BasicKernels<T>& k = simd::kernels<T>();
+        k.axpy((rowEnd - rowBegin) * weights.cols(), T(1), g.weights.rowData(rowBegin), weights.rowData(rowBegin));
+        k.axpy(rowEnd - rowBegin, T(1), &g.biases[rowBegin], &biases[rowBegin]);
+    }
+    BasicGradientBuffer& operator+=(const BasicGradientBuffer& g) {
+        addRows(g, 0, weights.rows());
+        samples += g.samples;
+        if (g.sparse)
+            addActiveRows(g.activeRows);
+        else
+            sparse = false;
+        return *this;
+    }
+};
+
+using GradientBuffer = BasicGradientBuffer<double>;
@@ -0,0 +1,121 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include "matrix.hpp"
+#include "mapped_file.hpp"
+
+using namespace std::string_literals;
+
+// A read-only memory map of an IDX file (the MNIST format) holding unsigned bytes.
+// The header is validated on open: magic 0x00 0x00 0x08 <rank>, <rank> big-endian dimensions, and a payload of exactly
+// their product. Items (the slices along the first dimension) are exposed in place as uint8_t; conversion to the
+// element type of the output matrix happens only for the rows asked for, e.g. one batch at a time.
+class IdxFile {
+private:
+    MappedFile file;
+    std::vector<size_t> dimensions;
+    const uint8_t *payload{nullptr};
+    size_t itemLength{1};
+
+    void parseHeader(const std::string& loc, size_t rank) {
+        const uint8_t *mapped = file.data();
+        const size_t length = file.size();
+        if (length < 4 || mapped[0] || mapped[1] || mapped[2] != 0x08 || !mapped[3])
+            throw std::runtime_error{loc + " is not an IDX file of unsigned bytes"s};
+        if (rank && mapped[3] != rank)
+            throw std::runtime_error{loc + " has rank "s + std::to_string(mapped[3]) + ", expected "s + std::to_string(rank)};
+        const size_t headerLength = 4 + 4 * size_t{mapped[3]};
+        if (length < headerLength)
+            throw std::runtime_error{loc + " is truncated in its header"s};
+        // a corrupt header must not wrap the product around to the real payload length
+        auto multiply = [&loc](size_t product, size_t d) {
+            if (d && product > SIZE_MAX / d)
+                throw std::runtime_error{loc + " has dimensions whose product overflows"s};
+            return product * d;
+        };
+        size_t payloadLength = 1;
+        for (size_t i = 0; i < mapped[3]; ++i) {
+            const uint8_t *d = mapped + 4 + 4 * i;
+            dimensions.push_back(size_t{d[0]} << 24 | size_t{d[1]} << 16 | size_t{d[2]} << 8 | size_t{d[3]});
+            payloadLength = multiply(payloadLength, dimensions.back());
+            if (i)
+                itemLength = multiply(itemLength, dimensions.back());
+        }
+        if (length - headerLength != payloadLength)
+            throw std::runtime_error{loc + " holds "s + std::to_string(length - headerLength) + " bytes of data, its dimensions say "s + std::to_string(payloadLength)};
+        payload = mapped + headerLength;
+    }
+public:
+    // rank 0 accepts any rank
+    explicit IdxFile(const std::string& loc, size_t rank = 0): file(loc) {
+        parseHeader(loc, rank);
+    }
+
+    const std::vector<size_t>& shape() const noexcept {
+        return dimensions;
+    }
+    // items along the first dimension: images or labels
+    size_t counts() const noexcept {
+        return dimensions[0];
+    }
+    // bytes per item: 28*28 for MNIST images, 1 for labels
+    size_t itemSize() const noexcept {
+        return itemLength;
+    }
+    const uint8_t *data() const noexcept {
+        return payload;
+    }
+    const uint8_t *item(size_t i) const noexcept {
+        return payload + i * itemLength;
+    }
+    // items [begin, end): read ahead in the background, or drop from memory once consumed (see MappedFile)
+    void prefetch(size_t begin, size_t end) const noexcept {
+        file.prefetch(item(begin) - file.data(), (end - begin) * itemLength);
+    }
+    void release(size_t begin, size_t end) const noexcept {
+        file.release(item(begin) - file.data(), (end - begin) * itemLength);
+    }
+    // out row r = scale * item(indices[r]) for r in [0, counts)
+    template <class T>
+    void gather(const size_t *indices, size_t counts, BasicMatrix<T>& out, double scale = 1) const {
+        out.resize(counts, itemLength);
+        for (size_t r = 0; r < counts; ++r) {
+            const uint8_t *src = item(indices[r]);
+            T *dst = out.rowData(r);
+            for (size_t j = 0; j < itemLength; ++j)
+                dst[j] = static_cast<T>(src[j] * scale);
+        }
+    }
+    // items [begin, end) in file order
+    template <class T>
+    void rows(size_t begin, size_t end, BasicMatrix<T>& out, double scale = 1) const {
+        out.resize(end - begin, itemLength);
+        for (size_t r = begin; r < end; ++r) {
+            const uint8_t *src = item(r);
+            T *dst = out.rowData(r - begin);
+            for (size_t j = 0; j < itemLength; ++j)
+                dst[j] = static_cast<T>(src[j] * scale);
+        }
+    }
+    // one column with the byte labels at indices as class indices
+    template <class T>
+    void gatherLabels(const size_t *indices, size_t counts, BasicMatrix<T>& out) const {
+        out.resize(counts, 1);
+        for (size_t r = 0; r < counts; ++r)
+            out(r, 0) = static_cast<T>(*item(indices[r]));
+    }
+    // one-hot rows of classCounts columns for the byte labels at indices
+    template <class T>
+    void gatherOneHot(const size_t *indices, size_t counts, BasicMatrix<T>& out, size_t classCounts) const {
+        out.resize(counts, classCounts);
+        out.fill(0);
+        for (size_t r = 0; r < counts; ++r) {
+            const size_t label = *item(indices[r]);
+            if (label >= classCounts)
+                throw std::runtime_error{"label "s + std::to_string(label) + " is out of "s + std::to_string(classCounts) + " classes"s};
+            out(r, label) = 1;
+        }
+    }
+};
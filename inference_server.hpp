@@ -0,0 +1,288 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <valarray>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "network.hpp"
+#include "matrix.hpp"
+
+using namespace std::literals;
+
+// Dynamic micro-batching in front of Network::runBatch. submit() queues one sample and returns a future of its output;
+// a worker thread takes up to maxBatchSize queued samples at once, waiting at most maxWait after the oldest of them
+// arrived for the batch to fill, and scores them in one batched forward pass.
+template <class T, class M = T>
+class BasicMicroBatcher {
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Request {
+        std::valarray<T> input;
+        std::promise<std::valarray<T>> output;
+        Clock::time_point arrival;
+    };
+    const BasicNetwork<T, M>& network;
+    const size_t maxBatchSize;
+    const std::chrono::microseconds maxWait;
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::deque<Request> queue;
+    bool stopping{false};
+    std::atomic<size_t> batchCounts{0};
+    std::atomic<size_t> sampleCounts{0};
+    std::thread worker;
+
+    void serve() {
+        std::vector<Request> batch;
+        BasicMatrix<T> inputs;
+        for (;;) {
+            {
+                std::unique_lock lock(mutex);
+                queued.wait(lock, [this] { return stopping || !queue.empty(); });
+                // stopping with nothing left to answer
+                if (queue.empty())
+                    return;
+                queued.wait_until(lock, queue.front().arrival + maxWait, [this] { return stopping || queue.size() >= maxBatchSize; });
+                const size_t counts = std::min(queue.size(), maxBatchSize);
+                batch.clear();
+                for (size_t i = 0; i < counts; ++i) {
+                    batch.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+            }
+            try {
+                inputs.resize(batch.size(), batch.front().input.size());
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    if (batch[i].input.size() != inputs.cols())
+                        throw std::runtime_error{"cannot batch samples of different sizes"};
+                    std::copy(std::begin(batch[i].input), std::end(batch[i].input), inputs.rowData(i));
+                }
+                const BasicMatrix<T> outputs = network.runBatch(inputs);
+                for (size_t i = 0; i < batch.size(); ++i)
+                    batch[i].output.set_value(std::valarray<T>(outputs.rowData(i), outputs.cols()));
+            } catch (...) {
+                for (Request& request: batch)
+                    request.output.set_exception(std::current_exception());
+            }
+            ++batchCounts;
+            sampleCounts += batch.size();
+        }
+    }
+public:
+    // network must outlive the batcher and is only read, see Network::runBatch
+    BasicMicroBatcher(const BasicNetwork<T, M>& network, size_t maxBatchSize = 32, std::chrono::microseconds maxWait = 500us):
+        network(network),
+        maxBatchSize(std::max<size_t>(maxBatchSize, 1)),
+        maxWait(maxWait),
+        worker(&BasicMicroBatcher::serve, this)
+    {}
+    BasicMicroBatcher(const BasicMicroBatcher&) = delete;
+    BasicMicroBatcher& operator=(const BasicMicroBatcher&) = delete;
+    // answers everything already submitted before returning
+    ~BasicMicroBatcher() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        worker.join();
+    }
+
+    std::future<std::valarray<T>> submit(std::valarray<T> input) {
+        Request request{std::move(input), {}, Clock::now()};
+        std::future<std::valarray<T>> output = request.output.get_future();
+        {
+            std::lock_guard lock(mutex);
+            queue.push_back(std::move(request));
+            if (queue.size() < maxBatchSize && queue.size() > 1)
+                return output;
+        }
+        // the first sample of a batch starts the wait, a full batch ends it
+        queued.notify_one();
+        return output;
+    }
+    // mean samples per forward pass so far
+    double meanBatchSize() const noexcept {
+        return batchCounts? sampleCounts / static_cast<double>(batchCounts): 0;
+    }
+};
+
+using MicroBatcher = BasicMicroBatcher<double>;
+
+namespace socket_io {
+    // false when the peer closed the connection before n bytes
+    inline bool readFully(int fd, void *buffer, size_t n) {
+        char *p = static_cast<char *>(buffer);
+        while (n) {
+            const ssize_t r = ::read(fd, p, n);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+            p += r;
+            n -= r;
+        }
+        return true;
+    }
+    inline bool writeFully(int fd, const void *buffer, size_t n) {
+        const char *p = static_cast<const char *>(buffer);
+        while (n) {
+            const ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            p += w;
+            n -= w;
+        }
+        return true;
+    }
+    inline sockaddr_un addressOf(const std::string& path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+            throw std::runtime_error{"socket path "s + path + " is too long"s};
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+}
+
+// Unix-domain stream socket front-end of a MicroBatcher (POSIX only).
+// Protocol, repeated any number of times per connection: the client writes one image of 28*28 uint8 pixels, row-major
+// like MainPanel::bitmap, and reads back the network's output as doubles in host byte order (10 for MNIST). Pixels are
+// scaled by 1/255 as in training. Every connection is served by its own thread, one request at a time.
+class InferenceServer {
+private:
+    static constexpr size_t imageSize = 28*28;
+    MicroBatcher& batcher;
+    std::string path;
+    int listenFd{-1};
+    std::atomic<bool> stopping{false};
+    struct Connection {
+        // -1 once serve has closed it and the thread is about to return
+        int fd;
+        std::thread thread;
+    };
+    std::mutex mutex;
+    std::vector<Connection> connections;
+    std::thread acceptor;
+
+    // joins the threads of closed connections, under mutex
+    void reapConnections() {
+        const auto closed = std::partition(connections.begin(), connections.end(), [](const Connection& c) { return c.fd >= 0; });
+        for (auto c = closed; c != connections.end(); ++c)
+            c->thread.join();
+        connections.erase(closed, connections.end());
+    }
+
+    void accept() {
+        for (;;) {
+            const int fd = ::accept(listenFd, nullptr, nullptr);
+            if (stopping) {
+                if (fd >= 0)
+                    ::close(fd);
+                break;
+            }
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                break;
+            }
+            std::lock_guard lock(mutex);
+            reapConnections();
+            connections.push_back({fd, std::thread(&InferenceServer::serve, this, fd)});
+        }
+    }
+    void serve(int fd) {
+        uint8_t image[imageSize];
+        std::valarray<double> input(imageSize);
+        while (socket_io::readFully(fd, image, sizeof(image))) {
+            std::transform(image, image + imageSize, std::begin(input), [](uint8_t v) { return v / 255.; });
+            std::valarray<double> output;
+            try {
+                output = batcher.submit(input).get();
+            } catch (const std::exception&) {
+                break;
+            }
+            if (!socket_io::writeFully(fd, simd::data(output), output.size() * sizeof(double)))
+                break;
+        }
+        // closed under mutex so that accept can't reuse the fd before it is marked
+        std::lock_guard lock(mutex);
+        std::find_if(connections.begin(), connections.end(), [fd](const Connection& c) { return c.fd == fd; })->fd = -1;
+        ::close(fd);
+    }
+public:
+    // binds and listens on path, replacing a stale socket file; throws std::runtime_error when it cannot
+    InferenceServer(MicroBatcher& batcher, const std::string& path): batcher(batcher), path(path) {
+        const sockaddr_un address = socket_io::addressOf(path);
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0)
+            throw std::runtime_error{"can't create a socket for "s + path};
+        ::unlink(path.c_str());
+        if (::bind(listenFd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) || ::listen(listenFd, SOMAXCONN)) {
+            ::close(listenFd);
+            throw std::runtime_error{"can't listen on "s + path};
+        }
+        acceptor = std::thread(&InferenceServer::accept, this);
+    }
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+    ~InferenceServer() {
+        stopping = true;
+        ::shutdown(listenFd, SHUT_RDWR);
+        acceptor.join();
+        ::close(listenFd);
+        {
+            std::lock_guard lock(mutex);
+            for (const Connection& connection: connections)
+                if (connection.fd >= 0)
+                    ::shutdown(connection.fd, SHUT_RDWR);
+        }
+        // no new connections now, and serve only takes mutex briefly before returning
+        for (Connection& connection: connections)
+            connection.thread.join();
+        ::unlink(path.c_str());
+    }
+};
+
+// one connection to an InferenceServer
+class InferenceClient {
+private:
+    int fd{-1};
+public:
+    explicit InferenceClient(const std::string& path) {
+        const sockaddr_un address = socket_io::addressOf(path);
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address))) {
+            if (fd >= 0)
+                ::close(fd);
+            throw std::runtime_error{"can't connect to "s + path};
+        }
+    }
+    InferenceClient(const InferenceClient&) = delete;
+    InferenceClient& operator=(const InferenceClient&) = delete;
+    ~InferenceClient() {
+        ::close(fd);
+    }
+    // image: 28*28 pixels; returns outputCounts scores
+    std::valarray<double> classify(const uint8_t *image, size_t outputCounts = 10) {
+        std::valarray<double> output(outputCounts);
+        if (!socket_io::writeFully(fd, image, 28*28) || !socket_io::readFully(fd, simd::data(output), outputCounts * sizeof(double)))
+            throw std::runtime_error{"the inference server closed the connection"};
+        return output;
+    }
+};
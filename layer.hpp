@@ -6,87 +6,203 @@
 #include <memory>
 #include <charconv>
 #include <cctype>
+#include <vector>
+#include <type_traits>
+#include <span>
+#include <string>
+#include <stdexcept>
 #include "activation_functions.hpp"
 #include "loss_functions.hpp"
 #include "stream_utils.hpp"
 #include "thread_pool.hpp"
+#include "matrix.hpp"
+#include "sparse_matrix.hpp"
+#include "gemm.hpp"
+#include "simd.hpp"
+#include "optimizer.hpp"
+#include "gradient_buffer.hpp"
+#include "traits.hpp"
+#include "telemetry.hpp"
 
 using namespace std::literals;
 
-class Layer {
-    std::valarray<double> biases;
-    std::valarray<std::valarray<double>> weights;
-    std::valarray<double> values;
-    std::valarray<double> deltas;
+template <class T, class Sizes, template <class> class... Activations>
+class BasicStaticNetwork;
+
+template <class T, class M = T>
+class BasicLayer {
+public:
+    using value_type = T;
+    // parameter precision of the optimizer: M wider than T keeps master weights and moments in M (mixed precision)
+    using master_type = M;
+private:
+    using Matrix = BasicMatrix<T>;
+    using SparseMatrix = BasicSparseMatrix<T>;
+    using GradientBuffer = BasicGradientBuffer<T>;
+    using ActivationFunction = BasicActivationFunction<T>;
+    using LossFunction = BasicLossFunction<T>;
+    static constexpr bool mixedPrecision = !std::is_same_v<T, M>;
+
+    std::valarray<T> biases;
+    Matrix weights;
+    std::valarray<T> values;
+    std::valarray<T> deltas;
     ActivationFunctions activationFunctionEnum;
     LossFunctions lossFunctionEnum;
     ssize_t layerSize;
     ssize_t nextLayerSize;
     std::unique_ptr<ActivationFunction> activationFunction;
     std::unique_ptr<LossFunction> lossFunction;
-    std::valarray<double> momentumBiases;
-    std::valarray<std::valarray<double>> momentumWeights;
-    std::valarray<double> rmspropBiases;
-    std::valarray<std::valarray<double>> rmspropWeights;
-    static constexpr const double smoothingFactor = 1.e-3;
-    static constexpr const double smallCorrection = 1.e-10;
-    static constexpr const double decayFactor = 1.e-8;
+    std::valarray<M> momentumBiases;
+    BasicMatrix<M> momentumWeights;
+    std::valarray<M> rmspropBiases;
+    BasicMatrix<M> rmspropWeights;
+    // empty unless mixedPrecision; weights and biases are then the rounded copies the forward pass reads
+    std::valarray<M> masterBiases;
+    BasicMatrix<M> masterWeights;
+    void updateBiases(const Optimizer& optimizer, const simd::UpdateCoefficients& c) {
+        updateBiases(optimizer, c, this->deltas);
+    }
+    void updateBiases(const Optimizer& optimizer, const simd::UpdateCoefficients& c, const std::valarray<T>& biasGradients) {
+        updateParameters(optimizer, c, layerSize, simd::data(this->biases), simd::data(masterBiases), simd::data(momentumBiases), simd::data(rmspropBiases), simd::data(biasGradients));
+    }
+    void updateWeightRows(const Optimizer& optimizer, const simd::UpdateCoefficients& c, ssize_t rowBegin, ssize_t rowEnd, const T *gradients) {
+        updateParameters(optimizer, c, (rowEnd - rowBegin) * nextLayerSize, this->weights.rowData(rowBegin), mixedPrecision? this->masterWeights.rowData(rowBegin): nullptr, this->momentumWeights.rowData(rowBegin), this->rmspropWeights.rowData(rowBegin), gradients);
+    }
+    // in mixed precision the step is taken on the master copy with the gradients widened to M, then rounded into w
+    void updateParameters(const Optimizer& optimizer, const simd::UpdateCoefficients& c, ssize_t n, T *w, M *master, M *m, M *v, const T *grad) {
+        if constexpr (mixedPrecision) {
+            thread_local std::vector<M> widened;
+            widened.assign(grad, grad + n);
+            optimizer.update(n, master, m, v, widened.data(), c);
+            std::copy(master, master + n, w);
+        } else {
+            optimizer.update(n, w, m, v, grad, c);
+        }
+    }
+    void copyToMaster() {
+        if constexpr (mixedPrecision) {
+            masterBiases.resize(layerSize);
+            std::copy(std::begin(biases), std::end(biases), std::begin(masterBiases));
+            masterWeights.resize(weights.rows(), weights.cols());
+            std::copy(weights.data(), weights.data() + weights.size(), masterWeights.data());
+        }
+    }
+    void resetOptimizerState() {
+        momentumBiases = 0;
+        rmspropBiases = 0;
+        momentumWeights.fill(0);
+        rmspropWeights.fill(0);
+    }
+    // The activation and the loss are dispatched on their enums once per call below, so the per-row loops call the
+    // concrete functor directly and with no allocation instead of going through the virtual, valarray-returning interface.
+    // rows [rowBegin, rowEnd) of out = f(out)
+    void activateRows(Matrix& out, ssize_t rowBegin, ssize_t rowEnd) const {
+        visitActivationFunction<T>(activationFunctionEnum, [&](auto f) {
+            using F = decltype(f);
+            for (ssize_t b = rowBegin; b < rowEnd; ++b)
+                f.F::apply(std::span<const T>(out.rowData(b), layerSize), std::span<T>(out.rowData(b), layerSize));
+        });
+    }
+    void activate(T *row) const {
+        visitActivationFunction<T>(activationFunctionEnum, [&](auto f) {
+            using F = decltype(f);
+            f.F::apply(std::span<const T>(row, layerSize), std::span<T>(row, layerSize));
+        });
+    }
+    // rows [rowBegin, rowEnd) of grads = derivative(values, grads), in place
+    void derivativeRows(const Matrix& values, Matrix& grads, ssize_t rowBegin, ssize_t rowEnd) const {
+        visitActivationFunction<T>(activationFunctionEnum, [&](auto f) {
+            using F = decltype(f);
+            for (ssize_t h = rowBegin; h < rowEnd; ++h)
+                f.F::applyDerivative(std::span<const T>(values.rowData(h), layerSize), std::span<const T>(grads.rowData(h), layerSize), std::span<T>(grads.rowData(h), layerSize));
+        });
+    }
+    // deltas = derivative(values, grads), in place
+    void derivative(T *grads) const {
+        visitActivationFunction<T>(activationFunctionEnum, [&](auto f) {
+            using F = decltype(f);
+            f.F::applyDerivative(std::span<const T>(simd::data(this->values), layerSize), std::span<const T>(grads, layerSize), std::span<T>(grads, layerSize));
+        });
+    }
+    void checkLossFunction() const {
+        if (lossFunctionEnum == LossFunctions::SOFTMAX_CROSS_ENTROPY && activationFunctionEnum != ActivationFunctions::SOFTMAX && activationFunctionEnum != ActivationFunctions::STABLE_SOFTMAX)
+            throw std::runtime_error{"cannot build a softmax cross-entropy layer without a SOFTMAX or STABLE_SOFTMAX activation"};
+    }
+    static void addColumnSums(const Matrix& batched, std::valarray<T>& sums) {
+        assert(sums.size() == batched.cols());      //assertion
+        for (ssize_t h = 0; h < batched.rows(); ++h)
+            simd::kernels<T>().axpy(batched.cols(), T(1), batched.rowData(h), simd::data(sums));
+    }
 public:
-    Layer(ssize_t nodeCounts
+    BasicLayer(ssize_t nodeCounts
             , ssize_t nextLayerNodeCounts = 0
             , const ActivationFunctions& activationFunctionEnum = ActivationFunctions::SIGMOID
             , const LossFunctions& lossFunctionEnum = LossFunctions::MSE
             , std::mt19937 gen = std::mt19937(std::random_device()())
         ): 
         biases(nodeCounts), 
-        weights(std::valarray<double>(nextLayerNodeCounts), nodeCounts),
+        weights(nodeCounts, nextLayerNodeCounts),
         values(nodeCounts), 
         deltas(nodeCounts),
         activationFunctionEnum(activationFunctionEnum),
         lossFunctionEnum(lossFunctionEnum),
         layerSize(nodeCounts),
-        nextLayerSize(weights.size()? weights[0].size(): 0),
-        activationFunction(buildActivationFunction(activationFunctionEnum)), 
-        lossFunction(buildLossFunction(lossFunctionEnum)),
+        nextLayerSize(nextLayerNodeCounts),
+        activationFunction(buildActivationFunction<T>(activationFunctionEnum)), 
+        lossFunction(buildLossFunction<T>(lossFunctionEnum)),
         momentumBiases(nodeCounts),
-        momentumWeights(std::valarray<double>(nextLayerNodeCounts), nodeCounts),
+        momentumWeights(nodeCounts, nextLayerNodeCounts),
         rmspropBiases(nodeCounts),
-        rmspropWeights(std::valarray<double>(nextLayerNodeCounts), nodeCounts)
+        rmspropWeights(nodeCounts, nextLayerNodeCounts)
     {
         for (ssize_t i = 0; i < biases.size(); ++i) {
             biases[i] = std::normal_distribution(0., .7)(gen);
         }
-        for (ssize_t i = 0; i < weights.size(); ++i) {
-            for (ssize_t j = 0; j < (weights.size()? weights[0].size(): 0); ++j) {
+        for (ssize_t i = 0; i < weights.rows(); ++i) {
+            for (ssize_t j = 0; j < weights.cols(); ++j) {
                 if (activationFunctionEnum == ActivationFunctions::SIGMOID || activationFunctionEnum == ActivationFunctions::TANH)
-                    weights[i][j] = std::normal_distribution(0., std::sqrt(2. / (nodeCounts + nextLayerNodeCounts)))(gen);
+                    weights(i, j) = std::normal_distribution(0., std::sqrt(2. / (nodeCounts + nextLayerNodeCounts)))(gen);
                 else
-                    weights[i][j] = std::normal_distribution(0., std::sqrt(2. / nodeCounts))(gen);
+                    weights(i, j) = std::normal_distribution(0., std::sqrt(2. / nodeCounts))(gen);
             }
         }
+        checkLossFunction();
+        copyToMaster();
     }
-    Layer(const std::valarray<double>& biases
-            , const std::valarray<std::valarray<double>>& weights
+    BasicLayer(const std::valarray<T>& biases
+            , Matrix weights
             , const ActivationFunctions& activationFunctionEnum
             , const LossFunctions& lossFunctionEnum
         ): 
         biases(biases),
-        weights(weights),
-        values(weights.size()),
-        deltas(weights.size()),
+        weights(std::move(weights)),
+        values(biases.size()),
+        deltas(biases.size()),
         activationFunctionEnum(activationFunctionEnum),
         lossFunctionEnum(lossFunctionEnum),
-        layerSize(weights.size()),
-        nextLayerSize(weights.size()? weights[0].size(): 0),
-        activationFunction(buildActivationFunction(activationFunctionEnum)),
-        lossFunction(buildLossFunction(lossFunctionEnum)),
+        layerSize(biases.size()),
+        nextLayerSize(this->weights.cols()),
+        activationFunction(buildActivationFunction<T>(activationFunctionEnum)),
+        lossFunction(buildLossFunction<T>(lossFunctionEnum)),
         momentumBiases(biases.size()),
-        momentumWeights(std::valarray<double>(nextLayerSize), weights.size()),
+        momentumWeights(this->weights.rows(), this->weights.cols()),
         rmspropBiases(biases.size()),
-        rmspropWeights(std::valarray<double>(nextLayerSize), weights.size())
+        rmspropWeights(this->weights.rows(), this->weights.cols())
+    {
+        assert(this->weights.rows() == layerSize);      //assertion
+        checkLossFunction();
+        copyToMaster();
+    }
+    BasicLayer(const std::valarray<T>& biases
+            , const std::valarray<std::valarray<T>>& weights
+            , const ActivationFunctions& activationFunctionEnum
+            , const LossFunctions& lossFunctionEnum
+        ): 
+        BasicLayer(biases, Matrix(weights), activationFunctionEnum, lossFunctionEnum)
     {}
-    Layer() = default;
-    Layer(const Layer& l): 
+    BasicLayer() = default;
+    BasicLayer(const BasicLayer& l): 
         biases(l.biases),
         weights(l.weights),
         values(l.values),
@@ -95,16 +211,18 @@ public:
         lossFunctionEnum(l.lossFunctionEnum),
         layerSize(l.layerSize),
         nextLayerSize(l.nextLayerSize),
-        activationFunction(buildActivationFunction(activationFunctionEnum)),
-        lossFunction(buildLossFunction(lossFunctionEnum)),
+        activationFunction(buildActivationFunction<T>(activationFunctionEnum)),
+        lossFunction(buildLossFunction<T>(lossFunctionEnum)),
         momentumBiases(l.momentumBiases),
         momentumWeights(l.momentumWeights),
         rmspropBiases(l.rmspropBiases),
-        rmspropWeights(l.rmspropWeights)
+        rmspropWeights(l.rmspropWeights),
+        masterBiases(l.masterBiases),
+        masterWeights(l.masterWeights)
     {
         std::cout << "Layer Copy Constructor" << "\r\n";      //debug
     }
-    Layer& operator=(const Layer& l) {
+    BasicLayer& operator=(const BasicLayer& l) {
         biases = l.biases;
         weights = l.weights;
         values = l.values;
@@ -117,146 +235,277 @@ public:
         momentumWeights = l.momentumWeights;
         rmspropBiases = l.rmspropBiases;
         rmspropWeights = l.rmspropWeights;
-        activationFunction = buildActivationFunction(activationFunctionEnum);
-        lossFunction = buildLossFunction(lossFunctionEnum);
+        masterBiases = l.masterBiases;
+        masterWeights = l.masterWeights;
+        activationFunction = buildActivationFunction<T>(activationFunctionEnum);
+        lossFunction = buildLossFunction<T>(lossFunctionEnum);
         std::cout << "Layer Copy Assignment" << "\r\n";      //debug
         return *this;
     }
-    void forward(const Layer& prevLayer) {
-        std::valarray<double> tmpValarr(this->values.size());
-        for (ssize_t i = 0; i < this->values.size(); ++i) {
-            for (ssize_t j = 0; j < prevLayer.weights.size(); ++j) {
-                tmpValarr[i] += prevLayer.weights[j][i] * prevLayer.values[j];
-            }
+    void forward(const BasicLayer& prevLayer) {
+        forward(prevLayer, simd::data(prevLayer.values), simd::data(this->values));
+    }
+    // out = f(biases + prevValues * prevLayer.weights) into layerSize preallocated values
+    void forward(const BasicLayer& prevLayer, const T *prevValues, T *out) const {
+        assert(prevLayer.weights.cols() == layerSize);      //assertion
+        std::copy(std::begin(this->biases), std::end(this->biases), out);
+        const simd::BasicKernels<T>& k = simd::kernels<T>();
+        for (ssize_t j = 0; j < prevLayer.weights.rows(); ++j) {
+            k.axpy(layerSize, prevValues[j], prevLayer.weights.rowData(j), out);
         }
-        this->values = (*activationFunction)(static_cast<std::valarray<double>&&>(this->biases + std::move(tmpValarr)));
+        activate(out);
     }
-    std::valarray<double> externForward(const Layer& prevLayer, const std::valarray<double>& prevValues) const {
-        std::valarray<double> tmpValarr(this->values.size());
-        for (ssize_t i = 0; i < this->values.size(); ++i) {
-            for (ssize_t j = 0; j < prevLayer.weights.size(); ++j) {
-                tmpValarr[i] += prevLayer.weights[j][i] * prevValues[j];
-            }
+    std::valarray<T> externForward(const BasicLayer& prevLayer, const std::valarray<T>& prevValues) const {
+        assert(prevLayer.weights.cols() == this->values.size());      //assertion
+        std::valarray<T> tmpValarr(this->biases);
+        // row-major weights: accumulate prevValues[j] times the contiguous row j of weights (rowData(j)), one axpy per row
+        const simd::BasicKernels<T>& k = simd::kernels<T>();
+        for (ssize_t j = 0; j < prevLayer.weights.rows(); ++j) {
+            k.axpy(tmpValarr.size(), prevValues[j], prevLayer.weights.rowData(j), simd::data(tmpValarr));
         }
-        return (*activationFunction)(static_cast<std::valarray<double>&&>(this->biases + std::move(tmpValarr)));
+        return (*activationFunction)(tmpValarr);
     }
-    void backward(const Layer& nextLayer, double learningRate) {
-        std::valarray<double> upstreamGradients(this->deltas.size());
+    void backward(const BasicLayer& nextLayer, double learningRate, const Optimizer& optimizer = Optimizer{}) {
+        const simd::BasicKernels<T>& k = simd::kernels<T>();
         for (ssize_t i = 0; i < this->values.size(); ++i) {
-            for (ssize_t j = 0; j < nextLayer.values.size(); ++j) {
-                upstreamGradients[i] += nextLayer.deltas[j] * this->weights[i][j];
-            }
+            this->deltas[i] = k.dot(nextLayerSize, simd::data(nextLayer.deltas), this->weights.rowData(i));
         }
-        this->deltas = activationFunction->derivative(this->values, upstreamGradients);
-        momentumBiases = (1 - smoothingFactor) * momentumBiases + smoothingFactor * this->deltas;
-        rmspropBiases = (1 - smoothingFactor) * rmspropBiases + smoothingFactor * std::pow(this->deltas, 2.);
-        this->biases -= learningRate * this->momentumBiases / (std::sqrt(rmspropBiases) + smallCorrection);
+        derivative(simd::data(this->deltas));
+        simd::UpdateCoefficients c = optimizer.coefficients(learningRate);
+        updateBiases(optimizer, c);
+        // the gradient of weight row i is values[i] * nextLayer.deltas
         for (ssize_t i = 0; i < this->values.size(); ++i) {
-            for (ssize_t j = 0; j < nextLayer.values.size(); ++j) {
-                momentumWeights[i][j] = (1 - smoothingFactor) * momentumWeights[i][j] + smoothingFactor * nextLayer.deltas[j] * this->values[i]; 
-                rmspropWeights[i][j] = (1 - smoothingFactor) * rmspropWeights[i][j] + smoothingFactor * std::pow(nextLayer.deltas[j] * this->values[i], 2); 
-                this->weights[i][j] -= learningRate * momentumWeights[i][j] / (std::sqrt(rmspropWeights[i][j]) + smallCorrection) + learningRate * this->weights[i][j] * decayFactor;
-            }
+            c.gScale = this->values[i];
+            updateWeightRows(optimizer, c, i, i + 1, simd::data(nextLayer.deltas));
         }
     }
-    void outputBackward(const std::valarray<double>& actual, double learningRate) {
+    void outputBackward(const std::valarray<T>& actual, double learningRate, const Optimizer& optimizer = Optimizer{}) {
         assert(actual.size() == values.size());      //assertion
-        this->deltas = activationFunction->derivative(this->values, (*lossFunction)(actual, this->values));
-        momentumBiases = (1 - smoothingFactor) * momentumBiases + smoothingFactor * this->deltas;
-        rmspropBiases = (1 - smoothingFactor) * rmspropBiases + smoothingFactor * std::pow(this->deltas, 2);
-        this->biases -= learningRate * this->momentumBiases / (std::sqrt(rmspropBiases) + smallCorrection) + learningRate * this->biases * decayFactor;
+        visitLossFunction<T>(lossFunctionEnum, [&](auto loss) {
+            using L = decltype(loss);
+            for (ssize_t j = 0; j < layerSize; ++j)
+                this->deltas[j] = loss.L::operator()(actual[j], this->values[j]);
+            if constexpr (!L::fusesSoftmax)
+                derivative(simd::data(this->deltas));
+        });
+        updateBiases(optimizer, optimizer.coefficients(learningRate));
     }
-    void outputBackward(double actual, size_t index, double learningRate) {
+    void outputBackward(T actual, size_t index, double learningRate, const Optimizer& optimizer = Optimizer{}) {
         assert(index < values.size());      //assertion
-        std::fill(std::begin(this->deltas), std::end(this->deltas), double(0));
-        double loss = (*lossFunction)(actual, this->values[index]);
-        std::valarray<double> losses(double(0), values.size());
-        losses[index] = loss;
-        this->deltas = activationFunction->derivative(this->values, losses);
-        momentumBiases = (1 - smoothingFactor) * momentumBiases + smoothingFactor * this->deltas;
-        rmspropBiases = (1 - smoothingFactor) * rmspropBiases + smoothingFactor * std::pow(this->deltas, 2);
-        this->biases -= learningRate * this->momentumBiases / (std::sqrt(rmspropBiases) + smallCorrection) + learningRate * this->biases * decayFactor;
-    }
-    std::valarray<std::valarray<double>> batchedBackward(const std::valarray<std::valarray<double>>& batchedValues, const std::valarray<std::valarray<double>>& batchedNextDeltas, const Layer& nextLayer, double learningRate, size_t threadCounts = 1) {
-        std::valarray<std::valarray<double>> batchedUpstreamGradients(std::valarray<double>(0.0, this->deltas.size()), batchedValues.size());
-        std::valarray<std::valarray<double>> batchedDeltas(std::valarray<double>(this->deltas.size()), batchedValues.size());
-        if (threadCounts > 1) {
-            ThreadPool threadPool(threadCounts);
-            for (ssize_t h = 0; h < batchedValues.size(); ++h) {
-                threadPool.addTasks([](size_t b
-                                        , std::valarray<double>& upstreamGradients
-                                        , const std::valarray<double>& nextDeltas
-                                        , const std::valarray<std::valarray<double>>& thisWeights
-                                        , std::valarray<double>& thisDeltas
-                                        , const std::valarray<double>& thisValues
-                                        , ActivationFunctions activationFunctionEnum
-                                    ) {
-                    for (ssize_t i = 0; i < thisValues.size(); ++i) {
-                        for (ssize_t j = 0; j < nextDeltas.size(); ++j) {
-                            upstreamGradients[i] += nextDeltas[j] * thisWeights[i][j];
-                        }
-                    }
-                    thisDeltas = buildActivationFunction(activationFunctionEnum)->derivative(thisValues, upstreamGradients);
-                }, h, std::ref(batchedUpstreamGradients[h]), std::cref(batchedNextDeltas[h]), std::cref(this->weights), std::ref(batchedDeltas[h]), std::cref(batchedValues[h]), activationFunctionEnum);
+        visitLossFunction<T>(lossFunctionEnum, [&](auto loss) {
+            using L = decltype(loss);
+            if constexpr (L::fusesSoftmax) {
+                // the target is actual at index and 0 elsewhere, so the gradient is actual * (values - e_index)
+                for (ssize_t j = 0; j < layerSize; ++j)
+                    this->deltas[j] = actual * this->values[j];
+                this->deltas[index] -= actual;
+            } else {
+                std::fill(std::begin(this->deltas), std::end(this->deltas), T(0));
+                this->deltas[index] = loss.L::operator()(actual, this->values[index]);
+                derivative(simd::data(this->deltas));
             }
+        });
+        updateBiases(optimizer, optimizer.coefficients(learningRate));
+    }
+    // rows [rowBegin, rowEnd) of out = activation(biases + prevValues * prevLayer.weights)
+    void batchedForward(const BasicLayer& prevLayer, const Matrix& prevValues, Matrix& out, ssize_t rowBegin, ssize_t rowEnd) const {
+        assert(prevValues.cols() == prevLayer.weights.rows() && prevLayer.weights.cols() == layerSize);      //assertion
+        assert(out.rows() == prevValues.rows() && out.cols() == layerSize);      //assertion
+        for (ssize_t b = rowBegin; b < rowEnd; ++b)
+            std::copy(std::begin(this->biases), std::end(this->biases), out.rowData(b));
+        gemm(rowEnd - rowBegin, layerSize, prevLayer.weights.rows(), prevValues.rowData(rowBegin), prevValues.cols(), prevLayer.weights.data(), prevLayer.weights.cols(), out.rowData(rowBegin), out.cols());
+        activateRows(out, rowBegin, rowEnd);
+    }
+    // the same from sparse prevValues: each row sums the weight rows of its non-zeros only
+    void batchedForward(const BasicLayer& prevLayer, const SparseMatrix& prevValues, Matrix& out, ssize_t rowBegin, ssize_t rowEnd) const {
+        assert(prevValues.cols() == prevLayer.weights.rows() && prevLayer.weights.cols() == layerSize);      //assertion
+        assert(out.rows() == prevValues.rows() && out.cols() == layerSize);      //assertion
+        const simd::BasicKernels<T>& k = simd::kernels<T>();
+        for (ssize_t b = rowBegin; b < rowEnd; ++b) {
+            T *row = out.rowData(b);
+            std::copy(std::begin(this->biases), std::end(this->biases), row);
+            const std::span<const uint32_t> columns = prevValues.columns(b);
+            const std::span<const T> values = prevValues.values(b);
+            for (size_t n = 0; n < columns.size(); ++n)
+                k.axpy(layerSize, values[n], prevLayer.weights.rowData(columns[n]), row);
+        }
+        activateRows(out, rowBegin, rowEnd);
+    }
+    Matrix batchedForward(const BasicLayer& prevLayer, const Matrix& prevValues) const {
+        Matrix out(prevValues.rows(), layerSize);
+        batchedForward(prevLayer, prevValues, out, 0, prevValues.rows());
+        return out;
+    }
+    GradientBuffer makeGradientBuffer() const {
+        return GradientBuffer(layerSize, nextLayerSize);
+    }
+    // Adds the gradients of this layer's weights and biases over the batch to gradients and returns the batch's deltas
+    // for the previous layer. Parameters are left untouched, see applyGradients.
+    Matrix accumulateGradients(const Matrix& batchedValues, const Matrix& batchedNextDeltas, GradientBuffer& gradients, ThreadPool *threadPool = nullptr) const {
+        assert(batchedValues.rows() == batchedNextDeltas.rows());      //assertion
+        assert(batchedValues.cols() == layerSize && batchedNextDeltas.cols() == nextLayerSize);      //assertion
+        assert(gradients.weights.rows() == layerSize && gradients.weights.cols() == nextLayerSize);      //assertion
+        const ssize_t batchSize = batchedValues.rows();
+        Matrix batchedDeltas(batchSize, layerSize);
+        // upstream gradients of the batch: nextDeltas * weights^T, with weights^T packed once for every slice, turned into
+        // the deltas in place while the slice is still in cache
+        const Matrix transposedWeights = this->weights.transposed();
+        auto backwardRows = [&](ssize_t rowBegin, ssize_t rowEnd) {
+            TELEMETRY_SCOPE("layer.deltas");
+            gemm(rowEnd - rowBegin, layerSize, nextLayerSize, batchedNextDeltas.rowData(rowBegin), batchedNextDeltas.cols(), transposedWeights.data(), transposedWeights.cols(), batchedDeltas.rowData(rowBegin), batchedDeltas.cols());
+            derivativeRows(batchedValues, batchedDeltas, rowBegin, rowEnd);
+        };
+        // weight gradients: the sum over the batch of outer products values[h]^T nextDeltas[h], i.e. values^T * nextDeltas,
+        // as one blocked gemm per slice of weight rows
+        const Matrix transposedValues = batchedValues.transposed();
+        auto gradientRows = [&](ssize_t rowBegin, ssize_t rowEnd) {
+            TELEMETRY_SCOPE("layer.weightGradients");
+            gemm(rowEnd - rowBegin, nextLayerSize, batchSize, transposedValues.rowData(rowBegin), transposedValues.cols(), batchedNextDeltas.data(), batchedNextDeltas.cols(), gradients.weights.rowData(rowBegin), gradients.weights.cols());
+        };
+        if (threadPool) {
+            threadPool->parallelFor(0, batchSize, 0, backwardRows);
+            threadPool->parallelFor(0, layerSize, 0, gradientRows);
         } else {
-            for (ssize_t h = 0; h < batchedValues.size(); ++h) {
-                for (ssize_t i = 0; i < this->values.size(); ++i) {
-                    for (ssize_t j = 0; j < nextLayer.values.size(); ++j) {
-                        batchedUpstreamGradients[h][i] += batchedNextDeltas[h][j] * this->weights[i][j];
-                    }
-                }
-                batchedDeltas[h] = activationFunction->derivative(batchedValues[h], batchedUpstreamGradients[h]);
-            }
+            backwardRows(0, batchSize);
+            gradientRows(0, layerSize);
         }
-        this->deltas = batchedDeltas.sum() / batchedDeltas.size();
-
-        momentumBiases = (1 - smoothingFactor) * momentumBiases + smoothingFactor * this->deltas;
-        rmspropBiases = (1 - smoothingFactor) * rmspropBiases + smoothingFactor * std::pow(this->deltas, 2);
-        this->biases -= learningRate * this->momentumBiases / (std::sqrt(rmspropBiases) + smallCorrection) + learningRate * this->biases * decayFactor;
-        
-        for (ssize_t i = 0; i < this->values.size(); ++i) {
-            for (ssize_t j = 0; j < nextLayer.values.size(); ++j) {
-                momentumWeights[i][j] *= 1 - smoothingFactor;
-                rmspropWeights[i][j] *= 1 - smoothingFactor;
-                double deltaWeightGrad = 0;
-                for (ssize_t h = 0; h < batchedValues.size(); ++h) {
-                    deltaWeightGrad += batchedNextDeltas[h][j] * batchedValues[h][i]; 
-                }
-                deltaWeightGrad /= batchedValues.size();
-                momentumWeights[i][j] += smoothingFactor * deltaWeightGrad;
-                rmspropWeights[i][j] += smoothingFactor * std::pow(deltaWeightGrad, 2);
-                this->weights[i][j] -= learningRate * momentumWeights[i][j] / (std::sqrt(rmspropWeights[i][j]) + smallCorrection) + learningRate * this->weights[i][j] * decayFactor;
+        addColumnSums(batchedDeltas, gradients.biases);
+        gradients.samples += batchSize;
+        gradients.sparse = false;
+        return batchedDeltas;
+    }
+    // For the input layer fed sparse batchedValues: adds the gradients of the weight rows of the features present in
+    // the batch, values[h][j] * nextDeltas[h] for every non-zero, and marks those rows active. No deltas are returned and
+    // the biases get no gradient, as nothing feeds the input layer and its biases never reach the output.
+    void accumulateSparseInputGradients(const SparseMatrix& batchedValues, const Matrix& batchedNextDeltas, GradientBuffer& gradients, ThreadPool *threadPool = nullptr) const {
+        assert(batchedValues.rows() == batchedNextDeltas.rows());      //assertion
+        assert(batchedValues.cols() == layerSize && batchedNextDeltas.cols() == nextLayerSize);      //assertion
+        assert(gradients.weights.rows() == layerSize && gradients.weights.cols() == nextLayerSize);      //assertion
+        const ssize_t batchSize = batchedValues.rows();
+        // samples may share features, so threads split the columns of the gradient rows rather than the samples
+        auto gradientCols = [&](ssize_t colBegin, ssize_t colEnd) {
+            TELEMETRY_SCOPE("layer.weightGradients");
+            const simd::BasicKernels<T>& k = simd::kernels<T>();
+            for (ssize_t h = 0; h < batchSize; ++h) {
+                const std::span<const uint32_t> columns = batchedValues.columns(h);
+                const std::span<const T> values = batchedValues.values(h);
+                for (size_t n = 0; n < columns.size(); ++n)
+                    k.axpy(colEnd - colBegin, values[n], batchedNextDeltas.rowData(h) + colBegin, gradients.weights.rowData(columns[n]) + colBegin);
             }
+        };
+        if (threadPool)
+            threadPool->parallelFor(0, nextLayerSize, 0, gradientCols);
+        else
+            gradientCols(0, nextLayerSize);
+        std::vector<ssize_t> rows;
+        rows.reserve(batchedValues.nonZeros());
+        for (ssize_t h = 0; h < batchSize; ++h)
+            for (uint32_t c: batchedValues.columns(h))
+                rows.push_back(c);
+        gradients.addActiveRows(std::move(rows));
+        gradients.samples += batchSize;
+    }
+    // the output layer has no weights; adds the gradients of its biases and returns the batch's deltas.
+    // batchedActual holds either the target rows or, in a single column when the layer is wider, class indices whose
+    // one-hot targets are never materialised
+    Matrix accumulateOutputGradients(const Matrix& batchedPredicted, const Matrix& batchedActual, GradientBuffer& gradients, ThreadPool *threadPool = nullptr) const {
+        assert(batchedPredicted.rows() == batchedActual.rows());
+        assert(batchedPredicted.cols() == layerSize);      //assertion
+        const bool sparse = batchedActual.cols() == 1 && layerSize > 1;
+        if (sparse) {
+            for (ssize_t i = 0; i < batchedActual.rows(); ++i)
+                if (!(batchedActual(i, 0) >= 0 && batchedActual(i, 0) < layerSize))
+                    throw std::runtime_error{"label "s + std::to_string(static_cast<long long>(batchedActual(i, 0))) + " is out of "s + std::to_string(layerSize) + " classes"s};
+        } else if (batchedActual.cols() != layerSize) {
+            throw std::runtime_error{"cannot train on targets of "s + std::to_string(batchedActual.cols()) + " columns for "s + std::to_string(layerSize) + " outputs"s};
         }
+        Matrix batchedDeltas(batchedPredicted.rows(), layerSize);
+        // loss gradient and activation derivative fused per row: each row of deltas is written once, then rewritten in place;
+        // a loss that fuses the softmax is the whole gradient already
+        auto backwardRows = [&](ssize_t rowBegin, ssize_t rowEnd) {
+            visitLossFunction<T>(lossFunctionEnum, [&](auto loss) {
+                using L = decltype(loss);
+                auto lossRows = [&](auto&& rowDone) {
+                    for (ssize_t i = rowBegin; i < rowEnd; ++i) {
+                        const T *predicted = batchedPredicted.rowData(i);
+                        const T *actual = batchedActual.rowData(i);
+                        T *thisDeltas = batchedDeltas.rowData(i);
+                        if (sparse) {
+                            const ssize_t label = static_cast<ssize_t>(actual[0]);
+                            for (ssize_t j = 0; j < layerSize; ++j)
+                                thisDeltas[j] = loss.L::operator()(T(0), predicted[j]);
+                            thisDeltas[label] = loss.L::operator()(T(1), predicted[label]);
+                        } else {
+                            for (ssize_t j = 0; j < layerSize; ++j)
+                                thisDeltas[j] = loss.L::operator()(actual[j], predicted[j]);
+                        }
+                        rowDone(predicted, thisDeltas);
+                    }
+                };
+                if constexpr (L::fusesSoftmax) {
+                    lossRows([](const T *, T *) {});
+                } else {
+                    visitActivationFunction<T>(activationFunctionEnum, [&](auto f) {
+                        using F = decltype(f);
+                        lossRows([&](const T *predicted, T *thisDeltas) {
+                            f.F::applyDerivative(std::span<const T>(predicted, layerSize), std::span<const T>(thisDeltas, layerSize), std::span<T>(thisDeltas, layerSize));
+                        });
+                    });
+                }
+            });
+        };
+        if (threadPool)
+            threadPool->parallelFor(0, batchedPredicted.rows(), 0, backwardRows);
+        else
+            backwardRows(0, batchedPredicted.rows());
+        addColumnSums(batchedDeltas, gradients.biases);
+        gradients.samples += batchedPredicted.rows();
+        gradients.sparse = false;
         return batchedDeltas;
     }
-    std::valarray<std::valarray<double>> batchedOutputBackward(const std::valarray<std::valarray<double>>& batchedPredicted, const std::valarray<std::valarray<double>>& batchedActual, double learningRate, size_t threadCounts = 1) {
-        assert(batchedPredicted.size() == batchedActual.size());
-        std::valarray<std::valarray<double>> batchedDeltas(std::valarray<double>(this->deltas.size()), batchedPredicted.size());
-        // this->deltas = 0;
-        if (threadCounts > 1) {
-            ThreadPool threadPool(threadCounts);
-            for (size_t i = 0; i < batchedPredicted.size(); ++i)
-                threadPool.addTasks([](size_t b
-                                        , std::valarray<double>& thisDeltas
-                                        , const std::valarray<double>& predicted
-                                        , const std::valarray<double>& actual
-                                        , ActivationFunctions activationFunction
-                                        , LossFunctions lossFunctionEnum
-                                    ) {
-                    thisDeltas = buildActivationFunction(activationFunction)->derivative(predicted, (*buildLossFunction(lossFunctionEnum))(actual, predicted));
-                }, i, std::ref(batchedDeltas[i]), std::cref(batchedPredicted[i]), std::cref(batchedActual[i]), activationFunctionEnum, lossFunctionEnum);
-        } else {
-            for (size_t i = 0; i < batchedPredicted.size(); ++i) {
-                batchedDeltas[i] = activationFunction->derivative(batchedPredicted[i], (*lossFunction)(batchedActual[i], batchedPredicted[i]));
-            }
+    // one optimizer step with the mean gradients of the buffer; the weights are updated in a single pass over the matrix
+    void applyGradients(const GradientBuffer& gradients, const Optimizer& optimizer, double learningRate, ThreadPool *threadPool = nullptr) {
+        assert(gradients.weights.rows() == layerSize && gradients.weights.cols() == nextLayerSize);      //assertion
+        if (!gradients.samples)
+            return;
+        const simd::UpdateCoefficients c = optimizer.coefficients(learningRate, 1. / gradients.samples);
+        // gradients of sparse inputs only: the active weight rows, when the optimizer leaves the zero-gradient parameters be
+        if (gradients.sparse && optimizer.skipsZeroGradients()) {
+            auto updateActiveRows = [&](ssize_t begin, ssize_t end) {
+                TELEMETRY_SCOPE("layer.update");
+                for (ssize_t n = begin; n < end; ++n) {
+                    const ssize_t r = gradients.activeRows[n];
+                    updateWeightRows(optimizer, c, r, r + 1, gradients.weights.rowData(r));
+                }
+            };
+            if (threadPool)
+                threadPool->parallelFor(0, gradients.activeRows.size(), 0, updateActiveRows);
+            else
+                updateActiveRows(0, gradients.activeRows.size());
+            return;
         }
-        this->deltas = batchedDeltas.sum() / batchedDeltas.size();
-        
-        momentumBiases = (1 - smoothingFactor) * momentumBiases + smoothingFactor * this->deltas;
-        rmspropBiases = (1 - smoothingFactor) * rmspropBiases + smoothingFactor * std::pow(this->deltas, 2);
-        this->biases -= learningRate * this->momentumBiases / (std::sqrt(rmspropBiases) + smallCorrection) + learningRate * this->biases * decayFactor;
+        updateBiases(optimizer, c, gradients.biases);
+        auto updateRows = [&](ssize_t rowBegin, ssize_t rowEnd) {
+            TELEMETRY_SCOPE("layer.update");
+            updateWeightRows(optimizer, c, rowBegin, rowEnd, gradients.weights.rowData(rowBegin));
+        };
+        if (threadPool)
+            threadPool->parallelFor(0, layerSize, 0, updateRows);
+        else
+            updateRows(0, layerSize);
+    }
+    // nextLayer is no longer needed and only kept for existing callers
+    Matrix batchedBackward(const Matrix& batchedValues, const Matrix& batchedNextDeltas, [[maybe_unused]] const BasicLayer& nextLayer, double learningRate, const Optimizer& optimizer = Optimizer{}, ThreadPool *threadPool = nullptr) {
+        TELEMETRY_SCOPE("layer.batchedBackward");
+        GradientBuffer gradients = makeGradientBuffer();
+        Matrix batchedDeltas = accumulateGradients(batchedValues, batchedNextDeltas, gradients, threadPool);
+        applyGradients(gradients, optimizer, learningRate, threadPool);
+        return batchedDeltas;
+    }
+    Matrix batchedOutputBackward(const Matrix& batchedPredicted, const Matrix& batchedActual, double learningRate, const Optimizer& optimizer = Optimizer{}, ThreadPool *threadPool = nullptr) {
+        GradientBuffer gradients = makeGradientBuffer();
+        Matrix batchedDeltas = accumulateOutputGradients(batchedPredicted, batchedActual, gradients, threadPool);
+        applyGradients(gradients, optimizer, learningRate, threadPool);
         return batchedDeltas;
     }
     ssize_t getLayerSize() const {
@@ -266,15 +515,25 @@ public:
         return nextLayerSize;
     }
     // std::valarray<double>& getValues() {}
-    friend class Network;
-    friend std::ostream& operator<< (std::ostream&, const Layer&);
-    friend std::istream& operator>> (std::istream&, Layer&);
+    template <class, class>
+    friend class BasicNetwork;
+    friend class Checkpoint;
+    friend class QuantizedNetwork;
+    template <class, class, template <class> class...> friend class BasicStaticNetwork;
+    template <class U, class V>
+    friend std::ostream& operator<< (std::ostream&, const BasicLayer<U, V>&);
+    template <class U, class V>
+    friend std::istream& operator>> (std::istream&, BasicLayer<U, V>&);
 };
 
-std::ostream& operator<< (std::ostream& os, const Layer& layer) {
+using Layer = BasicLayer<double>;
+
+template <class T, class M>
+std::ostream& operator<< (std::ostream& os, const BasicLayer<T, M>& layer) {
     os << "<layer>" << "\r\n";
     os << "size: " << layer.getLayerSize() << "\r\n";
     os << "next-size: " << layer.getNextLayerSize() << "\r\n";
+    os << "dtype: " << static_cast<size_t>(dataTypeOf<T>) << "\r\n";
     os << "biases: ";
     for (ssize_t i = 0; i < layer.biases.size(); ++i) {
         os << layer.biases[i] << ' ';
@@ -283,7 +542,7 @@ std::ostream& operator<< (std::ostream& os, const Layer& layer) {
     os << "weights: ";
     for (ssize_t i = 0; i < layer.getLayerSize(); ++i) {
         for (ssize_t j = 0; j < layer.getNextLayerSize(); ++j) {
-            os << layer.weights[i][j] << ' ';
+            os << layer.weights(i, j) << ' ';
         }
         os << "\r\n";
     }
@@ -293,7 +552,9 @@ std::ostream& operator<< (std::ostream& os, const Layer& layer) {
     return os;
 }
 
-std::istream& operator>> (std::istream& is, Layer& layer) {
+// values are parsed at the precision of T whatever the dtype line says
+template <class T, class M>
+std::istream& operator>> (std::istream& is, BasicLayer<T, M>& layer) {
     static auto info_size = "size: "s;
     static auto info_next_size = "next-size: "s;
     static auto info_biases = "biases: "s;
@@ -315,7 +576,7 @@ std::istream& operator>> (std::istream& is, Layer& layer) {
 
     iter = std::search(buffer.cbegin(), buffer.cend(), info_biases.cbegin(), info_biases.cend());
     std::advance(iter, info_biases.length());
-    std::valarray<double> biases(size);
+    std::valarray<T> biases(size);
     ptr = &*iter;
     for (int i = 0; i < size; ++i) {
         auto [neo_ptr, ec] = std::from_chars(ptr, reinterpret_cast<const char *>(&*buffer.cend()), biases[i]);
@@ -327,11 +588,11 @@ std::istream& operator>> (std::istream& is, Layer& layer) {
 
     iter = std::search(buffer.cbegin(), buffer.cend(), info_weights.cbegin(), info_weights.cend());
     std::advance(iter, info_weights.length());
-    std::valarray<std::valarray<double>> weights(std::valarray<double>(next_size), size);
+    BasicMatrix<T> weights(size, next_size);
     ptr = &*iter;
     for (ssize_t i = 0; i < size; ++i) {
         for (ssize_t j = 0; j < next_size; ++j) {
-            auto [neo_ptr, ec] = std::from_chars(ptr, reinterpret_cast<const char *>(&*buffer.cend()), weights[i][j]);
+            auto [neo_ptr, ec] = std::from_chars(ptr, reinterpret_cast<const char *>(&*buffer.cend()), weights(i, j));
             ptr = neo_ptr;
             ptr = std::find_if_not(ptr, &*buffer.cend(), [](char c){
                 return std::isspace(c);
@@ -349,7 +610,7 @@ std::istream& operator>> (std::istream& is, Layer& layer) {
     ptr = &*iter;
     LossFunctions lossFunctionEnum = static_cast<LossFunctions>(std::atoi(ptr));
 
-    Layer tmp(biases, weights, activationFunctionEnum, lossFunctionEnum);
+    BasicLayer<T, M> tmp(biases, std::move(weights), activationFunctionEnum, lossFunctionEnum);
 
     layer = std::move(tmp);
 
@@ -1,5 +1,7 @@
 #pragma once
 #include <valarray>
+#include <memory>
+#include <stdexcept>
 #ifndef M_PI
     #define M_PI 3.1415926535897932384626433832795
 #endif
@@ -11,95 +13,147 @@ enum class LossFunctions {
     TAN,
     POLICY_GRADIENT_LOSS,
     CUSTOM,
+    SOFTMAX_CROSS_ENTROPY,
 };
 
-struct LossFunction {
-    virtual std::valarray<double> operator() (const std::valarray<double>& actual, const std::valarray<double>& predicted) = 0;
-    virtual double operator() (double actual, double predicted) = 0;
+template <class T>
+struct BasicLossFunction {
+    // true when the loss gradient is taken with respect to the inputs of a softmax output activation, whose derivative
+    // the layer then skips
+    static constexpr bool fusesSoftmax = false;
+    virtual std::valarray<T> operator() (const std::valarray<T>& actual, const std::valarray<T>& predicted) = 0;
+    virtual T operator() (T actual, T predicted) = 0;
 };
 
-struct MSE: LossFunction {
-    std::valarray<double> operator() (const std::valarray<double>& actual, const std::valarray<double>& predicted) override {
+using LossFunction = BasicLossFunction<double>;
+
+template <class T>
+struct MSE: BasicLossFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& actual, const std::valarray<T>& predicted) override {
         return predicted - actual;
     }
-    double operator() (double actual, double predicted) override {
+    T operator() (T actual, T predicted) override {
         return predicted - actual;
     }
 };
 
-struct CrossEntropyLoss: LossFunction {
-    std::valarray<double> operator() (const std::valarray<double>& actual, const std::valarray<double>& predicted) override {
-        std::valarray<double> loss(actual.size());
+template <class T>
+struct CrossEntropyLoss: BasicLossFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& actual, const std::valarray<T>& predicted) override {
+        std::valarray<T> loss(actual.size());
         for (ssize_t i = 0; i < actual.size(); ++i) {
             loss[i] = (actual[i] == 0)? (-1. / (predicted[i] - 1.)): (-1. / predicted[i]);  
         }
         return loss;
     }
-    double operator() (double actual, double predicted) override {
+    T operator() (T actual, T predicted) override {
         return (actual == 0)? (-1. / (predicted - 1.)): (-1. / predicted);
     }
 };
 
-struct CrossEntropyLossV2: LossFunction {
-    std::valarray<double> operator() (const std::valarray<double>& actual, const std::valarray<double>& predicted) override {
-        std::valarray<double> loss(actual.size());
+template <class T>
+struct CrossEntropyLossV2: BasicLossFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& actual, const std::valarray<T>& predicted) override {
+        std::valarray<T> loss(actual.size());
         for (ssize_t i = 0; i < actual.size(); ++i) {
             loss[i] = (actual[i] == 0)? (-1. / (predicted[i] - 1.01) - .99): (-1. / (predicted[i] + .01) + .99);  
         }
         return loss;
     }
-    double operator() (double actual, double predicted) override {
+    T operator() (T actual, T predicted) override {
         return (actual == 0)? (-1. / (predicted - 1.01) - .99): (-1. / (predicted + .01) + .99);
     }
 };
 
-struct Tan: LossFunction {
+template <class T>
+struct Tan: BasicLossFunction<T> {
     static constexpr double tau = M_PI / 2; 
-    std::valarray<double> operator() (const std::valarray<double>& actual, const std::valarray<double>& predicted) override {
-        std::valarray<double> loss(actual.size());
+    std::valarray<T> operator() (const std::valarray<T>& actual, const std::valarray<T>& predicted) override {
+        std::valarray<T> loss(actual.size());
         for (ssize_t i = 0; i < actual.size(); ++i) {
             loss[i] = (std::pow(std::tan(((actual[i] == 0)? predicted[i]: 1. - predicted[i]) * tau), 2) + 1) * tau * ((actual[i] == 0)? 1: -1);
         }
         return loss;
     }
-    double operator() (double actual, double predicted) override {
+    T operator() (T actual, T predicted) override {
         return (std::pow(std::tan(((actual == 0)? predicted: 1. - predicted) * tau), 2) + 1) * tau * ((actual == 0)? 1: -1);
     }
 };
 
-struct PolicyGradientLoss: LossFunction {
-    std::valarray<double> operator() (const std::valarray<double>& q, const std::valarray<double>& predicted) override {
+template <class T>
+struct PolicyGradientLoss: BasicLossFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& q, const std::valarray<T>& predicted) override {
         return -q / (predicted + 1e-10);
     }
-    double operator() (double q, double predicted) override {
+    T operator() (T q, T predicted) override {
         return -q / (predicted + 1e-10);
     }
 };
 
-struct Custom: LossFunction {
-    std::valarray<double> operator() (const std::valarray<double>& loss, const std::valarray<double>& predicted) override {
+template <class T>
+struct Custom: BasicLossFunction<T> {
+    std::valarray<T> operator() (const std::valarray<T>& loss, const std::valarray<T>& predicted) override {
         return loss;
     }
-    double operator() (double loss, double predicted) override {
+    T operator() (T loss, T predicted) override {
         return loss;
     }
 };
 
+// Cross-entropy of a softmax output layer (SOFTMAX or STABLE_SOFTMAX) in closed form: the gradient of -sum(actual *
+// log(softmax(x))) with respect to x is softmax(x) - actual for a target summing to 1, so the output layer skips the
+// softmax Jacobian and the reciprocals of CROSS_ENTROPY_LOSS, and saturated outputs give bounded gradients.
+template <class T>
+struct SoftmaxCrossEntropy: BasicLossFunction<T> {
+    static constexpr bool fusesSoftmax = true;
+    std::valarray<T> operator() (const std::valarray<T>& actual, const std::valarray<T>& predicted) override {
+        return predicted - actual;
+    }
+    T operator() (T actual, T predicted) override {
+        return predicted - actual;
+    }
+};
+
+template <class T = double>
+static std::unique_ptr<BasicLossFunction<T>> buildLossFunction(const LossFunctions& n) {
+    switch (n) {
+        case LossFunctions::CROSS_ENTROPY_LOSS:
+            return std::make_unique<CrossEntropyLoss<T>>();
+        case LossFunctions::CROSS_ENTROPY_LOSS_V2:
+            return std::make_unique<CrossEntropyLossV2<T>>();
+        case LossFunctions::MSE:
+            return std::make_unique<MSE<T>>();
+        case LossFunctions::TAN:
+            return std::make_unique<Tan<T>>();
+        case LossFunctions::POLICY_GRADIENT_LOSS:
+            return std::make_unique<PolicyGradientLoss<T>>();
+        case LossFunctions::CUSTOM:
+            return std::make_unique<Custom<T>>();
+        case LossFunctions::SOFTMAX_CROSS_ENTROPY:
+            return std::make_unique<SoftmaxCrossEntropy<T>>();
+        default:
+            throw std::runtime_error{"cannot build LossFunction"};
+    }
+}
 
-static std::unique_ptr<LossFunction> buildLossFunction(const LossFunctions& n) {
+// calls f with a concrete loss function object of kind n; see visitActivationFunction
+template <class T = double, class F>
+decltype(auto) visitLossFunction(LossFunctions n, F&& f) {
     switch (n) {
         case LossFunctions::CROSS_ENTROPY_LOSS:
-            return std::make_unique<CrossEntropyLoss>();
+            return f(CrossEntropyLoss<T>{});
         case LossFunctions::CROSS_ENTROPY_LOSS_V2:
-            return std::make_unique<CrossEntropyLossV2>();
+            return f(CrossEntropyLossV2<T>{});
         case LossFunctions::MSE:
-            return std::make_unique<MSE>();
+            return f(MSE<T>{});
         case LossFunctions::TAN:
-            return std::make_unique<Tan>();
+            return f(Tan<T>{});
         case LossFunctions::POLICY_GRADIENT_LOSS:
-            return std::make_unique<PolicyGradientLoss>();
+            return f(PolicyGradientLoss<T>{});
         case LossFunctions::CUSTOM:
-            return std::make_unique<Custom>();
+            return f(Custom<T>{});
+        case LossFunctions::SOFTMAX_CROSS_ENTROPY:
+            return f(SoftmaxCrossEntropy<T>{});
         default:
             throw std::runtime_error{"cannot build LossFunction"};
     }
@@ -0,0 +1,134 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::string_literals;
+
+// a whole file mapped read-only; the mapping starts on a page boundary, so offsets aligned in the file stay aligned in memory
+class MappedFile {
+private:
+    const uint8_t *mapped{nullptr};
+    size_t length{0};
+#ifdef _WIN32
+    HANDLE mapping{nullptr};
+#endif
+
+    void unmap() noexcept {
+        if (!mapped)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(mapped);
+        CloseHandle(mapping);
+        mapping = nullptr;
+#else
+        ::munmap(const_cast<uint8_t *>(mapped), length);
+#endif
+        mapped = nullptr;
+    }
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& loc) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(loc.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error{"can't open "s + loc + " to map it"s};
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart)
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+            throw std::runtime_error{"can't map "s + loc};
+        mapped = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!mapped) {
+            CloseHandle(mapping);
+            throw std::runtime_error{"can't map "s + loc};
+        }
+        length = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = ::open(loc.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error{"can't open "s + loc + " to map it"s};
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (!::fstat(fd, &st) && st.st_size)
+            p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error{"can't map "s + loc};
+        mapped = static_cast<const uint8_t *>(p);
+        length = st.st_size;
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& o) noexcept: mapped(std::exchange(o.mapped, nullptr)), length(std::exchange(o.length, 0))
+#ifdef _WIN32
+        , mapping(std::exchange(o.mapping, nullptr))
+#endif
+    {}
+    MappedFile& operator=(MappedFile&& o) noexcept {
+        if (this != &o) {
+            unmap();
+            mapped = std::exchange(o.mapped, nullptr);
+            length = std::exchange(o.length, 0);
+#ifdef _WIN32
+            mapping = std::exchange(o.mapping, nullptr);
+#endif
+        }
+        return *this;
+    }
+    ~MappedFile() noexcept {
+        unmap();
+    }
+
+    const uint8_t *data() const noexcept {
+        return mapped;
+    }
+    size_t size() const noexcept {
+        return length;
+    }
+    // hints for streaming through a file larger than memory: start reading [offset, offset + n) in the background, and
+    // drop it from this process's resident pages once done with it (the page cache may still keep it)
+    void prefetch(size_t offset, size_t n) const noexcept {
+        if (!mapped || offset >= length)
+            return;
+        n = std::min(n, length - offset);
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY range{const_cast<uint8_t *>(mapped) + offset, n};
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        const size_t begin = pageFloor(offset);
+        ::madvise(const_cast<uint8_t *>(mapped) + begin, offset + n - begin, MADV_WILLNEED);
+#endif
+    }
+    void release(size_t offset, size_t n) const noexcept {
+        if (!mapped || offset >= length)
+            return;
+        n = std::min(n, length - offset);
+#ifndef _WIN32
+        const size_t begin = pageFloor(offset);
+        ::madvise(const_cast<uint8_t *>(mapped) + begin, offset + n - begin, MADV_DONTNEED);
+#endif
+    }
+private:
+#ifndef _WIN32
+    static size_t pageFloor(size_t offset) noexcept {
+        static const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+        return offset / pageSize * pageSize;
+    }
+#endif
+};
@@ -0,0 +1,154 @@
+#pragma once
+#include <vector>
+#include <valarray>
+#include <new>
+#include <cassert>
+#include <algorithm>
+#include <sys/types.h>
+
+template <class T, size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+    template <class U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+    AlignedAllocator() noexcept = default;
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+    T *allocate(size_t n) {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+    }
+    void deallocate(T *p, size_t) noexcept {
+        ::operator delete(p, std::align_val_t{Alignment});
+    }
+    template <class U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept {
+        return true;
+    }
+    template <class U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept {
+        return false;
+    }
+};
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// a row (stride 1) or a column (stride = cols) of a BasicMatrix
+template <class T>
+class StridedView {
+    T *ptr;
+    ssize_t count;
+    ssize_t step;
+public:
+    StridedView(T *ptr, ssize_t count, ssize_t step = 1): ptr(ptr), count(count), step(step) {}
+    T& operator[](ssize_t i) const {
+        return ptr[i * step];
+    }
+    T *data() const noexcept {
+        return ptr;
+    }
+    ssize_t size() const noexcept {
+        return count;
+    }
+    ssize_t stride() const noexcept {
+        return step;
+    }
+    bool contiguous() const noexcept {
+        return step == 1;
+    }
+    std::valarray<std::remove_const_t<T>> toValarray() const {
+        std::valarray<std::remove_const_t<T>> r(count);
+        for (ssize_t i = 0; i < count; ++i)
+            r[i] = ptr[i * step];
+        return r;
+    }
+};
+
+// contiguous, 64-byte aligned, row-major matrix
+template <class T>
+class BasicMatrix {
+    ssize_t rowCounts{0};
+    ssize_t colCounts{0};
+    AlignedVector<T> elements{};
+public:
+    using value_type = T;
+    BasicMatrix() = default;
+    BasicMatrix(ssize_t rows, ssize_t cols, const T& value = T{}): rowCounts(rows), colCounts(cols), elements(rows * cols, value) {}
+    explicit BasicMatrix(const std::valarray<std::valarray<T>>& nested):
+        rowCounts(nested.size()),
+        colCounts(nested.size()? nested[0].size(): 0),
+        elements(rowCounts * colCounts)
+    {
+        for (ssize_t i = 0; i < rowCounts; ++i) {
+            assert(nested[i].size() == colCounts);      //assertion
+            std::copy(std::begin(nested[i]), std::end(nested[i]), elements.begin() + i * colCounts);
+        }
+    }
+    T& operator()(ssize_t i, ssize_t j) noexcept {
+        return elements[i * colCounts + j];
+    }
+    const T& operator()(ssize_t i, ssize_t j) const noexcept {
+        return elements[i * colCounts + j];
+    }
+    StridedView<T> row(ssize_t i) noexcept {
+        return {elements.data() + i * colCounts, colCounts};
+    }
+    StridedView<const T> row(ssize_t i) const noexcept {
+        return {elements.data() + i * colCounts, colCounts};
+    }
+    StridedView<T> column(ssize_t j) noexcept {
+        return {elements.data() + j, rowCounts, colCounts};
+    }
+    StridedView<const T> column(ssize_t j) const noexcept {
+        return {elements.data() + j, rowCounts, colCounts};
+    }
+    T *rowData(ssize_t i) noexcept {
+        return elements.data() + i * colCounts;
+    }
+    const T *rowData(ssize_t i) const noexcept {
+        return elements.data() + i * colCounts;
+    }
+    T *data() noexcept {
+        return elements.data();
+    }
+    const T *data() const noexcept {
+        return elements.data();
+    }
+    ssize_t rows() const noexcept {
+        return rowCounts;
+    }
+    ssize_t cols() const noexcept {
+        return colCounts;
+    }
+    ssize_t size() const noexcept {
+        return rowCounts * colCounts;
+    }
+    bool empty() const noexcept {
+        return elements.empty();
+    }
+    void resize(ssize_t rows, ssize_t cols) {
+        rowCounts = rows;
+        colCounts = cols;
+        elements.resize(rows * cols);
+    }
+    void fill(const T& value) {
+        std::fill(elements.begin(), elements.end(), value);
+    }
+    BasicMatrix transposed() const {
+        BasicMatrix t(colCounts, rowCounts);
+        for (ssize_t i = 0; i < rowCounts; ++i)
+            for (ssize_t j = 0; j < colCounts; ++j)
+                t(j, i) = (*this)(i, j);
+        return t;
+    }
+    std::valarray<std::valarray<T>> toValarrays() const {
+        std::valarray<std::valarray<T>> nested(std::valarray<T>(colCounts), rowCounts);
+        for (ssize_t i = 0; i < rowCounts; ++i)
+            std::copy(rowData(i), rowData(i) + colCounts, std::begin(nested[i]));
+        return nested;
+    }
+};
+
+using Matrix = BasicMatrix<double>;
@@ -2,61 +2,34 @@
 #include <fstream>
 #include <valarray>
 #include <iostream>
+#include <algorithm>
+#include "idx.hpp"
 
 using namespace std::string_literals;
 
+// the eager loaders below widen the whole set to double; for training, IdxFile::gather converts one batch at a time instead
 std::valarray<double> loadLabels(const std::string& loc) {
-    if (std::ifstream ifs{loc, std::ios::binary}) {
-        unsigned char tmp;
-        unsigned ignoredU;
-        int counts;
-        ifs.read(reinterpret_cast<char *>(&ignoredU), sizeof(ignoredU));
-        ifs.read(reinterpret_cast<char *>(&counts), sizeof(counts));
-        std::reverse(reinterpret_cast<char *>(&counts), reinterpret_cast<char *>(&counts) + sizeof(counts));
-        std::valarray<double> buffer(counts);
-        for (int i = 0; i < counts; ++i) {
-            ifs.read(reinterpret_cast<char *>(&tmp), sizeof(tmp));
-            buffer[i] = tmp;
-        }
-        return buffer;
-    }
-    throw std::runtime_error{"can't open "s + loc + " to load labels"s};
+    IdxFile labels{loc, 1};
+    std::valarray<double> buffer(labels.counts());
+    std::copy(labels.data(), labels.data() + labels.counts(), std::begin(buffer));
+    return buffer;
 }
 
 int getCounts(const std::string& loc) {
-    if (std::ifstream ifs{loc, std::ios::binary}) {
-        int ignored;
-        int counts;
-        ifs.read(reinterpret_cast<char *>(&ignored), sizeof(ignored));
-        ifs.read(reinterpret_cast<char *>(&counts), sizeof(counts));
-        std::reverse(reinterpret_cast<char *>(&counts), reinterpret_cast<char *>(&counts) + sizeof(counts));
-        return counts;
-    }
-    throw std::runtime_error{"can't open "s + loc + " to get labels or images counts"s};
+    return IdxFile{loc}.counts();
 }
 
 std::valarray<std::valarray<double>> loadImages(const std::string& loc) {
-    if (std::ifstream ifs{loc, std::ios::binary}) {
-        unsigned char tmp;
-        unsigned ignoredU;
-        int counts;
-        ifs.read(reinterpret_cast<char *>(&ignoredU), sizeof(ignoredU));
-        ifs.read(reinterpret_cast<char *>(&counts), sizeof(counts));
-        std::reverse(reinterpret_cast<char *>(&counts), reinterpret_cast<char *>(&counts) + sizeof(counts));
-        ifs.read(reinterpret_cast<char *>(&ignoredU), sizeof(ignoredU));
-        ifs.read(reinterpret_cast<char *>(&ignoredU), sizeof(ignoredU));
-        std::valarray<std::valarray<double>> buffer(std::valarray<double>(28*28), counts);
-        for (int i = 0; i < counts; ++i) {
-            for (int j = 0; j < 28*28; ++j) {
-                ifs.read(reinterpret_cast<char *>(&tmp), sizeof(tmp));
-                buffer[i][j] = tmp;
-            }
-        }
-        return buffer;
-    }
-    throw std::runtime_error{"can't open "s + loc + " to load images"s};
+    IdxFile images{loc, 3};
+    if (images.itemSize() != 28*28)
+        throw std::runtime_error{loc + " does not hold 28x28 images"s};
+    std::valarray<std::valarray<double>> buffer(std::valarray<double>(28*28), images.counts());
+    for (size_t i = 0; i < images.counts(); ++i)
+        std::copy(images.item(i), images.item(i) + 28*28, std::begin(buffer[i]));
+    return buffer;
 }
 
+// dense one-hot rows; training also takes the classes of loadLabels as they are, see BasicNetwork::batchedTrain
 std::valarray<std::valarray<double>> classifyLabels(const std::valarray<double>& orignal) {
     std::valarray<std::valarray<double>> neo(std::valarray<double>(10), orignal.size());
     for (int i = 0; i < orignal.size(); ++i) {
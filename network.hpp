@@ -8,20 +8,71 @@
 #include <random>
 #include <string>
 #include <functional>
+#include <memory>
+#include <span>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
 #include "layer.hpp"
 #include "traits.hpp"
 #include "stream_utils.hpp"
 #include "thread_pool.hpp"
+#include "matrix.hpp"
+#include "sparse_matrix.hpp"
+#include "optimizer.hpp"
+#include "telemetry.hpp"
 
 using namespace std::literals;
 
-class Network {
+// result of BasicNetwork::evaluate over a labelled set
+struct Evaluation {
+    size_t counts{0};
+    size_t correctCounts{0};
+    // mean over the samples of -log(output of the actual class), the cross-entropy of a softmax output
+    double meanLoss{0};
+    size_t classCounts{0};
+    // classCounts * classCounts sample counts, row = actual class, column = predicted class
+    std::vector<size_t> confusion;
+
+    double accuracy() const noexcept {
+        return counts? correctCounts / static_cast<double>(counts): 0;
+    }
+    size_t confusionOf(size_t actual, size_t predicted) const noexcept {
+        return confusion[actual * classCounts + predicted];
+    }
+};
+
+// T is the compute precision of the values and weights; M, when wider, keeps master weights and optimizer moments
+// (see BasicLayer)
+template <class T, class M = T>
+class BasicNetwork {
+public:
+    using value_type = T;
+    using master_type = M;
+private:
+    using Layer = BasicLayer<T, M>;
+    using Matrix = BasicMatrix<T>;
+    using SparseMatrix = BasicSparseMatrix<T>;
+    using GradientBuffer = BasicGradientBuffer<T>;
+
     Layer inputLayer;
     std::vector<Layer> hiddenLayers;
     Layer outputLayer;
+    // long-lived workers shared by every batched path; null runs them on the calling thread
+    std::shared_ptr<ThreadPool> threadPool;
+    Optimizer optimizer;
+    // reused by batchedTrain: one set of per-layer buffers per data-parallel shard, with the shard's rows of the batch
+    std::vector<std::vector<GradientBuffer>> gradientShards;
+    std::vector<Matrix> shardInputs;
+    std::vector<Matrix> shardOutputs;
+    // smallest slice of a batch worth a shard of its own
+    static constexpr ssize_t minShardRows = 8;
+    // samples per task of test and evaluate
+    static constexpr size_t evaluationBatchSize = 256;
 public:
     template <class I, typename = std::enable_if_t<std::is_integral_v<I>>>
-    Network(ssize_t inputLayerNodeCounts
+    BasicNetwork(ssize_t inputLayerNodeCounts
                 , ssize_t outputLayerNodeCounts
                 , const std::vector<I>& hiddenLayersNodeCounts
                 , const std::vector<ActivationFunctions>& hiddenLayersActivationFunctionEnum = {}
@@ -42,93 +93,178 @@ public:
         assert(hiddenLayersActivationFunctionEnum.size() == hiddenLayersNodeCounts.size() || !hiddenLayersActivationFunctionEnum.size());
         for (ssize_t i = 0; i < hiddenLayersNodeCounts.size(); ++i) {
             hiddenLayers.emplace_back(hiddenLayersNodeCounts.at(i)
-                                        , (i + 1 < hiddenLayersNodeCounts.size())? hiddenLayersNodeCounts.at(i): outputLayerNodeCounts
+                                        , (i + 1 < hiddenLayersNodeCounts.size())? hiddenLayersNodeCounts.at(i + 1): outputLayerNodeCounts
                                         , hiddenLayersActivationFunctionEnum.size()? hiddenLayersActivationFunctionEnum[i]: ActivationFunctions::LEAKYRELU
                                     );
         }
         if (balanced) {
-            for (std::valarray<double>& weight: hiddenLayers.back().weights)
-                std::fill(std::begin(weight) + 1, std::end(weight), weight[0]);
+            Matrix& weights = hiddenLayers.back().weights;
+            for (ssize_t i = 0; i < weights.rows(); ++i)
+                std::fill(weights.rowData(i) + 1, weights.rowData(i) + weights.cols(), weights(i, 0));
             std::fill(std::begin(outputLayer.biases) + 1, std::end(outputLayer.biases), outputLayer.biases[0]);
+            hiddenLayers.back().copyToMaster();
+            outputLayer.copyToMaster();
         }
     }
     template <
-        class T, 
+        class L, 
         class... _Arg,
         template <class, class> class V, 
         typename = std::enable_if_t <
-            std::is_same_v<std::decay_t<T>, Layer> 
-            && std::is_constructible_v<std::vector<Layer, _Arg...>, V<T, _Arg...>>
+            std::is_same_v<std::decay_t<L>, Layer> 
+            && std::is_constructible_v<std::vector<Layer, _Arg...>, V<L, _Arg...>>
         >
     >
-    Network(T&& inputLayer, V<T, _Arg...>&& hiddenLayers, T&& outputLayer)
-        : inputLayer(std::forward<T>(inputLayer)) 
-        , hiddenLayers(std::forward<V<T, _Arg...>>(hiddenLayers))
-        , outputLayer(std::forward<T>(outputLayer))
+    BasicNetwork(L&& inputLayer, V<L, _Arg...>&& hiddenLayers, L&& outputLayer)
+        : inputLayer(std::forward<L>(inputLayer)) 
+        , hiddenLayers(std::forward<V<L, _Arg...>>(hiddenLayers))
+        , outputLayer(std::forward<L>(outputLayer))
     {}
-    Network() = default;
-    std::valarray<double> train(const std::valarray<double>& input, const std::valarray<double>& output, double learningRate) {
+    BasicNetwork() = default;
+    std::valarray<T> train(const std::valarray<T>& input, const std::valarray<T>& output, double learningRate) {
         assert(input.size() == inputLayer.values.size());       //assertion
         assert(output.size() == outputLayer.values.size());       //assertion
         run(input);
-        outputLayer.outputBackward(output, learningRate);
+        ++optimizer.steps;
+        outputLayer.outputBackward(output, learningRate, optimizer);
         for (ssize_t i = hiddenLayers.size() - 1; i >= 0; --i) {
-            hiddenLayers[i].backward((i == hiddenLayers.size() - 1)? outputLayer: hiddenLayers[i + 1], learningRate);
+            hiddenLayers[i].backward((i == hiddenLayers.size() - 1)? outputLayer: hiddenLayers[i + 1], learningRate, optimizer);
         }
-        inputLayer.backward(hiddenLayers[0], learningRate);
+        inputLayer.backward(hiddenLayers[0], learningRate, optimizer);
         return outputLayer.values;
     }
-    std::valarray<double> train(const std::valarray<double>& input, double output, size_t index, double learningRate) {
+    std::valarray<T> train(const std::valarray<T>& input, T output, size_t index, double learningRate) {
         assert(input.size() == inputLayer.values.size());       //assertion
         assert(index < outputLayer.values.size());       //assertion
         run(input);
-        outputLayer.outputBackward(output, index, learningRate);
+        ++optimizer.steps;
+        outputLayer.outputBackward(output, index, learningRate, optimizer);
         for (ssize_t i = hiddenLayers.size() - 1; i >= 0; --i) {
-            hiddenLayers[i].backward((i == hiddenLayers.size() - 1)? outputLayer: hiddenLayers[i + 1], learningRate);
+            hiddenLayers[i].backward((i == hiddenLayers.size() - 1)? outputLayer: hiddenLayers[i + 1], learningRate, optimizer);
         }
-        inputLayer.backward(hiddenLayers[0], learningRate);
+        inputLayer.backward(hiddenLayers[0], learningRate, optimizer);
         return outputLayer.values;
     }
-    void batchedTrain(const std::valarray<std::valarray<double>>& batchedInput, const std::valarray<std::valarray<double>>& batchedOutput, double learningRate, size_t threadCounts = 1) {
-        assert(batchedInput.size() == batchedOutput.size());       //assertion
-        // z: Layers; y: batches; x: nodes
-        std::vector<std::valarray<std::valarray<double>>> batchedHiddenLayersValues(size_t(hiddenLayers.size()), std::valarray<std::valarray<double>>(size_t(batchedInput.size())));
-        // y: batches; x: nodes
-        std::valarray<std::valarray<double>> batchedOutputLayerValues(size_t(batchedInput.size()));
-        if (threadCounts > 1) {
-            ThreadPool threadPool(threadCounts);
-            for (size_t i = 0; i < batchedInput.size(); ++i) {
-                threadPool.addTasks([](size_t b
-                                        , const std::valarray<double>& inputValues
-                                        , std::vector<std::valarray<std::valarray<double>>>& batchedHiddenLayersValues
-                                        , std::valarray<double>& outputLayerValues
-                                        , const Layer& inputLayer
-                                        , const std::vector<Layer>& hiddenLayers
-                                        , const Layer& outputLayer
-                                    ) {
-                    for (ssize_t j = 0; j < batchedHiddenLayersValues.size(); ++j) {
-                        batchedHiddenLayersValues[j][b] = hiddenLayers[j].externForward(j? hiddenLayers[j - 1]: inputLayer, j? batchedHiddenLayersValues[j - 1][b]: inputValues);
-                    }
-                    outputLayerValues = outputLayer.externForward(hiddenLayers.back(), batchedHiddenLayersValues.back()[b]);
-                }, i, std::cref(batchedInput[i]), std::ref(batchedHiddenLayersValues), std::ref(batchedOutputLayerValues[i]), std::cref(inputLayer), std::cref(hiddenLayers), std::cref(outputLayer));
-            }
+    // Data-parallel with a pool: every shard of the batch runs forward and backward on one thread into its own
+    // gradient buffers, the shards are summed by a tree reduction and one optimizer step follows.
+    // batchedOutput rows are the targets, or a single column of class indices for a wider output layer (one-hot targets
+    // that are never built). threadCounts 0 keeps the current pool (see setThreadCounts)
+    void batchedTrain(const Matrix& batchedInput, const Matrix& batchedOutput, double learningRate, size_t threadCounts = 0) {
+        assert(batchedInput.rows() == batchedOutput.rows());       //assertion
+        TELEMETRY_SCOPE("batchedTrain");
+        if (threadCounts)
+            setThreadCounts(threadCounts);
+        const ssize_t batchSize = batchedInput.rows();
+        TELEMETRY_SAMPLES(batchSize);
+        const ssize_t shardCounts = threadPool? std::clamp<ssize_t>(batchSize / minShardRows, 1, threadPool->getThreadCounts()): 1;
+        prepareGradientShards(shardCounts);
+        if (shardCounts == 1) {
+            accumulateGradients(batchedInput, batchedOutput, gradientShards[0], threadPool.get());
         } else {
-            for (size_t i = 0; i < batchedInput.size(); ++i) {
-                for (ssize_t j = 0; j < batchedHiddenLayersValues.size(); ++j) {
-                    batchedHiddenLayersValues[j][i] = hiddenLayers[j].externForward(j? hiddenLayers[j - 1]: inputLayer, j? batchedHiddenLayersValues[j - 1][i]: batchedInput[i]);
+            threadPool->parallelFor(0, shardCounts, 1, [&](ssize_t shardBegin, ssize_t shardEnd) {
+                for (ssize_t s = shardBegin; s < shardEnd; ++s) {
+                    const ssize_t rowBegin = batchSize * s / shardCounts;
+                    const ssize_t rowEnd = batchSize * (s + 1) / shardCounts;
+                    {
+                        TELEMETRY_SCOPE("shard");
+                        shardInputs[s].resize(rowEnd - rowBegin, batchedInput.cols());
+                        shardOutputs[s].resize(rowEnd - rowBegin, batchedOutput.cols());
+                        std::copy(batchedInput.rowData(rowBegin), batchedInput.rowData(rowEnd), shardInputs[s].data());
+                        std::copy(batchedOutput.rowData(rowBegin), batchedOutput.rowData(rowEnd), shardOutputs[s].data());
+                    }
+                    accumulateGradients(shardInputs[s], shardOutputs[s], gradientShards[s], nullptr);
                 }
-                batchedOutputLayerValues[i] = outputLayer.externForward(hiddenLayers.back(), batchedHiddenLayersValues.back()[i]);
-            }
+            });
+            TELEMETRY_SCOPE("reduce");
+            reduceGradientShards(shardCounts);
         }
-
-        std::valarray<std::valarray<double>> batchedDeltas = outputLayer.batchedOutputBackward(batchedOutputLayerValues, batchedOutput, learningRate, threadCounts);
-        for (ssize_t i = hiddenLayers.size() - 1; i >= 0; --i) {
-            batchedDeltas = hiddenLayers[i].batchedBackward(batchedHiddenLayersValues[i], batchedDeltas, (i == hiddenLayers.size() - 1)? outputLayer: hiddenLayers[i + 1], learningRate, threadCounts);
-        }
-        inputLayer.batchedBackward(batchedInput, batchedDeltas, hiddenLayers[0], learningRate, threadCounts);
-        return;
+        applyGradients(gradientShards[0], learningRate);
+    }
+    void batchedTrain(const std::valarray<std::valarray<T>>& batchedInput, const std::valarray<std::valarray<T>>& batchedOutput, double learningRate, size_t threadCounts = 0) {
+        batchedTrain(Matrix(batchedInput), Matrix(batchedOutput), learningRate, threadCounts);
     }
-    std::valarray<double> run(const std::valarray<double>& input) {
+    // Sparse inputs such as bag-of-words features: the first layer multiplies the non-zeros only, and only the weight rows
+    // of the features in the batch get gradients (and, see Optimizer::lazy, steps). The batch is not sharded; the pool
+    // splits the work inside every layer instead
+    void batchedTrain(const SparseMatrix& batchedInput, const Matrix& batchedOutput, double learningRate, size_t threadCounts = 0) {
+        assert(batchedInput.rows() == batchedOutput.rows());       //assertion
+        TELEMETRY_SCOPE("batchedTrain");
+        if (threadCounts)
+            setThreadCounts(threadCounts);
+        TELEMETRY_SAMPLES(batchedInput.rows());
+        prepareGradientShards(1);
+        accumulateGradients(batchedInput, batchedOutput, gradientShards[0], threadPool.get());
+        applyGradients(gradientShards[0], learningRate);
+    }
+    // batchedLabels: the class of every sample, e.g. mnist.hpp::loadLabels
+    void batchedTrain(const std::valarray<std::valarray<T>>& batchedInput, const std::valarray<T>& batchedLabels, double learningRate, size_t threadCounts = 0) {
+        Matrix labels(batchedLabels.size(), 1);
+        std::copy(std::begin(batchedLabels), std::end(batchedLabels), labels.data());
+        batchedTrain(Matrix(batchedInput), labels, learningRate, threadCounts);
+    }
+    // one buffer per layer: input layer, hidden layers, output layer
+    std::vector<GradientBuffer> makeGradientBuffers() const {
+        std::vector<GradientBuffer> gradients;
+        gradients.push_back(inputLayer.makeGradientBuffer());
+        for (const Layer& hiddenLayer: hiddenLayers)
+            gradients.push_back(hiddenLayer.makeGradientBuffer());
+        gradients.push_back(outputLayer.makeGradientBuffer());
+        return gradients;
+    }
+    // forward and backward pass of the batch, adding its gradients to the buffers of makeGradientBuffers() without
+    // changing any parameter; call it on several micro-batches before one applyGradients to accumulate
+    void accumulateGradients(const Matrix& batchedInput, const Matrix& batchedOutput, std::vector<GradientBuffer>& gradients) const {
+        accumulateGradients(batchedInput, batchedOutput, gradients, threadPool.get());
+    }
+    void accumulateGradients(const SparseMatrix& batchedInput, const Matrix& batchedOutput, std::vector<GradientBuffer>& gradients) const {
+        accumulateGradients(batchedInput, batchedOutput, gradients, threadPool.get());
+    }
+    // one optimizer step of every layer with the mean of the accumulated gradients
+    void applyGradients(const std::vector<GradientBuffer>& gradients, double learningRate) {
+        assert(gradients.size() == hiddenLayers.size() + 2);       //assertion
+        TELEMETRY_SCOPE("update");
+        ++optimizer.steps;
+        inputLayer.applyGradients(gradients.front(), optimizer, learningRate, threadPool.get());
+        for (ssize_t i = 0; i < hiddenLayers.size(); ++i)
+            hiddenLayers[i].applyGradients(gradients[i + 1], optimizer, learningRate, threadPool.get());
+        outputLayer.applyGradients(gradients.back(), optimizer, learningRate, threadPool.get());
+    }
+    // one row per sample; every layer is a single matrix-matrix product over the whole batch
+    Matrix runBatch(const Matrix& inputs) const {
+        std::vector<Matrix> batchedHiddenLayersValues;
+        Matrix batchedOutputLayerValues;
+        batchedForward(inputs, batchedHiddenLayersValues, batchedOutputLayerValues, threadPool.get());
+        return batchedOutputLayerValues;
+    }
+    Matrix runBatch(const SparseMatrix& inputs) const {
+        std::vector<Matrix> batchedHiddenLayersValues;
+        Matrix batchedOutputLayerValues;
+        batchedForward(inputs, batchedHiddenLayersValues, batchedOutputLayerValues, threadPool.get());
+        return batchedOutputLayerValues;
+    }
+    // keeps one pool of threadCounts workers alive across batches; 0 or 1 runs everything on the calling thread
+    void setThreadCounts(size_t threadCounts) {
+        if (threadCounts <= 1)
+            threadPool.reset();
+        else if (!threadPool || threadPool->getThreadCounts() != threadCounts)
+            threadPool = std::make_shared<ThreadPool>(threadCounts);
+    }
+    size_t getThreadCounts() const noexcept {
+        return threadPool? threadPool->getThreadCounts(): 1;
+    }
+    // e.g. setOptimizer(buildOptimizer(Optimizers::ADAM)); clears the moment buffers and the step count
+    void setOptimizer(const Optimizer& optimizer) {
+        this->optimizer = optimizer;
+        this->optimizer.steps = 0;
+        inputLayer.resetOptimizerState();
+        for (Layer& hiddenLayer: hiddenLayers)
+            hiddenLayer.resetOptimizerState();
+        outputLayer.resetOptimizerState();
+    }
+    const Optimizer& getOptimizer() const noexcept {
+        return optimizer;
+    }
+    std::valarray<T> run(const std::valarray<T>& input) {
         inputLayer.values = input;
         for (ssize_t i = 0; i < hiddenLayers.size(); ++i) {
             hiddenLayers[i].forward((i == 0)? inputLayer: hiddenLayers.at(i - 1));
@@ -136,21 +272,132 @@ public:
         outputLayer.forward(hiddenLayers.back());
         return outputLayer.values;
     }
+    // scratch activations of one const run() at a time; grows to fit the widest network it has served, then is reused
+    using Workspace = std::vector<T>;
+    // Inference without heap allocation or writes to the network, so one model can serve any number of threads: the
+    // activations ping-pong between two halves of the workspace and the output layer writes straight into output.
+    void run(std::span<const T> input, std::span<T> output, Workspace& workspace) const {
+        assert(input.size() == inputLayer.layerSize && output.size() == outputLayer.layerSize);       //assertion
+        ssize_t widest = 0;
+        for (const Layer& hiddenLayer: hiddenLayers)
+            widest = std::max(widest, hiddenLayer.layerSize);
+        if (workspace.size() < 2 * widest)
+            workspace.resize(2 * widest);
+        const T *prevValues = input.data();
+        for (ssize_t i = 0; i < hiddenLayers.size(); ++i) {
+            T *values = workspace.data() + (i % 2) * widest;
+            hiddenLayers[i].forward(i? hiddenLayers[i - 1]: inputLayer, prevValues, values);
+            prevValues = values;
+        }
+        outputLayer.forward(hiddenLayers.empty()? inputLayer: hiddenLayers.back(), prevValues, output.data());
+    }
+    // the same with a workspace per calling thread
+    void run(std::span<const T> input, std::span<T> output) const {
+        thread_local Workspace workspace;
+        run(input, output, workspace);
+    }
+    // const counterpart of run(valarray), which goes through the layers' own values and is for training
+    std::valarray<T> predict(const std::valarray<T>& input) const {
+        std::valarray<T> output(outputLayer.layerSize);
+        run(std::span<const T>(simd::data(input), input.size()), std::span<T>(simd::data(output), output.size()));
+        return output;
+    }
     template <class _Actual, class _BiPred>
-    bool test(const std::valarray<double>& testInputs, _Actual&& testActual, _BiPred&& biPred) {
-        std::valarray<double> testPredicted = this->run(testInputs);
+    bool test(const std::valarray<T>& testInputs, _Actual&& testActual, _BiPred&& biPred) {
+        std::valarray<T> testPredicted = this->run(testInputs);
         return biPred(testPredicted, testActual);
     }
+    // runs batches of evaluationBatchSize samples through batchedForward, split across the thread pool when there is
+    // one, so biPred may be called concurrently
     template <class _Actual, class _BiPred>
-    double test(const std::valarray<std::valarray<double>>& testInputs, _Actual&& testActual, _BiPred&& biPred) {
-        ssize_t correctCounts = 0;
-        for (ssize_t i = 0; i < testInputs.size(); ++i) {
-            if (biPred(this->run(testInputs[i]), testActual[i]))
-                ++correctCounts;
-        }
+    double test(const std::valarray<std::valarray<T>>& testInputs, _Actual&& testActual, _BiPred&& biPred) const {
+        const size_t batchCounts = (testInputs.size() + evaluationBatchSize - 1) / evaluationBatchSize;
+        std::atomic<ssize_t> correctCounts{0};
+        auto testBatches = [&](ssize_t batchBegin, ssize_t batchEnd) {
+            Matrix inputs;
+            std::vector<Matrix> batchedHiddenLayersValues;
+            Matrix outputs;
+            std::valarray<T> predicted(outputLayer.layerSize);
+            ssize_t counts = 0;
+            for (ssize_t b = batchBegin; b < batchEnd; ++b) {
+                const size_t begin = b * evaluationBatchSize;
+                const size_t end = std::min(begin + evaluationBatchSize, testInputs.size());
+                gatherRows(testInputs, begin, end, inputs);
+                batchedForward(inputs, batchedHiddenLayersValues, outputs, nullptr);
+                for (size_t i = begin; i < end; ++i) {
+                    std::copy(outputs.rowData(i - begin), outputs.rowData(i - begin) + outputLayer.layerSize, std::begin(predicted));
+                    if (biPred(predicted, testActual[i]))
+                        ++counts;
+                }
+            }
+            correctCounts += counts;
+        };
+        if (threadPool)
+            threadPool->parallelFor(0, batchCounts, 0, testBatches);
+        else
+            testBatches(0, batchCounts);
         return correctCounts / static_cast<double>(testInputs.size());
     }
-    void assignData(const Network& n) {
+    // accuracy, confusion matrix and mean loss of a classifier in one pass: testLabels holds class indices, the
+    // predicted class is the greatest output. The set is cut into batches of batchSize samples that run through
+    // batchedForward on separate threads of the pool; per-batch losses are summed in batch order and the counts are
+    // integers, so the result does not depend on the thread count. Each task of the pool keeps one confusion matrix,
+    // added to the result when it is done
+    template <class _Label>
+    Evaluation evaluate(const std::valarray<std::valarray<T>>& testInputs, const std::valarray<_Label>& testLabels, size_t batchSize = evaluationBatchSize) const {
+        assert(testInputs.size() == testLabels.size() && batchSize > 0);       //assertion
+        const size_t classCounts = outputLayer.layerSize;
+        for (const _Label& label: testLabels)
+            if (!(label >= 0 && label < classCounts))
+                throw std::runtime_error{"label "s + std::to_string(static_cast<long long>(label)) + " is out of "s + std::to_string(classCounts) + " classes"s};
+        const size_t batchCounts = (testInputs.size() + batchSize - 1) / batchSize;
+        struct Partial {
+            size_t correctCounts{0};
+            double lossSum{0};
+        };
+        std::vector<Partial> partials(batchCounts);
+        Evaluation evaluation;
+        evaluation.counts = testInputs.size();
+        evaluation.classCounts = classCounts;
+        evaluation.confusion.assign(classCounts * classCounts, 0);
+        std::mutex confusionMutex;
+        auto evaluateBatches = [&](ssize_t batchBegin, ssize_t batchEnd) {
+            Matrix inputs;
+            std::vector<Matrix> batchedHiddenLayersValues;
+            Matrix outputs;
+            std::vector<size_t> confusion(classCounts * classCounts, 0);
+            for (ssize_t b = batchBegin; b < batchEnd; ++b) {
+                const size_t begin = b * batchSize;
+                const size_t end = std::min(begin + batchSize, testInputs.size());
+                gatherRows(testInputs, begin, end, inputs);
+                batchedForward(inputs, batchedHiddenLayersValues, outputs, nullptr);
+                Partial& partial = partials[b];
+                for (size_t i = begin; i < end; ++i) {
+                    const T *output = outputs.rowData(i - begin);
+                    const size_t actual = static_cast<size_t>(testLabels[i]);
+                    const size_t predicted = std::max_element(output, output + classCounts) - output;
+                    partial.correctCounts += predicted == actual;
+                    partial.lossSum -= std::log(std::max<double>(output[actual], 1e-12));
+                    ++confusion[actual * classCounts + predicted];
+                }
+            }
+            std::lock_guard lock(confusionMutex);
+            for (size_t c = 0; c < confusion.size(); ++c)
+                evaluation.confusion[c] += confusion[c];
+        };
+        if (threadPool)
+            threadPool->parallelFor(0, batchCounts, 0, evaluateBatches);
+        else
+            evaluateBatches(0, batchCounts);
+        double lossSum = 0;
+        for (const Partial& partial: partials) {
+            evaluation.correctCounts += partial.correctCounts;
+            lossSum += partial.lossSum;
+        }
+        evaluation.meanLoss = evaluation.counts? lossSum / evaluation.counts: 0;
+        return evaluation;
+    }
+    void assignData(const BasicNetwork& n) {
         inputLayer.weights = n.inputLayer.weights;
         inputLayer.biases = n.inputLayer.biases;
         for (size_t i = 0; i < hiddenLayers.size(); ++i) {
@@ -159,12 +406,149 @@ public:
         }
         outputLayer.weights = n.outputLayer.weights;
         outputLayer.biases = n.outputLayer.biases;
+        inputLayer.copyToMaster();
+        for (Layer& hiddenLayer: hiddenLayers)
+            hiddenLayer.copyToMaster();
+        outputLayer.copyToMaster();
+    }
+private:
+    // multiply-adds of rows [rowBegin, rowEnd) of the batch with each column of the input layer's weights
+    static double inputMultiplyAdds(const Matrix& batchedInput, ssize_t rowBegin, ssize_t rowEnd) noexcept {
+        return static_cast<double>(rowEnd - rowBegin) * batchedInput.cols();
+    }
+    static double inputMultiplyAdds(const SparseMatrix& batchedInput, ssize_t rowBegin, ssize_t rowEnd) noexcept {
+        return batchedInput.nonZeros(rowBegin, rowEnd);
+    }
+    // samples [begin, end) as the rows of inputs
+    void gatherRows(const std::valarray<std::valarray<T>>& samples, size_t begin, size_t end, Matrix& inputs) const {
+        inputs.resize(end - begin, inputLayer.layerSize);
+        for (size_t i = begin; i < end; ++i) {
+            assert(samples[i].size() == inputLayer.layerSize);       //assertion
+            std::copy(std::begin(samples[i]), std::end(samples[i]), inputs.rowData(i - begin));
+        }
+    }
+    // fresh or cleared gradient buffers for shards [0, shardCounts)
+    void prepareGradientShards(ssize_t shardCounts) {
+        if (gradientShards.size() < shardCounts) {
+            gradientShards.resize(shardCounts);
+            shardInputs.resize(shardCounts);
+            shardOutputs.resize(shardCounts);
+        }
+        for (ssize_t s = 0; s < shardCounts; ++s) {
+            if (gradientShards[s].empty())
+                gradientShards[s] = makeGradientBuffers();
+            else
+                for (GradientBuffer& gradients: gradientShards[s])
+                    gradients.clear();
+        }
+    }
+    // Inputs: Matrix or SparseMatrix
+    template <class Inputs>
+    void accumulateGradients(const Inputs& batchedInput, const Matrix& batchedOutput, std::vector<GradientBuffer>& gradients, ThreadPool *threadPool) const {
+        assert(batchedInput.rows() == batchedOutput.rows());       //assertion
+        assert(gradients.size() == hiddenLayers.size() + 2);       //assertion
+        // z: Layers; y: batches; x: nodes
+        std::vector<Matrix> batchedHiddenLayersValues;
+        // y: batches; x: nodes
+        Matrix batchedOutputLayerValues;
+        {
+            TELEMETRY_SCOPE("forward");
+            batchedForward(batchedInput, batchedHiddenLayersValues, batchedOutputLayerValues, threadPool);
+        }
+
+        // layers are numbered from 0, the input layer, to hiddenLayers.size() + 1, the output layer; the backward pass
+        // of a layer with weights is two gemms, into the previous deltas and into the weight gradients
+        TELEMETRY_SCOPE("backward");
+        Matrix batchedDeltas;
+        {
+            TELEMETRY_LAYER_SCOPE("backward", hiddenLayers.size() + 1, 0);
+            batchedDeltas = outputLayer.accumulateOutputGradients(batchedOutputLayerValues, batchedOutput, gradients.back(), threadPool);
+        }
+        for (ssize_t i = hiddenLayers.size() - 1; i >= 0; --i) {
+            TELEMETRY_LAYER_SCOPE("backward", i + 1, 4. * batchedInput.rows() * hiddenLayers[i].layerSize * hiddenLayers[i].nextLayerSize);
+            batchedDeltas = hiddenLayers[i].accumulateGradients(batchedHiddenLayersValues[i], batchedDeltas, gradients[i + 1], threadPool);
+        }
+        TELEMETRY_LAYER_SCOPE("backward", 0, (std::is_same_v<Inputs, SparseMatrix>? 2.: 4.) * inputMultiplyAdds(batchedInput, 0, batchedInput.rows()) * inputLayer.nextLayerSize);
+        if constexpr (std::is_same_v<Inputs, SparseMatrix>)
+            inputLayer.accumulateSparseInputGradients(batchedInput, batchedDeltas, gradients.front(), threadPool);
+        else
+            inputLayer.accumulateGradients(batchedInput, batchedDeltas, gradients.front(), threadPool);
+    }
+    // gradientShards[0] += gradientShards[1 .. shardCounts): log2(shardCounts) levels of pairwise sums, shard s taking
+    // shard s + stride; each level runs its pairs in parallel, split into row blocks so a task stays in cache
+    void reduceGradientShards(ssize_t shardCounts) {
+        static constexpr ssize_t rowsPerTask = 32;
+        struct Sum {
+            GradientBuffer *dst;
+            const GradientBuffer *src;
+            ssize_t rowBegin;
+            ssize_t rowEnd;
+        };
+        std::vector<Sum> sums;
+        for (ssize_t stride = 1; stride < shardCounts; stride *= 2) {
+            sums.clear();
+            for (ssize_t s = 0; s + stride < shardCounts; s += 2 * stride) {
+                for (size_t l = 0; l < gradientShards[s].size(); ++l) {
+                    GradientBuffer& dst = gradientShards[s][l];
+                    const GradientBuffer& src = gradientShards[s + stride][l];
+                    for (ssize_t r = 0; r < dst.weights.rows(); r += rowsPerTask)
+                        sums.push_back({&dst, &src, r, std::min(r + rowsPerTask, dst.weights.rows())});
+                    dst.samples += src.samples;
+                    if (src.sparse)
+                        dst.addActiveRows(src.activeRows);
+                    else
+                        dst.sparse = false;
+                }
+            }
+            threadPool->parallelFor(0, sums.size(), 0, [&sums](ssize_t begin, ssize_t end) {
+                for (ssize_t t = begin; t < end; ++t)
+                    sums[t].dst->addRows(*sums[t].src, sums[t].rowBegin, sums[t].rowEnd);
+            });
+        }
+    }
+    template <class Inputs>
+    void batchedForward(const Inputs& batchedInput, std::vector<Matrix>& batchedHiddenLayersValues, Matrix& batchedOutputLayerValues, ThreadPool *threadPool) const {
+        assert(batchedInput.cols() == inputLayer.layerSize);       //assertion
+        const ssize_t batchSize = batchedInput.rows();
+        batchedHiddenLayersValues.clear();
+        for (const Layer& hiddenLayer: hiddenLayers)
+            batchedHiddenLayersValues.emplace_back(batchSize, hiddenLayer.layerSize);
+        batchedOutputLayerValues.resize(batchSize, outputLayer.layerSize);
+        auto forwardRows = [&](ssize_t rowBegin, ssize_t rowEnd) {
+            {
+                TELEMETRY_LAYER_SCOPE("forward", 1, 2. * inputMultiplyAdds(batchedInput, rowBegin, rowEnd) * hiddenLayers[0].layerSize);
+                hiddenLayers[0].batchedForward(inputLayer, batchedInput, batchedHiddenLayersValues[0], rowBegin, rowEnd);
+            }
+            for (ssize_t j = 1; j < hiddenLayers.size(); ++j) {
+                TELEMETRY_LAYER_SCOPE("forward", j + 1, 2. * (rowEnd - rowBegin) * hiddenLayers[j - 1].layerSize * hiddenLayers[j].layerSize);
+                hiddenLayers[j].batchedForward(hiddenLayers[j - 1], batchedHiddenLayersValues[j - 1], batchedHiddenLayersValues[j], rowBegin, rowEnd);
+            }
+            TELEMETRY_LAYER_SCOPE("forward", hiddenLayers.size() + 1, 2. * (rowEnd - rowBegin) * hiddenLayers.back().layerSize * outputLayer.layerSize);
+            outputLayer.batchedForward(hiddenLayers.back(), batchedHiddenLayersValues.back(), batchedOutputLayerValues, rowBegin, rowEnd);
+        };
+        // samples are independent, so each thread carries its own slice of rows through every layer
+        if (threadPool)
+            threadPool->parallelFor(0, batchSize, 0, forwardRows);
+        else
+            forwardRows(0, batchSize);
     }
-    friend inline std::ostream& operator<< (std::ostream&, const Network&);
-    friend inline std::istream& operator>> (std::istream&, Network&);
+public:
+    template <class U, class V>
+    friend std::ostream& operator<< (std::ostream&, const BasicNetwork<U, V>&);
+    template <class U, class V>
+    friend std::istream& operator>> (std::istream&, BasicNetwork<U, V>&);
+    friend class Checkpoint;
+    friend class QuantizedNetwork;
+    template <class, class, template <class> class...> friend class BasicStaticNetwork;
 };
 
-inline std::ostream& operator<< (std::ostream& os, const Network& network) {
+using Network = BasicNetwork<double>;
+using FloatNetwork = BasicNetwork<float>;
+// fp32 forward and backward passes, fp64 weight updates
+using MixedPrecisionNetwork = BasicNetwork<float, double>;
+
+template <class T, class M>
+std::ostream& operator<< (std::ostream& os, const BasicNetwork<T, M>& network) {
     os << "<network>" << "\r\n";
     os << "<hidden-layers-counts>" << "\r\n";
     os << network.hiddenLayers.size() << "\r\n";
@@ -186,7 +570,9 @@ inline std::ostream& operator<< (std::ostream& os, const Network& network) {
     return os;
 }
 
-inline std::istream& operator>> (std::istream& is, Network& network) {
+template <class T, class M>
+std::istream& operator>> (std::istream& is, BasicNetwork<T, M>& network) {
+    using Layer = BasicLayer<T, M>;
     skipTill(is, "<hidden-layers-counts>"s);
     ssize_t hidden_size;
     is >> hidden_size;
@@ -206,7 +592,7 @@ inline std::istream& operator>> (std::istream& is, Network& network) {
     is >> outputLayer;
 
     skipTill(is, "</network>"s);
-    Network tmp(std::move(inputLayer), std::move(hiddenLayers), std::move(outputLayer));
+    BasicNetwork<T, M> tmp(std::move(inputLayer), std::move(hiddenLayers), std::move(outputLayer));
     network = std::move(tmp);
     return is;
 }
\ No newline at end of file
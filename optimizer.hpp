@@ -0,0 +1,130 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "simd.hpp"
+
+enum class Optimizers {
+    MOMENTUM_RMSPROP,
+    SGD,
+    MOMENTUM,
+    RMSPROP,
+    ADAM,
+    ADAMW,
+};
+
+// The update rule of every Layer parameter. Each kind maps onto simd::UpdateCoefficients, so a step is one fused
+// pass over the weights, the gradient and the moment buffers whatever the optimizer.
+//   SGD:              w -= lr * g
+//   MOMENTUM:         m = beta1 m + g;  w -= lr * m
+//   RMSPROP:          v = beta2 v + (1 - beta2) g^2;  w -= lr * g / (sqrt(v) + eps)
+//   ADAM:             bias-corrected m and v, weightDecay added to the gradient as L2
+//   ADAMW:            bias-corrected m and v, weightDecay decoupled: w -= lr * weightDecay * w
+//   MOMENTUM_RMSPROP: ADAMW without bias correction; the rule Layer always used, and the default
+struct Optimizer {
+    Optimizers kind{Optimizers::MOMENTUM_RMSPROP};
+    double beta1{1 - 1.e-3};
+    double beta2{1 - 1.e-3};
+    double eps{1.e-10};
+    double weightDecay{1.e-8};
+    // steps taken so far, for the bias correction of ADAM and ADAMW
+    size_t steps{0};
+    // With sparse inputs, step only the input-layer weight rows of the features present in the batch and leave the
+    // others, moments included, as they are (lazy moments and weight decay, as LazyAdam does). Not saved in checkpoints.
+    // SGD without weight decay always skips those rows, as its step is zero there anyway
+    bool lazy{false};
+
+    bool skipsZeroGradients() const noexcept {
+        return lazy || (kind == Optimizers::SGD && weightDecay == 0);
+    }
+
+    bool usesFirstMoment() const noexcept {
+        return kind == Optimizers::MOMENTUM || kind == Optimizers::ADAM || kind == Optimizers::ADAMW || kind == Optimizers::MOMENTUM_RMSPROP;
+    }
+    bool usesSecondMoment() const noexcept {
+        return kind == Optimizers::RMSPROP || kind == Optimizers::ADAM || kind == Optimizers::ADAMW || kind == Optimizers::MOMENTUM_RMSPROP;
+    }
+    // coefficients of the current step for the gradient gScale * grad
+    simd::UpdateCoefficients coefficients(double learningRate, double gScale = 1) const {
+        simd::UpdateCoefficients c;
+        c.gScale = gScale;
+        c.learningRate = learningRate;
+        c.eps = eps;
+        const double t = static_cast<double>(std::max<size_t>(steps, 1));
+        switch (kind) {
+            case Optimizers::SGD:
+                c.l2 = weightDecay;
+                break;
+            case Optimizers::MOMENTUM:
+                c.a1 = beta1;
+                c.l2 = weightDecay;
+                break;
+            case Optimizers::RMSPROP:
+                c.a2 = beta2;
+                c.b2 = 1 - beta2;
+                c.l2 = weightDecay;
+                break;
+            case Optimizers::ADAM:
+            case Optimizers::ADAMW:
+                c.a1 = beta1;
+                c.b1 = 1 - beta1;
+                c.a2 = beta2;
+                c.b2 = 1 - beta2;
+                c.c1 = 1 / (1 - std::pow(beta1, t));
+                c.c2 = 1 / (1 - std::pow(beta2, t));
+                (kind == Optimizers::ADAM? c.l2: c.decay) = weightDecay;
+                break;
+            case Optimizers::MOMENTUM_RMSPROP:
+                c.a1 = beta1;
+                c.b1 = 1 - beta1;
+                c.a2 = beta2;
+                c.b2 = 1 - beta2;
+                c.decay = weightDecay;
+                break;
+            default:
+                throw std::runtime_error{"cannot build Optimizer"};
+        }
+        return c;
+    }
+    // w -= step of (c.gScale * grad) over n contiguous parameters; m and v must have n elements when the kind uses them
+    template <class T>
+    void update(ssize_t n, T *w, T *m, T *v, const T *grad, const simd::UpdateCoefficients& c) const {
+        simd::kernels<T>().optimizerUpdate(n, w, usesFirstMoment()? m: nullptr, usesSecondMoment()? v: nullptr, grad, c);
+    }
+};
+
+// the usual hyperparameters of each kind; adjust the fields of the result to tune
+inline Optimizer buildOptimizer(const Optimizers& n) {
+    Optimizer optimizer;
+    optimizer.kind = n;
+    switch (n) {
+        case Optimizers::MOMENTUM_RMSPROP:
+            return optimizer;
+        case Optimizers::SGD:
+            optimizer.weightDecay = 0;
+            return optimizer;
+        case Optimizers::MOMENTUM:
+            optimizer.beta1 = .9;
+            optimizer.weightDecay = 0;
+            return optimizer;
+        case Optimizers::RMSPROP:
+            optimizer.beta2 = .9;
+            optimizer.eps = 1.e-8;
+            optimizer.weightDecay = 0;
+            return optimizer;
+        case Optimizers::ADAM:
+            optimizer.beta1 = .9;
+            optimizer.beta2 = .999;
+            optimizer.eps = 1.e-8;
+            optimizer.weightDecay = 0;
+            return optimizer;
+        case Optimizers::ADAMW:
+            optimizer.beta1 = .9;
+            optimizer.beta2 = .999;
+            optimizer.eps = 1.e-8;
+            optimizer.weightDecay = 1.e-2;
+            return optimizer;
+        default:
+            throw std::runtime_error{"cannot build Optimizer"};
+    }
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include <vector>
+#include <valarray>
+#include <memory>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include "network.hpp"
+#include "matrix.hpp"
+#include "simd.hpp"
+
+// Post-training int8 quantization of a trained network, for inference only.
+// Weights are symmetric int8 with one scale per output node, stored transposed so that every output is one contiguous
+// int8 dot product. Activations are symmetric int8 with one scale per layer, calibrated as the largest magnitude the
+// layer input takes over a sample set (e.g. the t10k images). Products accumulate exactly in int32 (simd::int8Kernels);
+// the bias and the activation function run in float on the dequantized sums.
+class QuantizedNetwork {
+private:
+    struct QuantizedLayer {
+        ssize_t inputSize;
+        ssize_t outputSize;
+        // outputSize rows of the inputSize weights into each output node
+        std::vector<int8_t> weights;
+        // dequantizes the int32 sum of output j: inputScale * scale of weight row j
+        std::vector<float> outputScales;
+        std::vector<float> biases;
+        // real value of one int8 step of the input
+        float inputScale;
+        ActivationFunctions activationFunctionEnum;
+    };
+    std::vector<QuantizedLayer> layers;
+    // the pool of the source network, for test
+    std::shared_ptr<ThreadPool> threadPool;
+
+    static float scaleOf(float maxAbs) noexcept {
+        return (maxAbs > 0)? maxAbs / 127: 1;
+    }
+    static int8_t quantize(float x, float inverseScale) noexcept {
+        return static_cast<int8_t>(std::clamp(std::lrint(x * inverseScale), -127l, 127l));
+    }
+    template <class T>
+    static float maxAbsOf(const BasicMatrix<T>& m) noexcept {
+        T maxAbs = 0;
+        for (ssize_t i = 0; i < m.size(); ++i)
+            maxAbs = std::max(maxAbs, std::abs(m.data()[i]));
+        return maxAbs;
+    }
+    template <class T, class M>
+    void addLayer(const BasicLayer<T, M>& from, const BasicLayer<T, M>& to, float inputMaxAbs) {
+        QuantizedLayer layer;
+        layer.inputSize = from.layerSize;
+        layer.outputSize = to.layerSize;
+        layer.weights.resize(layer.outputSize * layer.inputSize);
+        layer.outputScales.resize(layer.outputSize);
+        layer.biases.assign(std::begin(to.biases), std::end(to.biases));
+        layer.inputScale = scaleOf(inputMaxAbs);
+        layer.activationFunctionEnum = to.activationFunctionEnum;
+        for (ssize_t j = 0; j < layer.outputSize; ++j) {
+            T maxAbs = 0;
+            for (ssize_t i = 0; i < layer.inputSize; ++i)
+                maxAbs = std::max(maxAbs, std::abs(from.weights(i, j)));
+            const float weightScale = scaleOf(maxAbs);
+            for (ssize_t i = 0; i < layer.inputSize; ++i)
+                layer.weights[j * layer.inputSize + i] = quantize(from.weights(i, j), 1 / weightScale);
+            layer.outputScales[j] = layer.inputScale * weightScale;
+        }
+        layers.push_back(std::move(layer));
+    }
+    // one sample through every layer; values holds the input on entry and the output on return. Once quantized, a
+    // layer's input is dead, so values is overwritten with the dequantized sums and activated in place; none of the
+    // buffers allocate after the first sample
+    void forward(std::vector<float>& values, std::vector<int8_t>& quantized, std::vector<int32_t>& sums) const {
+        for (const QuantizedLayer& layer: layers) {
+            assert(values.size() == layer.inputSize);       //assertion
+            quantized.resize(layer.inputSize);
+            const float inverseScale = 1 / layer.inputScale;
+            for (ssize_t i = 0; i < layer.inputSize; ++i)
+                quantized[i] = quantize(values[i], inverseScale);
+            sums.resize(layer.outputSize);
+            simd::int8Kernels().gemv(layer.outputSize, layer.inputSize, layer.weights.data(), layer.inputSize, quantized.data(), sums.data());
+            values.resize(layer.outputSize);
+            for (ssize_t j = 0; j < layer.outputSize; ++j)
+                values[j] = sums[j] * layer.outputScales[j] + layer.biases[j];
+            visitActivationFunction<float>(layer.activationFunctionEnum, [&](auto f) {
+                using F = decltype(f);
+                f.F::apply(std::span<const float>(values), std::span<float>(values));
+            });
+        }
+    }
+public:
+    // calibration holds one sample per row, scaled as the network was trained (e.g. pixels / 255)
+    template <class T, class M>
+    QuantizedNetwork(const BasicNetwork<T, M>& network, const BasicMatrix<T>& calibration): threadPool(network.threadPool) {
+        assert(calibration.rows() > 0);       //assertion
+        std::vector<BasicMatrix<T>> batchedHiddenLayersValues;
+        BasicMatrix<T> batchedOutputLayerValues;
+        network.batchedForward(calibration, batchedHiddenLayersValues, batchedOutputLayerValues, network.threadPool.get());
+        addLayer(network.inputLayer, network.hiddenLayers.empty()? network.outputLayer: network.hiddenLayers[0], maxAbsOf(calibration));
+        for (size_t i = 0; i < network.hiddenLayers.size(); ++i)
+            addLayer(network.hiddenLayers[i], (i + 1 < network.hiddenLayers.size())? network.hiddenLayers[i + 1]: network.outputLayer, maxAbsOf(batchedHiddenLayersValues[i]));
+    }
+
+    ssize_t inputSize() const noexcept {
+        return layers.front().inputSize;
+    }
+    ssize_t outputSize() const noexcept {
+        return layers.back().outputSize;
+    }
+    // weights and biases
+    size_t parameterCounts() const noexcept {
+        size_t counts = 0;
+        for (const QuantizedLayer& layer: layers)
+            counts += layer.weights.size() + layer.biases.size();
+        return counts;
+    }
+    // bytes of every weight, bias and scale
+    size_t parameterBytes() const noexcept {
+        size_t bytes = 0;
+        for (const QuantizedLayer& layer: layers)
+            bytes += layer.weights.size() * sizeof(int8_t) + (layer.biases.size() + layer.outputScales.size() + 1) * sizeof(float);
+        return bytes;
+    }
+
+    template <class T>
+    std::valarray<T> run(const std::valarray<T>& input) const {
+        std::vector<float> values(std::begin(input), std::end(input));
+        std::vector<int8_t> quantized;
+        std::vector<int32_t> sums;
+        forward(values, quantized, sums);
+        std::valarray<T> output(values.size());
+        std::copy(std::begin(values), std::end(values), std::begin(output));
+        return output;
+    }
+    // one row per sample
+    template <class T>
+    BasicMatrix<T> runBatch(const BasicMatrix<T>& inputs) const {
+        assert(inputs.cols() == inputSize());       //assertion
+        BasicMatrix<T> outputs(inputs.rows(), outputSize());
+        std::vector<float> values;
+        std::vector<int8_t> quantized;
+        std::vector<int32_t> sums;
+        for (ssize_t b = 0; b < inputs.rows(); ++b) {
+            values.assign(inputs.rowData(b), inputs.rowData(b) + inputs.cols());
+            forward(values, quantized, sums);
+            std::copy(std::begin(values), std::end(values), outputs.rowData(b));
+        }
+        return outputs;
+    }
+    // same contract as Network::test, split across the source network's thread pool when it has one
+    template <class T, class _Actual, class _BiPred>
+    double test(const std::valarray<std::valarray<T>>& testInputs, _Actual&& testActual, _BiPred&& biPred) const {
+        std::atomic<ssize_t> correctCounts{0};
+        auto testSamples = [&](ssize_t begin, ssize_t end) {
+            std::vector<float> values;
+            std::vector<int8_t> quantized;
+            std::vector<int32_t> sums;
+            std::valarray<T> output(outputSize());
+            ssize_t counts = 0;
+            for (ssize_t i = begin; i < end; ++i) {
+                values.assign(std::begin(testInputs[i]), std::end(testInputs[i]));
+                forward(values, quantized, sums);
+                std::copy(values.begin(), values.end(), std::begin(output));
+                if (biPred(output, testActual[i]))
+                    ++counts;
+            }
+            correctCounts += counts;
+        };
+        if (threadPool)
+            threadPool->parallelFor(0, testInputs.size(), 0, testSamples);
+        else
+            testSamples(0, testInputs.size());
+        return correctCounts / static_cast<double>(testInputs.size());
+    }
+};
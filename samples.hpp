@@ -1,6 +1,7 @@
 #pragma once
 #include <fstream>
 #include "network.hpp"
+#include "checkpoint.hpp"
 #include "mnist.hpp"
 #include "activation_functions.hpp"
 #include "loss_functions.hpp"
@@ -11,38 +12,34 @@ using namespace std::literals;
 
 inline void mnist() {
     Network n(28*28, 10, std::vector{128}, std::vector{ActivationFunctions::LEAKYRELU}, ActivationFunctions::STABLE_SOFTMAX_V3, LossFunctions::CROSS_ENTROPY_LOSS_V2);
-    if (std::ifstream ifs{"mnist-v4.dat", std::ios::binary}) {
+    if (std::ifstream{"mnist-v4.dat", std::ios::binary}) {
         std::cout << "train on an existing network" << "\r\n";
-        ifs >> n;
+        n = loadNetwork("mnist-v4.dat");
     } else {
         std::cout << "new network" << "\r\n";
     }
     std::valarray<double> trainLabels{loadLabels("train-labels.idx1-ubyte"s)};
-    std::valarray<std::valarray<double>> trainLabelsClassified{classifyLabels(trainLabels)};
     std::valarray<std::valarray<double>> trainImages{loadImages("train-images.idx3-ubyte"s)};
     std::for_each(std::begin(trainImages), std::end(trainImages), [](std::valarray<double>& v){
         v /= 255;
     });
     std::valarray<double> testLabels{loadLabels("t10k-labels.idx1-ubyte"s)};
-    std::valarray<std::valarray<double>> testLabelsClassified{classifyLabels(testLabels)};
     std::valarray<std::valarray<double>> testImages{loadImages("t10k-images.idx3-ubyte"s)};
     std::for_each(std::begin(testImages), std::end(testImages), [](std::valarray<double>& v){
         v /= 255;
     });
-    decltype(trainLabelsClassified) trimmedTrainLabelsClassified = trainLabelsClassified[std::slice(0, 60000, 1)];
+    decltype(trainLabels) trimmedTrainLabels = trainLabels[std::slice(0, 60000, 1)];
     decltype(trainImages) trimmedTrainImages = trainImages[std::slice(0, 60000, 1)];
     decltype(testImages) trimmedTestImages = testImages[std::slice(0, 10000, 1)];
     decltype(testLabels) trimmedTestLabels = testLabels[std::slice(0, 10000, 1)];
 
     size_t batchSize = 64;
-    train(n, trimmedTrainImages, trimmedTrainLabelsClassified, .000'1, 20, batchSize, testImages, testLabels, [](const std::valarray<double>& predicted, const double& actual){
+    train(n, trimmedTrainImages, trimmedTrainLabels, .000'1, 20, batchSize, testImages, testLabels, [](const std::valarray<double>& predicted, const double& actual){
         return getGreatestLabel(predicted) == actual;
     }, 6);
 
-    if (std::ofstream ofs{"garbage.dat", std::ios::binary}) {
-        ofs << n;
-        std::cout << "the trained network is saved." << "\r\n";
-    }
+    Checkpoint::save(n, "garbage.dat");
+    std::cout << "the trained network is saved." << "\r\n";
 
 }
 
@@ -0,0 +1,248 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <string>
+#include <utility>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <cstdint>
+#include <cassert>
+#include "matrix.hpp"
+#include "idx.hpp"
+
+using namespace std::string_literals;
+
+// Out-of-core mini-batches from IDX shards, each an (images, labels) pair of files such as the MNIST ones, for datasets
+// larger than memory.
+// Randomisation is two-level: every epoch shuffles the order of fixed-size chunks of consecutive samples (block
+// shuffle), and the samples of windowChunks chunks at a time are shuffled together (shuffle buffer). A reader thread
+// streams the chunks in that order, each one read sequentially with the next already prefetched and its pages released
+// after the copy, so resident memory stays at about 2 * windowChunks * chunkSamples samples and I/O overlaps training.
+// next() hands out batches like DataLoader::next.
+template <class T = double>
+class BasicShardedIdxDataset {
+public:
+    using Matrix = BasicMatrix<T>;
+private:
+    struct Shard {
+        IdxFile images;
+        IdxFile labels;
+    };
+    struct Chunk {
+        size_t shard;
+        size_t begin;
+        size_t end;
+    };
+    struct LoadedChunk {
+        std::vector<uint8_t> images;
+        std::vector<uint8_t> labels;
+    };
+    std::vector<Shard> shards;
+    std::vector<Chunk> chunks;
+    size_t itemSize{0};
+    size_t sampleCounts{0};
+    const size_t batchSize;
+    const size_t windowChunks;
+    const double scale;
+    const size_t classCounts;
+    const bool dropLast;
+    std::mt19937 gen;
+
+    // shared with the reader, under mutex
+    std::vector<size_t> chunkOrder;
+    size_t nextToLoad{0};
+    size_t generation{0};
+    std::deque<LoadedChunk> ready;
+    std::exception_ptr failure;
+    bool stopping{false};
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // the caller's side: the current window of chunks and its shuffled samples (chunk in window, offset in chunk)
+    size_t takenChunks{0};
+    std::vector<LoadedChunk> window;
+    std::vector<std::pair<uint32_t, uint32_t>> samples;
+    size_t cursor{0};
+    Matrix inputs;
+    Matrix outputs;
+    std::thread reader;
+
+    LoadedChunk load(const Chunk& chunk, const Chunk *following) const {
+        const Shard& shard = shards[chunk.shard];
+        if (following)
+            shards[following->shard].images.prefetch(following->begin, following->end);
+        LoadedChunk loaded;
+        loaded.images.assign(shard.images.item(chunk.begin), shard.images.item(chunk.end));
+        loaded.labels.assign(shard.labels.item(chunk.begin), shard.labels.item(chunk.end));
+        shard.images.release(chunk.begin, chunk.end);
+        shard.labels.release(chunk.begin, chunk.end);
+        return loaded;
+    }
+    void read() {
+        std::unique_lock lock(mutex);
+        for (;;) {
+            // one window being consumed, one queued behind it
+            changed.wait(lock, [this] { return stopping || (nextToLoad < chunkOrder.size() && ready.size() < windowChunks); });
+            if (stopping)
+                return;
+            const size_t loading = generation;
+            const Chunk chunk = chunks[chunkOrder[nextToLoad]];
+            ++nextToLoad;
+            const Chunk *following = (nextToLoad < chunkOrder.size())? &chunks[chunkOrder[nextToLoad]]: nullptr;
+            lock.unlock();
+            LoadedChunk loaded;
+            std::exception_ptr error;
+            try {
+                loaded = load(chunk, following);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            // an epoch restarted meanwhile throws its chunks away
+            if (loading != generation)
+                continue;
+            if (error)
+                failure = error;
+            else
+                ready.push_back(std::move(loaded));
+            changed.notify_all();
+        }
+    }
+    // the next window of the epoch; empty past its end
+    void refill() {
+        window.clear();
+        samples.clear();
+        cursor = 0;
+        std::unique_lock lock(mutex);
+        while (window.size() < windowChunks && takenChunks < chunkOrder.size()) {
+            changed.wait(lock, [this] { return !ready.empty() || failure; });
+            if (failure)
+                std::rethrow_exception(failure);
+            window.push_back(std::move(ready.front()));
+            ready.pop_front();
+            ++takenChunks;
+            changed.notify_all();
+        }
+        lock.unlock();
+        for (uint32_t c = 0; c < window.size(); ++c)
+            for (uint32_t i = 0; i < window[c].labels.size(); ++i)
+                samples.emplace_back(c, i);
+        std::shuffle(samples.begin(), samples.end(), gen);
+    }
+public:
+    // shardLocs: (images, labels) IDX files; images are scaled by scale, labels one-hot over classCounts or, with
+    // classCounts 0, one column of class indices (see BasicNetwork::batchedTrain)
+    BasicShardedIdxDataset(const std::vector<std::pair<std::string, std::string>>& shardLocs
+                            , size_t batchSize
+                            , size_t chunkSamples = 4096
+                            , size_t windowChunks = 4
+                            , double scale = 1. / 255
+                            , size_t classCounts = 10
+                            , bool dropLast = true
+                            , unsigned seed = std::random_device{}()
+                        ):
+        batchSize(batchSize),
+        windowChunks(std::max<size_t>(windowChunks, 1)),
+        scale(scale),
+        classCounts(classCounts),
+        dropLast(dropLast),
+        gen(seed)
+    {
+        assert(batchSize > 0 && chunkSamples > 0);       //assertion
+        for (const auto& [imagesLoc, labelsLoc]: shardLocs) {
+            Shard shard{IdxFile{imagesLoc}, IdxFile{labelsLoc, 1}};
+            if (shard.images.counts() != shard.labels.counts())
+                throw std::runtime_error{imagesLoc + " and "s + labelsLoc + " hold different sample counts"s};
+            if (itemSize && shard.images.itemSize() != itemSize)
+                throw std::runtime_error{imagesLoc + " holds samples of another size than the shards before it"s};
+            itemSize = shard.images.itemSize();
+            for (size_t begin = 0; begin < shard.images.counts(); begin += chunkSamples)
+                chunks.push_back({shards.size(), begin, std::min(begin + chunkSamples, shard.images.counts())});
+            sampleCounts += shard.images.counts();
+            shards.push_back(std::move(shard));
+        }
+        if (!sampleCounts)
+            throw std::runtime_error{"cannot build a dataset without samples"};
+        reader = std::thread(&BasicShardedIdxDataset::read, this);
+    }
+    BasicShardedIdxDataset(const BasicShardedIdxDataset&) = delete;
+    BasicShardedIdxDataset& operator=(const BasicShardedIdxDataset&) = delete;
+    ~BasicShardedIdxDataset() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        reader.join();
+    }
+
+    size_t counts() const noexcept {
+        return sampleCounts;
+    }
+    size_t getBatchCounts() const noexcept {
+        return dropLast? sampleCounts / batchSize: (sampleCounts + batchSize - 1) / batchSize;
+    }
+    // reshuffles the chunk order and starts streaming the epoch
+    void startEpoch() {
+        {
+            std::lock_guard lock(mutex);
+            ++generation;
+            ready.clear();
+            failure = nullptr;
+            chunkOrder.resize(chunks.size());
+            std::iota(chunkOrder.begin(), chunkOrder.end(), 0);
+            std::shuffle(chunkOrder.begin(), chunkOrder.end(), gen);
+            nextToLoad = 0;
+        }
+        changed.notify_all();
+        takenChunks = 0;
+        window.clear();
+        samples.clear();
+        cursor = 0;
+    }
+    // the next batch of the epoch, or false past its end; inputs and outputs stay valid until the next call
+    bool next(const Matrix *& batchInputs, const Matrix *& batchOutputs) {
+        const size_t outputCols = classCounts? classCounts: 1;
+        inputs.resize(batchSize, itemSize);
+        outputs.resize(batchSize, outputCols);
+        outputs.fill(0);
+        size_t rows = 0;
+        while (rows < batchSize) {
+            if (cursor == samples.size()) {
+                refill();
+                if (samples.empty())
+                    break;
+            }
+            const auto [c, i] = samples[cursor++];
+            const uint8_t *src = window[c].images.data() + i * itemSize;
+            T *dst = inputs.rowData(rows);
+            for (size_t j = 0; j < itemSize; ++j)
+                dst[j] = static_cast<T>(src[j] * scale);
+            const size_t label = window[c].labels[i];
+            if (!classCounts)
+                outputs(rows, 0) = static_cast<T>(label);
+            else if (label >= classCounts)
+                throw std::runtime_error{"label "s + std::to_string(label) + " is out of "s + std::to_string(classCounts) + " classes"s};
+            else
+                outputs(rows, label) = 1;
+            ++rows;
+        }
+        if (!rows || (dropLast && rows < batchSize))
+            return false;
+        if (rows < batchSize) {
+            inputs.resize(rows, itemSize);
+            outputs.resize(rows, outputCols);
+        }
+        batchInputs = &inputs;
+        batchOutputs = &outputs;
+        return true;
+    }
+};
+
+using ShardedIdxDataset = BasicShardedIdxDataset<double>;
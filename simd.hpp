@@ -0,0 +1,1229 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <valarray>
+#include <algorithm>
+#include <type_traits>
+#include <sys/types.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define SIMD_X86_
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    #include <arm_neon.h>
+    #define SIMD_NEON_
+#endif
+
+// Element-wise, BLAS-1 and GEMM kernels for the dense layers and activation functions.
+// kernels<T>() (T = double or float) picks the widest instruction set the CPU reports at first use (CPUID on x86);
+// scalarKernels<T>() is the libm/plain-loop reference the vector paths are compared against.
+// The float kernels run twice the lanes of the double ones and evaluate exp/tanh/sigmoid in double.
+//
+// exp approximation (avx2/avx512): x = n*ln2 + r with |r| <= ln2/2, e^r by a degree-12 Taylor polynomial, 2^n by
+// exponent-field construction. Relative error <= 4.5e-16 (~2 ulp) for x in [-708, 709]; x < -708 returns 0
+// (the reference returns subnormals below 1e-307), x > 709 returns +inf, NaN propagates.
+// tanh approximation: sgn(x) * (1 - 2 / (e^(2|x|) + 1)); absolute error <= 5e-16 over all finite x.
+namespace simd {
+
+// g = gScale * grad + l2 * w
+// m = a1 * m + b1 * g                   (m == nullptr: m = g)
+// v = a2 * v + b2 * g^2                 (v == nullptr: the denominator below is 1)
+// w -= learningRate * c1 * m / (sqrt(c2 * v) + eps) + learningRate * decay * w
+struct UpdateCoefficients {
+    double gScale{1};
+    double learningRate{0};
+    double a1{0}, b1{1};
+    double a2{0}, b2{1};
+    double c1{1}, c2{1};
+    double eps{0};
+    double l2{0};
+    double decay{0};
+};
+
+template <class T>
+struct BasicKernels {
+    const char *name;
+    T (*dot)(ssize_t n, const T *x, const T *y);
+    // y += alpha * x
+    void (*axpy)(ssize_t n, T alpha, const T *x, T *y);
+    void (*exp)(ssize_t n, const T *x, T *y);
+    void (*tanh)(ssize_t n, const T *x, T *y);
+    void (*sigmoid)(ssize_t n, const T *x, T *y);
+    // slope 0 gives relu
+    void (*leakyRelu)(ssize_t n, T slope, const T *x, T *y);
+    // out = (y > 0? 1: slope) * usGrad
+    void (*leakyReluDerivative)(ssize_t n, T slope, const T *y, const T *usGrad, T *out);
+    // one fused pass of an optimizer step over w and its moment buffers, see UpdateCoefficients
+    void (*optimizerUpdate)(ssize_t n, T *w, T *m, T *v, const T *grad, const UpdateCoefficients& c);
+    // C += A * B, row-major with leading dimensions
+    void (*gemm)(ssize_t m, ssize_t n, ssize_t k, const T *a, ssize_t lda, const T *b, ssize_t ldb, T *c, ssize_t ldc);
+};
+
+using Kernels = BasicKernels<double>;
+
+namespace gemm_blocking {
+    static constexpr ssize_t rowBlock = 64;
+    static constexpr ssize_t depthBlock = 256;
+    static constexpr ssize_t colBlock = 512;
+}
+
+// C += A * B with A: m x k, B: k x n, C: m x n, all row-major with leading dimensions lda/ldb/ldc.
+// Blocked so that a depthBlock x colBlock panel of B stays in L2 while rowBlock rows of A stream over it;
+// the micro-kernel updates four rows of C per pass over a row of B.
+template <class T>
+__attribute__((always_inline)) inline void blockedGemm(ssize_t m, ssize_t n, ssize_t k, const T *a, ssize_t lda, const T *b, ssize_t ldb, T *c, ssize_t ldc) {
+    using namespace gemm_blocking;
+    for (ssize_t j0 = 0; j0 < n; j0 += colBlock) {
+        const ssize_t j1 = std::min(n, j0 + colBlock);
+        for (ssize_t p0 = 0; p0 < k; p0 += depthBlock) {
+            const ssize_t p1 = std::min(k, p0 + depthBlock);
+            for (ssize_t i0 = 0; i0 < m; i0 += rowBlock) {
+                const ssize_t i1 = std::min(m, i0 + rowBlock);
+                ssize_t i = i0;
+                for (; i + 4 <= i1; i += 4) {
+                    T *__restrict__ c0 = c + i * ldc;
+                    T *__restrict__ c1 = c0 + ldc;
+                    T *__restrict__ c2 = c1 + ldc;
+                    T *__restrict__ c3 = c2 + ldc;
+                    for (ssize_t p = p0; p < p1; ++p) {
+                        const T a0 = a[i * lda + p];
+                        const T a1 = a[(i + 1) * lda + p];
+                        const T a2 = a[(i + 2) * lda + p];
+                        const T a3 = a[(i + 3) * lda + p];
+                        const T *__restrict__ bp = b + p * ldb;
+                        for (ssize_t j = j0; j < j1; ++j) {
+                            const T bv = bp[j];
+                            c0[j] += a0 * bv;
+                            c1[j] += a1 * bv;
+                            c2[j] += a2 * bv;
+                            c3[j] += a3 * bv;
+                        }
+                    }
+                }
+                for (; i < i1; ++i) {
+                    T *__restrict__ ci = c + i * ldc;
+                    for (ssize_t p = p0; p < p1; ++p) {
+                        const T ai = a[i * lda + p];
+                        const T *__restrict__ bp = b + p * ldb;
+                        for (ssize_t j = j0; j < j1; ++j) {
+                            ci[j] += ai * bp[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// 4 x width block of C += A * B over a depth of kc, A: 4 x kc, B: kc x width
+template <class T>
+using GemmTile = void (*)(ssize_t kc, const T *a, ssize_t lda, const T *b, ssize_t ldb, T *c, ssize_t ldc);
+
+// Blocked like blockedGemm, but every full 4 x width block of C goes through tile, which keeps it in registers for
+// the whole depth block instead of reloading C for each element of the depth; the edges fall back to blockedGemm.
+template <class T, ssize_t width, GemmTile<T> tile>
+__attribute__((always_inline)) inline void tiledGemm(ssize_t m, ssize_t n, ssize_t k, const T *a, ssize_t lda, const T *b, ssize_t ldb, T *c, ssize_t ldc) {
+    using namespace gemm_blocking;
+    for (ssize_t j0 = 0; j0 < n; j0 += colBlock) {
+        const ssize_t j1 = std::min(n, j0 + colBlock);
+        const ssize_t jw = j0 + (j1 - j0) / width * width;
+        for (ssize_t p0 = 0; p0 < k; p0 += depthBlock) {
+            const ssize_t p1 = std::min(k, p0 + depthBlock);
+            for (ssize_t i0 = 0; i0 < m; i0 += rowBlock) {
+                const ssize_t i1 = std::min(m, i0 + rowBlock);
+                const ssize_t i4 = i0 + (i1 - i0) / 4 * 4;
+                for (ssize_t i = i0; i < i4; i += 4)
+                    for (ssize_t j = j0; j < jw; j += width)
+                        tile(p1 - p0, a + i * lda + p0, lda, b + p0 * ldb + j, ldb, c + i * ldc + j, ldc);
+                if (jw < j1)
+                    blockedGemm(i4 - i0, j1 - jw, p1 - p0, a + i0 * lda + p0, lda, b + p0 * ldb + jw, ldb, c + i0 * ldc + jw, ldc);
+                if (i4 < i1)
+                    blockedGemm(i1 - i4, j1 - j0, p1 - p0, a + i4 * lda + p0, lda, b + p0 * ldb + j0, ldb, c + i4 * ldc + j0, ldc);
+            }
+        }
+    }
+}
+
+namespace scalar {
+    template <class T>
+    inline void gemm(ssize_t m, ssize_t n, ssize_t k, const T *a, ssize_t lda, const T *b, ssize_t ldb, T *c, ssize_t ldc) {
+        blockedGemm(m, n, k, a, lda, b, ldb, c, ldc);
+    }
+    template <class T>
+    inline T dot(ssize_t n, const T *x, const T *y) {
+        T sum = 0;
+        for (ssize_t i = 0; i < n; ++i)
+            sum += x[i] * y[i];
+        return sum;
+    }
+    template <class T>
+    inline void axpy(ssize_t n, T alpha, const T *x, T *y) {
+        for (ssize_t i = 0; i < n; ++i)
+            y[i] += alpha * x[i];
+    }
+    template <class T>
+    inline void exp(ssize_t n, const T *x, T *y) {
+        for (ssize_t i = 0; i < n; ++i)
+            y[i] = std::exp(x[i]);
+    }
+    template <class T>
+    inline void tanh(ssize_t n, const T *x, T *y) {
+        for (ssize_t i = 0; i < n; ++i)
+            y[i] = std::tanh(x[i]);
+    }
+    template <class T>
+    inline void sigmoid(ssize_t n, const T *x, T *y) {
+        for (ssize_t i = 0; i < n; ++i)
+            y[i] = 1 / (1 + std::exp(-x[i]));
+    }
+    template <class T>
+    inline void leakyRelu(ssize_t n, T slope, const T *x, T *y) {
+        for (ssize_t i = 0; i < n; ++i)
+            y[i] = (x[i] > 0)? x[i]: slope * x[i];
+    }
+    template <class T>
+    inline void leakyReluDerivative(ssize_t n, T slope, const T *y, const T *usGrad, T *out) {
+        for (ssize_t i = 0; i < n; ++i)
+            out[i] = ((y[i] > 0)? T(1): slope) * usGrad[i];
+    }
+    template <bool first, bool second, class T>
+    inline void optimizerUpdate(ssize_t n, T *w, T *m, T *v, const T *grad, const UpdateCoefficients& c) {
+        for (ssize_t i = 0; i < n; ++i) {
+            const double g = c.gScale * grad[i] + c.l2 * w[i];
+            double step = g;
+            if constexpr (first)
+                step = m[i] = c.a1 * m[i] + c.b1 * g;
+            if constexpr (second) {
+                v[i] = c.a2 * v[i] + c.b2 * g * g;
+                step = c.c1 * step / (std::sqrt(c.c2 * v[i]) + c.eps);
+            }
+            w[i] -= c.learningRate * step + c.learningRate * c.decay * w[i];
+        }
+    }
+    template <class T>
+    inline void optimizerUpdate(ssize_t n, T *w, T *m, T *v, const T *grad, const UpdateCoefficients& c) {
+        if (m && v)
+            optimizerUpdate<true, true>(n, w, m, v, grad, c);
+        else if (m)
+            optimizerUpdate<true, false>(n, w, m, v, grad, c);
+        else if (v)
+            optimizerUpdate<false, true>(n, w, m, v, grad, c);
+        else
+            optimizerUpdate<false, false>(n, w, m, v, grad, c);
+    }
+}
+
+template <class T = double>
+inline const BasicKernels<T>& scalarKernels() {
+    static const BasicKernels<T> k{"scalar", scalar::dot<T>, scalar::axpy<T>, scalar::exp<T>, scalar::tanh<T>, scalar::sigmoid<T>, scalar::leakyRelu<T>, scalar::leakyReluDerivative<T>, scalar::optimizerUpdate<T>, scalar::gemm<T>};
+    return k;
+}
+
+namespace exp_constants {
+    static constexpr double log2e = 1.4426950408889634074;
+    static constexpr double ln2Hi = 6.93147180369123816490e-01;
+    static constexpr double ln2Lo = 1.90821492927058770002e-10;
+    static constexpr double roundMagic = 6755399441055744.0;     // 1.5 * 2^52
+    static constexpr double upper = 709.;
+    static constexpr double lower = -708.;
+    // 1 / k! for k = 12 .. 2
+    static constexpr double taylor[] = {
+        2.08767569878680989792e-09, 2.50521083854417187751e-08, 2.75573192239858906526e-07,
+        2.75573192239858906526e-06, 2.48015873015873015873e-05, 1.98412698412698412698e-04,
+        1.38888888888888888889e-03, 8.33333333333333333333e-03, 4.16666666666666666667e-02,
+        1.66666666666666666667e-01, 5.00000000000000000000e-01,
+    };
+}
+
+#ifdef SIMD_X86_
+namespace avx2 {
+    // 4 x 8 tile: 8 accumulators, 2 loads of B and 4 broadcasts of A per step
+    __attribute__((target("avx2,fma"))) inline void gemmTile(ssize_t kc, const double *a, ssize_t lda, const double *b, ssize_t ldb, double *c, ssize_t ldc) {
+        __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd(), c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+        __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd(), c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+        for (ssize_t p = 0; p < kc; ++p) {
+            const __m256d b0 = _mm256_loadu_pd(b + p * ldb);
+            const __m256d b1 = _mm256_loadu_pd(b + p * ldb + 4);
+            __m256d x = _mm256_broadcast_sd(a + p);
+            c00 = _mm256_fmadd_pd(x, b0, c00);
+            c01 = _mm256_fmadd_pd(x, b1, c01);
+            x = _mm256_broadcast_sd(a + lda + p);
+            c10 = _mm256_fmadd_pd(x, b0, c10);
+            c11 = _mm256_fmadd_pd(x, b1, c11);
+            x = _mm256_broadcast_sd(a + 2 * lda + p);
+            c20 = _mm256_fmadd_pd(x, b0, c20);
+            c21 = _mm256_fmadd_pd(x, b1, c21);
+            x = _mm256_broadcast_sd(a + 3 * lda + p);
+            c30 = _mm256_fmadd_pd(x, b0, c30);
+            c31 = _mm256_fmadd_pd(x, b1, c31);
+        }
+        _mm256_storeu_pd(c, _mm256_add_pd(_mm256_loadu_pd(c), c00));
+        _mm256_storeu_pd(c + 4, _mm256_add_pd(_mm256_loadu_pd(c + 4), c01));
+        _mm256_storeu_pd(c + ldc, _mm256_add_pd(_mm256_loadu_pd(c + ldc), c10));
+        _mm256_storeu_pd(c + ldc + 4, _mm256_add_pd(_mm256_loadu_pd(c + ldc + 4), c11));
+        _mm256_storeu_pd(c + 2 * ldc, _mm256_add_pd(_mm256_loadu_pd(c + 2 * ldc), c20));
+        _mm256_storeu_pd(c + 2 * ldc + 4, _mm256_add_pd(_mm256_loadu_pd(c + 2 * ldc + 4), c21));
+        _mm256_storeu_pd(c + 3 * ldc, _mm256_add_pd(_mm256_loadu_pd(c + 3 * ldc), c30));
+        _mm256_storeu_pd(c + 3 * ldc + 4, _mm256_add_pd(_mm256_loadu_pd(c + 3 * ldc + 4), c31));
+    }
+    __attribute__((target("avx2,fma"))) inline void gemm(ssize_t m, ssize_t n, ssize_t k, const double *a, ssize_t lda, const double *b, ssize_t ldb, double *c, ssize_t ldc) {
+        tiledGemm<double, 8, gemmTile>(m, n, k, a, lda, b, ldb, c, ldc);
+    }
+    __attribute__((target("avx2,fma"))) inline __m256d exp4(__m256d x) {
+        using namespace exp_constants;
+        const __m256d clamped = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(lower)), _mm256_set1_pd(upper));
+        const __m256d magic = _mm256_set1_pd(roundMagic);
+        const __m256d kd = _mm256_fmadd_pd(clamped, _mm256_set1_pd(log2e), magic);
+        const __m256d k = _mm256_sub_pd(kd, magic);
+        __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(ln2Hi), clamped);
+        r = _mm256_fnmadd_pd(k, _mm256_set1_pd(ln2Lo), r);
+        __m256d p = _mm256_set1_pd(taylor[0]);
+        for (size_t i = 1; i < std::size(taylor); ++i)
+            p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(taylor[i]));
+        p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.));
+        p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.));
+        const __m256i exponent = _mm256_slli_epi64(_mm256_add_epi64(_mm256_castpd_si256(kd), _mm256_set1_epi64x(1023)), 52);
+        __m256d result = _mm256_mul_pd(p, _mm256_castsi256_pd(exponent));
+        result = _mm256_blendv_pd(result, _mm256_setzero_pd(), _mm256_cmp_pd(x, _mm256_set1_pd(lower), _CMP_LT_OQ));
+        result = _mm256_blendv_pd(result, _mm256_set1_pd(HUGE_VAL), _mm256_cmp_pd(x, _mm256_set1_pd(upper), _CMP_GT_OQ));
+        return _mm256_blendv_pd(result, x, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+    }
+    __attribute__((target("avx2,fma"))) inline __m256d tanh4(__m256d x) {
+        const __m256d signMask = _mm256_set1_pd(-0.);
+        const __m256d absX = _mm256_andnot_pd(signMask, x);
+        const __m256d e = exp4(_mm256_min_pd(_mm256_add_pd(absX, absX), _mm256_set1_pd(40.)));
+        const __m256d t = _mm256_sub_pd(_mm256_set1_pd(1.), _mm256_div_pd(_mm256_set1_pd(2.), _mm256_add_pd(e, _mm256_set1_pd(1.))));
+        // min_pd returned 40 for NaN; pass NaN through as std::tanh does
+        return _mm256_blendv_pd(_mm256_or_pd(t, _mm256_and_pd(signMask, x)), x, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+    }
+    __attribute__((target("avx2,fma"))) inline double dot(ssize_t n, const double *x, const double *y) {
+        __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), acc0);
+            acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), acc1);
+        }
+        for (; i + 4 <= n; i += 4)
+            acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), acc0);
+        alignas(32) double lanes[4];
+        _mm256_store_pd(lanes, _mm256_add_pd(acc0, acc1));
+        double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (; i < n; ++i)
+            sum += x[i] * y[i];
+        return sum;
+    }
+    __attribute__((target("avx2,fma"))) inline void axpy(ssize_t n, double alpha, const double *x, double *y) {
+        const __m256d a = _mm256_set1_pd(alpha);
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(y + i, _mm256_fmadd_pd(a, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+        for (; i < n; ++i)
+            y[i] += alpha * x[i];
+    }
+    __attribute__((target("avx2,fma"))) inline void exp(ssize_t n, const double *x, double *y) {
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(y + i, exp4(_mm256_loadu_pd(x + i)));
+        if (i < n) {
+            alignas(32) double tail[4]{};
+            std::memcpy(tail, x + i, (n - i) * sizeof(double));
+            _mm256_store_pd(tail, exp4(_mm256_load_pd(tail)));
+            std::memcpy(y + i, tail, (n - i) * sizeof(double));
+        }
+    }
+    __attribute__((target("avx2,fma"))) inline void tanh(ssize_t n, const double *x, double *y) {
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(y + i, tanh4(_mm256_loadu_pd(x + i)));
+        if (i < n) {
+            alignas(32) double tail[4]{};
+            std::memcpy(tail, x + i, (n - i) * sizeof(double));
+            _mm256_store_pd(tail, tanh4(_mm256_load_pd(tail)));
+            std::memcpy(y + i, tail, (n - i) * sizeof(double));
+        }
+    }
+    __attribute__((target("avx2,fma"))) inline void sigmoid(ssize_t n, const double *x, double *y) {
+        const __m256d one = _mm256_set1_pd(1.);
+        const __m256d signMask = _mm256_set1_pd(-0.);
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(y + i, _mm256_div_pd(one, _mm256_add_pd(one, exp4(_mm256_xor_pd(signMask, _mm256_loadu_pd(x + i))))));
+        for (; i < n; ++i)
+            y[i] = 1 / (1 + std::exp(-x[i]));
+    }
+    __attribute__((target("avx2,fma"))) inline void leakyRelu(ssize_t n, double slope, const double *x, double *y) {
+        const __m256d s = _mm256_set1_pd(slope);
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m256d v = _mm256_loadu_pd(x + i);
+            _mm256_storeu_pd(y + i, _mm256_blendv_pd(_mm256_mul_pd(s, v), v, _mm256_cmp_pd(v, _mm256_setzero_pd(), _CMP_GT_OQ)));
+        }
+        for (; i < n; ++i)
+            y[i] = (x[i] > 0)? x[i]: slope * x[i];
+    }
+    __attribute__((target("avx2,fma"))) inline void leakyReluDerivative(ssize_t n, double slope, const double *y, const double *usGrad, double *out) {
+        const __m256d s = _mm256_set1_pd(slope);
+        const __m256d one = _mm256_set1_pd(1.);
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m256d factor = _mm256_blendv_pd(s, one, _mm256_cmp_pd(_mm256_loadu_pd(y + i), _mm256_setzero_pd(), _CMP_GT_OQ));
+            _mm256_storeu_pd(out + i, _mm256_mul_pd(factor, _mm256_loadu_pd(usGrad + i)));
+        }
+        for (; i < n; ++i)
+            out[i] = ((y[i] > 0)? 1.: slope) * usGrad[i];
+    }
+    template <bool first, bool second>
+    __attribute__((target("avx2,fma"))) inline void optimizerUpdate(ssize_t n, double *w, double *m, double *v, const double *grad, const UpdateCoefficients& c) {
+        const __m256d gScale = _mm256_set1_pd(c.gScale);
+        const __m256d l2 = _mm256_set1_pd(c.l2);
+        const __m256d a1 = _mm256_set1_pd(c.a1), b1 = _mm256_set1_pd(c.b1);
+        const __m256d a2 = _mm256_set1_pd(c.a2), b2 = _mm256_set1_pd(c.b2);
+        const __m256d c1 = _mm256_set1_pd(c.c1), c2 = _mm256_set1_pd(c.c2);
+        const __m256d eps = _mm256_set1_pd(c.eps);
+        const __m256d lr = _mm256_set1_pd(c.learningRate);
+        const __m256d lrDecay = _mm256_set1_pd(c.learningRate * c.decay);
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m256d wi = _mm256_loadu_pd(w + i);
+            const __m256d g = _mm256_fmadd_pd(gScale, _mm256_loadu_pd(grad + i), _mm256_mul_pd(l2, wi));
+            __m256d step = g;
+            if constexpr (first) {
+                step = _mm256_fmadd_pd(a1, _mm256_loadu_pd(m + i), _mm256_mul_pd(b1, g));
+                _mm256_storeu_pd(m + i, step);
+            }
+            if constexpr (second) {
+                const __m256d vi = _mm256_fmadd_pd(a2, _mm256_loadu_pd(v + i), _mm256_mul_pd(b2, _mm256_mul_pd(g, g)));
+                _mm256_storeu_pd(v + i, vi);
+                step = _mm256_div_pd(_mm256_mul_pd(c1, step), _mm256_add_pd(_mm256_sqrt_pd(_mm256_mul_pd(c2, vi)), eps));
+            }
+            _mm256_storeu_pd(w + i, _mm256_sub_pd(wi, _mm256_fmadd_pd(lr, step, _mm256_mul_pd(lrDecay, wi))));
+        }
+        scalar::optimizerUpdate<first, second>(n - i, w + i, m? m + i: m, v? v + i: v, grad + i, c);
+    }
+    __attribute__((target("avx2,fma"))) inline void optimizerUpdate(ssize_t n, double *w, double *m, double *v, const double *grad, const UpdateCoefficients& c) {
+        if (m && v)
+            optimizerUpdate<true, true>(n, w, m, v, grad, c);
+        else if (m)
+            optimizerUpdate<true, false>(n, w, m, v, grad, c);
+        else if (v)
+            optimizerUpdate<false, true>(n, w, m, v, grad, c);
+        else
+            optimizerUpdate<false, false>(n, w, m, v, grad, c);
+    }
+
+    // float: 8 lanes per register, exp/tanh/sigmoid evaluated in double on 4 lanes at a time
+    __attribute__((target("avx2,fma"))) inline void gemmTile(ssize_t kc, const float *a, ssize_t lda, const float *b, ssize_t ldb, float *c, ssize_t ldc) {
+        __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps(), c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+        __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps(), c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+        for (ssize_t p = 0; p < kc; ++p) {
+            const __m256 b0 = _mm256_loadu_ps(b + p * ldb);
+            const __m256 b1 = _mm256_loadu_ps(b + p * ldb + 8);
+            __m256 x = _mm256_broadcast_ss(a + p);
+            c00 = _mm256_fmadd_ps(x, b0, c00);
+            c01 = _mm256_fmadd_ps(x, b1, c01);
+            x = _mm256_broadcast_ss(a + lda + p);
+            c10 = _mm256_fmadd_ps(x, b0, c10);
+            c11 = _mm256_fmadd_ps(x, b1, c11);
+            x = _mm256_broadcast_ss(a + 2 * lda + p);
+            c20 = _mm256_fmadd_ps(x, b0, c20);
+            c21 = _mm256_fmadd_ps(x, b1, c21);
+            x = _mm256_broadcast_ss(a + 3 * lda + p);
+            c30 = _mm256_fmadd_ps(x, b0, c30);
+            c31 = _mm256_fmadd_ps(x, b1, c31);
+        }
+        _mm256_storeu_ps(c, _mm256_add_ps(_mm256_loadu_ps(c), c00));
+        _mm256_storeu_ps(c + 8, _mm256_add_ps(_mm256_loadu_ps(c + 8), c01));
+        _mm256_storeu_ps(c + ldc, _mm256_add_ps(_mm256_loadu_ps(c + ldc), c10));
+        _mm256_storeu_ps(c + ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + ldc + 8), c11));
+        _mm256_storeu_ps(c + 2 * ldc, _mm256_add_ps(_mm256_loadu_ps(c + 2 * ldc), c20));
+        _mm256_storeu_ps(c + 2 * ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + 2 * ldc + 8), c21));
+        _mm256_storeu_ps(c + 3 * ldc, _mm256_add_ps(_mm256_loadu_ps(c + 3 * ldc), c30));
+        _mm256_storeu_ps(c + 3 * ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + 3 * ldc + 8), c31));
+    }
+    __attribute__((target("avx2,fma"))) inline void gemm(ssize_t m, ssize_t n, ssize_t k, const float *a, ssize_t lda, const float *b, ssize_t ldb, float *c, ssize_t ldc) {
+        tiledGemm<float, 16, gemmTile>(m, n, k, a, lda, b, ldb, c, ldc);
+    }
+    __attribute__((target("avx2,fma"))) inline float dot(ssize_t n, const float *x, const float *y) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        ssize_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+        }
+        for (; i + 8 <= n; i += 8)
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+        alignas(32) float lanes[8];
+        _mm256_store_ps(lanes, _mm256_add_ps(acc0, acc1));
+        float sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+        for (; i < n; ++i)
+            sum += x[i] * y[i];
+        return sum;
+    }
+    __attribute__((target("avx2,fma"))) inline void axpy(ssize_t n, float alpha, const float *x, float *y) {
+        const __m256 a = _mm256_set1_ps(alpha);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(y + i, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+        for (; i < n; ++i)
+            y[i] += alpha * x[i];
+    }
+    // y = f(x) on 4 floats widened to double
+    template <__m256d (*f)(__m256d)>
+    __attribute__((target("avx2,fma"))) inline void widened(ssize_t n, const float *x, float *y) {
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_ps(y + i, _mm256_cvtpd_ps(f(_mm256_cvtps_pd(_mm_loadu_ps(x + i)))));
+        if (i < n) {
+            alignas(16) float tail[4]{};
+            std::memcpy(tail, x + i, (n - i) * sizeof(float));
+            _mm_store_ps(tail, _mm256_cvtpd_ps(f(_mm256_cvtps_pd(_mm_load_ps(tail)))));
+            std::memcpy(y + i, tail, (n - i) * sizeof(float));
+        }
+    }
+    __attribute__((target("avx2,fma"))) inline __m256d sigmoid4(__m256d x) {
+        const __m256d one = _mm256_set1_pd(1.);
+        return _mm256_div_pd(one, _mm256_add_pd(one, exp4(_mm256_xor_pd(_mm256_set1_pd(-0.), x))));
+    }
+    __attribute__((target("avx2,fma"))) inline void exp(ssize_t n, const float *x, float *y) {
+        widened<exp4>(n, x, y);
+    }
+    __attribute__((target("avx2,fma"))) inline void tanh(ssize_t n, const float *x, float *y) {
+        widened<tanh4>(n, x, y);
+    }
+    __attribute__((target("avx2,fma"))) inline void sigmoid(ssize_t n, const float *x, float *y) {
+        widened<sigmoid4>(n, x, y);
+    }
+    __attribute__((target("avx2,fma"))) inline void leakyRelu(ssize_t n, float slope, const float *x, float *y) {
+        const __m256 s = _mm256_set1_ps(slope);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256 v = _mm256_loadu_ps(x + i);
+            _mm256_storeu_ps(y + i, _mm256_blendv_ps(_mm256_mul_ps(s, v), v, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GT_OQ)));
+        }
+        for (; i < n; ++i)
+            y[i] = (x[i] > 0)? x[i]: slope * x[i];
+    }
+    __attribute__((target("avx2,fma"))) inline void leakyReluDerivative(ssize_t n, float slope, const float *y, const float *usGrad, float *out) {
+        const __m256 s = _mm256_set1_ps(slope);
+        const __m256 one = _mm256_set1_ps(1.f);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256 factor = _mm256_blendv_ps(s, one, _mm256_cmp_ps(_mm256_loadu_ps(y + i), _mm256_setzero_ps(), _CMP_GT_OQ));
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(factor, _mm256_loadu_ps(usGrad + i)));
+        }
+        for (; i < n; ++i)
+            out[i] = ((y[i] > 0)? 1.f: slope) * usGrad[i];
+    }
+    template <bool first, bool second>
+    __attribute__((target("avx2,fma"))) inline void optimizerUpdate(ssize_t n, float *w, float *m, float *v, const float *grad, const UpdateCoefficients& c) {
+        const __m256 gScale = _mm256_set1_ps(c.gScale);
+        const __m256 l2 = _mm256_set1_ps(c.l2);
+        const __m256 a1 = _mm256_set1_ps(c.a1), b1 = _mm256_set1_ps(c.b1);
+        const __m256 a2 = _mm256_set1_ps(c.a2), b2 = _mm256_set1_ps(c.b2);
+        const __m256 c1 = _mm256_set1_ps(c.c1), c2 = _mm256_set1_ps(c.c2);
+        const __m256 eps = _mm256_set1_ps(c.eps);
+        const __m256 lr = _mm256_set1_ps(c.learningRate);
+        const __m256 lrDecay = _mm256_set1_ps(c.learningRate * c.decay);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256 wi = _mm256_loadu_ps(w + i);
+            const __m256 g = _mm256_fmadd_ps(gScale, _mm256_loadu_ps(grad + i), _mm256_mul_ps(l2, wi));
+            __m256 step = g;
+            if constexpr (first) {
+                step = _mm256_fmadd_ps(a1, _mm256_loadu_ps(m + i), _mm256_mul_ps(b1, g));
+                _mm256_storeu_ps(m + i, step);
+            }
+            if constexpr (second) {
+                const __m256 vi = _mm256_fmadd_ps(a2, _mm256_loadu_ps(v + i), _mm256_mul_ps(b2, _mm256_mul_ps(g, g)));
+                _mm256_storeu_ps(v + i, vi);
+                step = _mm256_div_ps(_mm256_mul_ps(c1, step), _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(c2, vi)), eps));
+            }
+            _mm256_storeu_ps(w + i, _mm256_sub_ps(wi, _mm256_fmadd_ps(lr, step, _mm256_mul_ps(lrDecay, wi))));
+        }
+        scalar::optimizerUpdate<first, second>(n - i, w + i, m? m + i: m, v? v + i: v, grad + i, c);
+    }
+    __attribute__((target("avx2,fma"))) inline void optimizerUpdate(ssize_t n, float *w, float *m, float *v, const float *grad, const UpdateCoefficients& c) {
+        if (m && v)
+            optimizerUpdate<true, true>(n, w, m, v, grad, c);
+        else if (m)
+            optimizerUpdate<true, false>(n, w, m, v, grad, c);
+        else if (v)
+            optimizerUpdate<false, true>(n, w, m, v, grad, c);
+        else
+            optimizerUpdate<false, false>(n, w, m, v, grad, c);
+    }
+}
+
+namespace avx512 {
+    // 4 x 16 tile: 8 accumulators, 2 loads of B and 4 broadcasts of A per step
+    __attribute__((target("avx512f"))) inline void gemmTile(ssize_t kc, const double *a, ssize_t lda, const double *b, ssize_t ldb, double *c, ssize_t ldc) {
+        __m512d c00 = _mm512_setzero_pd(), c01 = _mm512_setzero_pd(), c10 = _mm512_setzero_pd(), c11 = _mm512_setzero_pd();
+        __m512d c20 = _mm512_setzero_pd(), c21 = _mm512_setzero_pd(), c30 = _mm512_setzero_pd(), c31 = _mm512_setzero_pd();
+        for (ssize_t p = 0; p < kc; ++p) {
+            const __m512d b0 = _mm512_loadu_pd(b + p * ldb);
+            const __m512d b1 = _mm512_loadu_pd(b + p * ldb + 8);
+            __m512d x = _mm512_set1_pd(a[p]);
+            c00 = _mm512_fmadd_pd(x, b0, c00);
+            c01 = _mm512_fmadd_pd(x, b1, c01);
+            x = _mm512_set1_pd(a[lda + p]);
+            c10 = _mm512_fmadd_pd(x, b0, c10);
+            c11 = _mm512_fmadd_pd(x, b1, c11);
+            x = _mm512_set1_pd(a[2 * lda + p]);
+            c20 = _mm512_fmadd_pd(x, b0, c20);
+            c21 = _mm512_fmadd_pd(x, b1, c21);
+            x = _mm512_set1_pd(a[3 * lda + p]);
+            c30 = _mm512_fmadd_pd(x, b0, c30);
+            c31 = _mm512_fmadd_pd(x, b1, c31);
+        }
+        _mm512_storeu_pd(c, _mm512_add_pd(_mm512_loadu_pd(c), c00));
+        _mm512_storeu_pd(c + 8, _mm512_add_pd(_mm512_loadu_pd(c + 8), c01));
+        _mm512_storeu_pd(c + ldc, _mm512_add_pd(_mm512_loadu_pd(c + ldc), c10));
+        _mm512_storeu_pd(c + ldc + 8, _mm512_add_pd(_mm512_loadu_pd(c + ldc + 8), c11));
+        _mm512_storeu_pd(c + 2 * ldc, _mm512_add_pd(_mm512_loadu_pd(c + 2 * ldc), c20));
+        _mm512_storeu_pd(c + 2 * ldc + 8, _mm512_add_pd(_mm512_loadu_pd(c + 2 * ldc + 8), c21));
+        _mm512_storeu_pd(c + 3 * ldc, _mm512_add_pd(_mm512_loadu_pd(c + 3 * ldc), c30));
+        _mm512_storeu_pd(c + 3 * ldc + 8, _mm512_add_pd(_mm512_loadu_pd(c + 3 * ldc + 8), c31));
+    }
+    __attribute__((target("avx512f"))) inline void gemm(ssize_t m, ssize_t n, ssize_t k, const double *a, ssize_t lda, const double *b, ssize_t ldb, double *c, ssize_t ldc) {
+        tiledGemm<double, 16, gemmTile>(m, n, k, a, lda, b, ldb, c, ldc);
+    }
+    __attribute__((target("avx512f"))) inline __mmask8 tailMask(ssize_t remaining) {
+        return static_cast<__mmask8>((1u << remaining) - 1);
+    }
+    __attribute__((target("avx512f"))) inline __m512d exp8(__m512d x) {
+        using namespace exp_constants;
+        const __m512d clamped = _mm512_min_pd(_mm512_max_pd(x, _mm512_set1_pd(lower)), _mm512_set1_pd(upper));
+        const __m512d magic = _mm512_set1_pd(roundMagic);
+        const __m512d kd = _mm512_fmadd_pd(clamped, _mm512_set1_pd(log2e), magic);
+        const __m512d k = _mm512_sub_pd(kd, magic);
+        __m512d r = _mm512_fnmadd_pd(k, _mm512_set1_pd(ln2Hi), clamped);
+        r = _mm512_fnmadd_pd(k, _mm512_set1_pd(ln2Lo), r);
+        __m512d p = _mm512_set1_pd(taylor[0]);
+        for (size_t i = 1; i < std::size(taylor); ++i)
+            p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(taylor[i]));
+        p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.));
+        p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.));
+        const __m512i exponent = _mm512_slli_epi64(_mm512_add_epi64(_mm512_castpd_si512(kd), _mm512_set1_epi64(1023)), 52);
+        __m512d result = _mm512_mul_pd(p, _mm512_castsi512_pd(exponent));
+        result = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_set1_pd(lower), _CMP_LT_OQ), result, _mm512_setzero_pd());
+        result = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_set1_pd(upper), _CMP_GT_OQ), result, _mm512_set1_pd(HUGE_VAL));
+        return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, x, _CMP_UNORD_Q), result, x);
+    }
+    __attribute__((target("avx512f"))) inline __m512d tanh8(__m512d x) {
+        const __m512i signMask = _mm512_set1_epi64(INT64_MIN);
+        const __m512i bits = _mm512_castpd_si512(x);
+        const __m512d absX = _mm512_castsi512_pd(_mm512_andnot_si512(signMask, bits));
+        const __m512d e = exp8(_mm512_min_pd(_mm512_add_pd(absX, absX), _mm512_set1_pd(40.)));
+        const __m512d t = _mm512_sub_pd(_mm512_set1_pd(1.), _mm512_div_pd(_mm512_set1_pd(2.), _mm512_add_pd(e, _mm512_set1_pd(1.))));
+        const __m512d result = _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(t), _mm512_and_si512(signMask, bits)));
+        // min_pd returned 40 for NaN; pass NaN through as std::tanh does
+        return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, x, _CMP_UNORD_Q), result, x);
+    }
+    __attribute__((target("avx512f"))) inline double dot(ssize_t n, const double *x, const double *y) {
+        __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+        ssize_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i), acc0);
+            acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i + 8), _mm512_loadu_pd(y + i + 8), acc1);
+        }
+        if (i < n) {
+            const __mmask8 mask0 = (n - i >= 8)? 0xFF: tailMask(n - i);
+            acc0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask0, x + i), _mm512_maskz_loadu_pd(mask0, y + i), acc0);
+            if (n - i > 8) {
+                const __mmask8 mask1 = tailMask(n - i - 8);
+                acc1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask1, x + i + 8), _mm512_maskz_loadu_pd(mask1, y + i + 8), acc1);
+            }
+        }
+        return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+    }
+    __attribute__((target("avx512f"))) inline void axpy(ssize_t n, double alpha, const double *x, double *y) {
+        const __m512d a = _mm512_set1_pd(alpha);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm512_storeu_pd(y + i, _mm512_fmadd_pd(a, _mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i)));
+        if (i < n) {
+            const __mmask8 mask = tailMask(n - i);
+            _mm512_mask_storeu_pd(y + i, mask, _mm512_fmadd_pd(a, _mm512_maskz_loadu_pd(mask, x + i), _mm512_maskz_loadu_pd(mask, y + i)));
+        }
+    }
+    __attribute__((target("avx512f"))) inline void exp(ssize_t n, const double *x, double *y) {
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm512_storeu_pd(y + i, exp8(_mm512_loadu_pd(x + i)));
+        if (i < n)
+            _mm512_mask_storeu_pd(y + i, tailMask(n - i), exp8(_mm512_maskz_loadu_pd(tailMask(n - i), x + i)));
+    }
+    __attribute__((target("avx512f"))) inline void tanh(ssize_t n, const double *x, double *y) {
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm512_storeu_pd(y + i, tanh8(_mm512_loadu_pd(x + i)));
+        if (i < n)
+            _mm512_mask_storeu_pd(y + i, tailMask(n - i), tanh8(_mm512_maskz_loadu_pd(tailMask(n - i), x + i)));
+    }
+    __attribute__((target("avx512f"))) inline void sigmoid(ssize_t n, const double *x, double *y) {
+        const __m512d one = _mm512_set1_pd(1.);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm512_storeu_pd(y + i, _mm512_div_pd(one, _mm512_add_pd(one, exp8(_mm512_sub_pd(_mm512_setzero_pd(), _mm512_loadu_pd(x + i))))));
+        for (; i < n; ++i)
+            y[i] = 1 / (1 + std::exp(-x[i]));
+    }
+    __attribute__((target("avx512f"))) inline void leakyRelu(ssize_t n, double slope, const double *x, double *y) {
+        const __m512d s = _mm512_set1_pd(slope);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m512d v = _mm512_loadu_pd(x + i);
+            _mm512_storeu_pd(y + i, _mm512_mask_blend_pd(_mm512_cmp_pd_mask(v, _mm512_setzero_pd(), _CMP_GT_OQ), _mm512_mul_pd(s, v), v));
+        }
+        for (; i < n; ++i)
+            y[i] = (x[i] > 0)? x[i]: slope * x[i];
+    }
+    __attribute__((target("avx512f"))) inline void leakyReluDerivative(ssize_t n, double slope, const double *y, const double *usGrad, double *out) {
+        const __m512d s = _mm512_set1_pd(slope);
+        const __m512d one = _mm512_set1_pd(1.);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m512d factor = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(_mm512_loadu_pd(y + i), _mm512_setzero_pd(), _CMP_GT_OQ), s, one);
+            _mm512_storeu_pd(out + i, _mm512_mul_pd(factor, _mm512_loadu_pd(usGrad + i)));
+        }
+        for (; i < n; ++i)
+            out[i] = ((y[i] > 0)? 1.: slope) * usGrad[i];
+    }
+    template <bool first, bool second>
+    __attribute__((target("avx512f"))) inline void optimizerUpdate(ssize_t n, double *w, double *m, double *v, const double *grad, const UpdateCoefficients& c) {
+        const __m512d gScale = _mm512_set1_pd(c.gScale);
+        const __m512d l2 = _mm512_set1_pd(c.l2);
+        const __m512d a1 = _mm512_set1_pd(c.a1), b1 = _mm512_set1_pd(c.b1);
+        const __m512d a2 = _mm512_set1_pd(c.a2), b2 = _mm512_set1_pd(c.b2);
+        const __m512d c1 = _mm512_set1_pd(c.c1), c2 = _mm512_set1_pd(c.c2);
+        const __m512d eps = _mm512_set1_pd(c.eps);
+        const __m512d lr = _mm512_set1_pd(c.learningRate);
+        const __m512d lrDecay = _mm512_set1_pd(c.learningRate * c.decay);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m512d wi = _mm512_loadu_pd(w + i);
+            const __m512d g = _mm512_fmadd_pd(gScale, _mm512_loadu_pd(grad + i), _mm512_mul_pd(l2, wi));
+            __m512d step = g;
+            if constexpr (first) {
+                step = _mm512_fmadd_pd(a1, _mm512_loadu_pd(m + i), _mm512_mul_pd(b1, g));
+                _mm512_storeu_pd(m + i, step);
+            }
+            if constexpr (second) {
+                const __m512d vi = _mm512_fmadd_pd(a2, _mm512_loadu_pd(v + i), _mm512_mul_pd(b2, _mm512_mul_pd(g, g)));
+                _mm512_storeu_pd(v + i, vi);
+                step = _mm512_div_pd(_mm512_mul_pd(c1, step), _mm512_add_pd(_mm512_sqrt_pd(_mm512_mul_pd(c2, vi)), eps));
+            }
+            _mm512_storeu_pd(w + i, _mm512_sub_pd(wi, _mm512_fmadd_pd(lr, step, _mm512_mul_pd(lrDecay, wi))));
+        }
+        scalar::optimizerUpdate<first, second>(n - i, w + i, m? m + i: m, v? v + i: v, grad + i, c);
+    }
+    __attribute__((target("avx512f"))) inline void optimizerUpdate(ssize_t n, double *w, double *m, double *v, const double *grad, const UpdateCoefficients& c) {
+        if (m && v)
+            optimizerUpdate<true, true>(n, w, m, v, grad, c);
+        else if (m)
+            optimizerUpdate<true, false>(n, w, m, v, grad, c);
+        else if (v)
+            optimizerUpdate<false, true>(n, w, m, v, grad, c);
+        else
+            optimizerUpdate<false, false>(n, w, m, v, grad, c);
+    }
+
+    // float: 16 lanes per register, exp/tanh/sigmoid evaluated in double on 8 lanes at a time
+    __attribute__((target("avx512f"))) inline void gemmTile(ssize_t kc, const float *a, ssize_t lda, const float *b, ssize_t ldb, float *c, ssize_t ldc) {
+        __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps(), c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+        __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps(), c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+        for (ssize_t p = 0; p < kc; ++p) {
+            const __m512 b0 = _mm512_loadu_ps(b + p * ldb);
+            const __m512 b1 = _mm512_loadu_ps(b + p * ldb + 16);
+            __m512 x = _mm512_set1_ps(a[p]);
+            c00 = _mm512_fmadd_ps(x, b0, c00);
+            c01 = _mm512_fmadd_ps(x, b1, c01);
+            x = _mm512_set1_ps(a[lda + p]);
+            c10 = _mm512_fmadd_ps(x, b0, c10);
+            c11 = _mm512_fmadd_ps(x, b1, c11);
+            x = _mm512_set1_ps(a[2 * lda + p]);
+            c20 = _mm512_fmadd_ps(x, b0, c20);
+            c21 = _mm512_fmadd_ps(x, b1, c21);
+            x = _mm512_set1_ps(a[3 * lda + p]);
+            c30 = _mm512_fmadd_ps(x, b0, c30);
+            c31 = _mm512_fmadd_ps(x, b1, c31);
+        }
+        _mm512_storeu_ps(c, _mm512_add_ps(_mm512_loadu_ps(c), c00));
+        _mm512_storeu_ps(c + 16, _mm512_add_ps(_mm512_loadu_ps(c + 16), c01));
+        _mm512_storeu_ps(c + ldc, _mm512_add_ps(_mm512_loadu_ps(c + ldc), c10));
+        _mm512_storeu_ps(c + ldc + 16, _mm512_add_ps(_mm512_loadu_ps(c + ldc + 16), c11));
+        _mm512_storeu_ps(c + 2 * ldc, _mm512_add_ps(_mm512_loadu_ps(c + 2 * ldc), c20));
+        _mm512_storeu_ps(c + 2 * ldc + 16, _mm512_add_ps(_mm512_loadu_ps(c + 2 * ldc + 16), c21));
+        _mm512_storeu_ps(c + 3 * ldc, _mm512_add_ps(_mm512_loadu_ps(c + 3 * ldc), c30));
+        _mm512_storeu_ps(c + 3 * ldc + 16, _mm512_add_ps(_mm512_loadu_ps(c + 3 * ldc + 16), c31));
+    }
+    __attribute__((target("avx512f"))) inline void gemm(ssize_t m, ssize_t n, ssize_t k, const float *a, ssize_t lda, const float *b, ssize_t ldb, float *c, ssize_t ldc) {
+        tiledGemm<float, 32, gemmTile>(m, n, k, a, lda, b, ldb, c, ldc);
+    }
+    __attribute__((target("avx512f"))) inline __mmask16 tailMask16(ssize_t remaining) {
+        return static_cast<__mmask16>((1u << remaining) - 1);
+    }
+    __attribute__((target("avx512f"))) inline float dot(ssize_t n, const float *x, const float *y) {
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        ssize_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), acc1);
+        }
+        for (; i + 16 <= n; i += 16)
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+        if (i < n) {
+            const __mmask16 mask = tailMask16(n - i);
+            acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i), acc1);
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    }
+    __attribute__((target("avx512f"))) inline void axpy(ssize_t n, float alpha, const float *x, float *y) {
+        const __m512 a = _mm512_set1_ps(alpha);
+        ssize_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            _mm512_storeu_ps(y + i, _mm512_fmadd_ps(a, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+        if (i < n) {
+            const __mmask16 mask = tailMask16(n - i);
+            _mm512_mask_storeu_ps(y + i, mask, _mm512_fmadd_ps(a, _mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i)));
+        }
+    }
+    // y = f(x) on 8 floats widened to double
+    template <__m512d (*f)(__m512d)>
+    __attribute__((target("avx512f"))) inline void widened(ssize_t n, const float *x, float *y) {
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(y + i, _mm512_cvtpd_ps(f(_mm512_cvtps_pd(_mm256_loadu_ps(x + i)))));
+        if (i < n) {
+            alignas(32) float tail[8]{};
+            std::memcpy(tail, x + i, (n - i) * sizeof(float));
+            _mm256_store_ps(tail, _mm512_cvtpd_ps(f(_mm512_cvtps_pd(_mm256_load_ps(tail)))));
+            std::memcpy(y + i, tail, (n - i) * sizeof(float));
+        }
+    }
+    __attribute__((target("avx512f"))) inline __m512d sigmoid8(__m512d x) {
+        const __m512d one = _mm512_set1_pd(1.);
+        return _mm512_div_pd(one, _mm512_add_pd(one, exp8(_mm512_sub_pd(_mm512_setzero_pd(), x))));
+    }
+    __attribute__((target("avx512f"))) inline void exp(ssize_t n, const float *x, float *y) {
+        widened<exp8>(n, x, y);
+    }
+    __attribute__((target("avx512f"))) inline void tanh(ssize_t n, const float *x, float *y) {
+        widened<tanh8>(n, x, y);
+    }
+    __attribute__((target("avx512f"))) inline void sigmoid(ssize_t n, const float *x, float *y) {
+        widened<sigmoid8>(n, x, y);
+    }
+    __attribute__((target("avx512f"))) inline void leakyRelu(ssize_t n, float slope, const float *x, float *y) {
+        const __m512 s = _mm512_set1_ps(slope);
+        ssize_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const __m512 v = _mm512_loadu_ps(x + i);
+            _mm512_storeu_ps(y + i, _mm512_mask_blend_ps(_mm512_cmp_ps_mask(v, _mm512_setzero_ps(), _CMP_GT_OQ), _mm512_mul_ps(s, v), v));
+        }
+        for (; i < n; ++i)
+            y[i] = (x[i] > 0)? x[i]: slope * x[i];
+    }
+    __attribute__((target("avx512f"))) inline void leakyReluDerivative(ssize_t n, float slope, const float *y, const float *usGrad, float *out) {
+        const __m512 s = _mm512_set1_ps(slope);
+        const __m512 one = _mm512_set1_ps(1.f);
+        ssize_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const __m512 factor = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(_mm512_loadu_ps(y + i), _mm512_setzero_ps(), _CMP_GT_OQ), s, one);
+            _mm512_storeu_ps(out + i, _mm512_mul_ps(factor, _mm512_loadu_ps(usGrad + i)));
+        }
+        for (; i < n; ++i)
+            out[i] = ((y[i] > 0)? 1.f: slope) * usGrad[i];
+    }
+    template <bool first, bool second>
+    __attribute__((target("avx512f"))) inline void optimizerUpdate(ssize_t n, float *w, float *m, float *v, const float *grad, const UpdateCoefficients& c) {
+        const __m512 gScale = _mm512_set1_ps(c.gScale);
+        const __m512 l2 = _mm512_set1_ps(c.l2);
+        const __m512 a1 = _mm512_set1_ps(c.a1), b1 = _mm512_set1_ps(c.b1);
+        const __m512 a2 = _mm512_set1_ps(c.a2), b2 = _mm512_set1_ps(c.b2);
+        const __m512 c1 = _mm512_set1_ps(c.c1), c2 = _mm512_set1_ps(c.c2);
+        const __m512 eps = _mm512_set1_ps(c.eps);
+        const __m512 lr = _mm512_set1_ps(c.learningRate);
+        const __m512 lrDecay = _mm512_set1_ps(c.learningRate * c.decay);
+        ssize_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const __m512 wi = _mm512_loadu_ps(w + i);
+            const __m512 g = _mm512_fmadd_ps(gScale, _mm512_loadu_ps(grad + i), _mm512_mul_ps(l2, wi));
+            __m512 step = g;
+            if constexpr (first) {
+                step = _mm512_fmadd_ps(a1, _mm512_loadu_ps(m + i), _mm512_mul_ps(b1, g));
+                _mm512_storeu_ps(m + i, step);
+            }
+            if constexpr (second) {
+                const __m512 vi = _mm512_fmadd_ps(a2, _mm512_loadu_ps(v + i), _mm512_mul_ps(b2, _mm512_mul_ps(g, g)));
+                _mm512_storeu_ps(v + i, vi);
+                step = _mm512_div_ps(_mm512_mul_ps(c1, step), _mm512_add_ps(_mm512_sqrt_ps(_mm512_mul_ps(c2, vi)), eps));
+            }
+            _mm512_storeu_ps(w + i, _mm512_sub_ps(wi, _mm512_fmadd_ps(lr, step, _mm512_mul_ps(lrDecay, wi))));
+        }
+        scalar::optimizerUpdate<first, second>(n - i, w + i, m? m + i: m, v? v + i: v, grad + i, c);
+    }
+    __attribute__((target("avx512f"))) inline void optimizerUpdate(ssize_t n, float *w, float *m, float *v, const float *grad, const UpdateCoefficients& c) {
+        if (m && v)
+            optimizerUpdate<true, true>(n, w, m, v, grad, c);
+        else if (m)
+            optimizerUpdate<true, false>(n, w, m, v, grad, c);
+        else if (v)
+            optimizerUpdate<false, true>(n, w, m, v, grad, c);
+        else
+            optimizerUpdate<false, false>(n, w, m, v, grad, c);
+    }
+}
+#endif
+
+#ifdef SIMD_NEON_
+// exp/tanh stay on libm here; the loops below are the bandwidth-bound ones
+namespace neon {
+    inline double dot(ssize_t n, const double *x, const double *y) {
+        float64x2_t acc0 = vdupq_n_f64(0), acc1 = vdupq_n_f64(0);
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc0 = vfmaq_f64(acc0, vld1q_f64(x + i), vld1q_f64(y + i));
+            acc1 = vfmaq_f64(acc1, vld1q_f64(x + i + 2), vld1q_f64(y + i + 2));
+        }
+        double sum = vaddvq_f64(vaddq_f64(acc0, acc1));
+        for (; i < n; ++i)
+            sum += x[i] * y[i];
+        return sum;
+    }
+    inline void axpy(ssize_t n, double alpha, const double *x, double *y) {
+        const float64x2_t a = vdupq_n_f64(alpha);
+        ssize_t i = 0;
+        for (; i + 2 <= n; i += 2)
+            vst1q_f64(y + i, vfmaq_f64(vld1q_f64(y + i), a, vld1q_f64(x + i)));
+        for (; i < n; ++i)
+            y[i] += alpha * x[i];
+    }
+    template <bool first, bool second>
+    inline void optimizerUpdate(ssize_t n, double *w, double *m, double *v, const double *grad, const UpdateCoefficients& c) {
+        const float64x2_t eps = vdupq_n_f64(c.eps);
+        ssize_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            const float64x2_t wi = vld1q_f64(w + i);
+            const float64x2_t g = vfmaq_n_f64(vmulq_n_f64(wi, c.l2), vld1q_f64(grad + i), c.gScale);
+            float64x2_t step = g;
+            if constexpr (first) {
+                step = vfmaq_n_f64(vmulq_n_f64(g, c.b1), vld1q_f64(m + i), c.a1);
+                vst1q_f64(m + i, step);
+            }
+            if constexpr (second) {
+                const float64x2_t vi = vfmaq_n_f64(vmulq_n_f64(vmulq_f64(g, g), c.b2), vld1q_f64(v + i), c.a2);
+                vst1q_f64(v + i, vi);
+                step = vdivq_f64(vmulq_n_f64(step, c.c1), vaddq_f64(vsqrtq_f64(vmulq_n_f64(vi, c.c2)), eps));
+            }
+            vst1q_f64(w + i, vsubq_f64(wi, vfmaq_n_f64(vmulq_n_f64(wi, c.learningRate * c.decay), step, c.learningRate)));
+        }
+        scalar::optimizerUpdate<first, second>(n - i, w + i, m? m + i: m, v? v + i: v, grad + i, c);
+    }
+    inline void optimizerUpdate(ssize_t n, double *w, double *m, double *v, const double *grad, const UpdateCoefficients& c) {
+        if (m && v)
+            optimizerUpdate<true, true>(n, w, m, v, grad, c);
+        else if (m)
+            optimizerUpdate<true, false>(n, w, m, v, grad, c);
+        else if (v)
+            optimizerUpdate<false, true>(n, w, m, v, grad, c);
+        else
+            optimizerUpdate<false, false>(n, w, m, v, grad, c);
+    }
+    inline float dot(ssize_t n, const float *x, const float *y) {
+        float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+        ssize_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = vfmaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(y + i));
+            acc1 = vfmaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(y + i + 4));
+        }
+        float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+        for (; i < n; ++i)
+            sum += x[i] * y[i];
+        return sum;
+    }
+    inline void axpy(ssize_t n, float alpha, const float *x, float *y) {
+        const float32x4_t a = vdupq_n_f32(alpha);
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            vst1q_f32(y + i, vfmaq_f32(vld1q_f32(y + i), a, vld1q_f32(x + i)));
+        for (; i < n; ++i)
+            y[i] += alpha * x[i];
+    }
+    template <bool first, bool second>
+    inline void optimizerUpdate(ssize_t n, float *w, float *m, float *v, const float *grad, const UpdateCoefficients& c) {
+        const float32x4_t eps = vdupq_n_f32(c.eps);
+        ssize_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const float32x4_t wi = vld1q_f32(w + i);
+            const float32x4_t g = vfmaq_n_f32(vmulq_n_f32(wi, c.l2), vld1q_f32(grad + i), c.gScale);
+            float32x4_t step = g;
+            if constexpr (first) {
+                step = vfmaq_n_f32(vmulq_n_f32(g, c.b1), vld1q_f32(m + i), c.a1);
+                vst1q_f32(m + i, step);
+            }
+            if constexpr (second) {
+                const float32x4_t vi = vfmaq_n_f32(vmulq_n_f32(vmulq_f32(g, g), c.b2), vld1q_f32(v + i), c.a2);
+                vst1q_f32(v + i, vi);
+                step = vdivq_f32(vmulq_n_f32(step, c.c1), vaddq_f32(vsqrtq_f32(vmulq_n_f32(vi, c.c2)), eps));
+            }
+            vst1q_f32(w + i, vsubq_f32(wi, vfmaq_n_f32(vmulq_n_f32(wi, c.learningRate * c.decay), step, c.learningRate)));
+        }
+        scalar::optimizerUpdate<first, second>(n - i, w + i, m? m + i: m, v? v + i: v, grad + i, c);
+    }
+    inline void optimizerUpdate(ssize_t n, float *w, float *m, float *v, const float *grad, const UpdateCoefficients& c) {
+        if (m && v)
+            optimizerUpdate<true, true>(n, w, m, v, grad, c);
+        else if (m)
+            optimizerUpdate<true, false>(n, w, m, v, grad, c);
+        else if (v)
+            optimizerUpdate<false, true>(n, w, m, v, grad, c);
+        else
+            optimizerUpdate<false, false>(n, w, m, v, grad, c);
+    }
+}
+#endif
+
+template <class T = double>
+inline const BasicKernels<T>& detectKernels() {
+    static_assert(std::is_same_v<T, double> || std::is_same_v<T, float>);
+#ifdef SIMD_X86_
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        static const BasicKernels<T> k{"avx512", avx512::dot, avx512::axpy, avx512::exp, avx512::tanh, avx512::sigmoid, avx512::leakyRelu, avx512::leakyReluDerivative, avx512::optimizerUpdate, avx512::gemm};
+        return k;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        static const BasicKernels<T> k{"avx2", avx2::dot, avx2::axpy, avx2::exp, avx2::tanh, avx2::sigmoid, avx2::leakyRelu, avx2::leakyReluDerivative, avx2::optimizerUpdate, avx2::gemm};
+        return k;
+    }
+#endif
+#ifdef SIMD_NEON_
+    static const BasicKernels<T> k{"neon", neon::dot, neon::axpy, scalar::exp<T>, scalar::tanh<T>, scalar::sigmoid<T>, scalar::leakyRelu<T>, scalar::leakyReluDerivative<T>, neon::optimizerUpdate, scalar::gemm<T>};
+    return k;
+#endif
+    return scalarKernels<T>();
+}
+
+// one active table per scalar type
+template <class T>
+inline const BasicKernels<T> *& activeKernels() {
+    static const BasicKernels<T> *k = &detectKernels<T>();
+    return k;
+}
+
+template <class T = double>
+inline const BasicKernels<T>& kernels() {
+    return *activeKernels<T>();
+}
+
+// e.g. useKernels(scalarKernels()) to run everything on the reference path
+template <class T>
+inline void useKernels(const BasicKernels<T>& k) {
+    activeKernels<T>() = &k;
+}
+
+// int8 x int8 products of the quantized inference path (quantized.hpp), accumulated exactly in int32: sign-extended to
+// int16 lanes, multiplied and summed in pairs. Exact for n up to 2^31 / 127^2, about 133k.
+struct Int8Kernels {
+    const char *name;
+    int32_t (*dot)(ssize_t n, const int8_t *x, const int8_t *y);
+    // y[j] = dot(n, w + j * ldw, x) for j in [0, rows)
+    void (*gemv)(ssize_t rows, ssize_t n, const int8_t *w, ssize_t ldw, const int8_t *x, int32_t *y);
+};
+
+template <int32_t (*dot)(ssize_t, const int8_t *, const int8_t *)>
+inline void rowDots(ssize_t rows, ssize_t n, const int8_t *w, ssize_t ldw, const int8_t *x, int32_t *y) {
+    for (ssize_t j = 0; j < rows; ++j)
+        y[j] = dot(n, w + j * ldw, x);
+}
+
+namespace scalar {
+    inline int32_t dot(ssize_t n, const int8_t *x, const int8_t *y) {
+        int32_t s = 0;
+        for (ssize_t i = 0; i < n; ++i)
+            s += int32_t{x[i]} * y[i];
+        return s;
+    }
+}
+
+inline const Int8Kernels& scalarInt8Kernels() {
+    static const Int8Kernels k{"scalar", scalar::dot, rowDots<scalar::dot>};
+    return k;
+}
+
+#ifdef SIMD_X86_
+namespace avx2 {
+    __attribute__((target("avx2,fma"))) inline __m256i dot16(__m256i acc, const int8_t *x, const int8_t *y) {
+        const __m256i x16 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x)));
+        const __m256i y16 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y)));
+        return _mm256_add_epi32(acc, _mm256_madd_epi16(x16, y16));
+    }
+    __attribute__((target("avx2,fma"))) inline int32_t reduce(__m256i v) {
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+        return _mm_cvtsi128_si32(s);
+    }
+    __attribute__((target("avx2,fma"))) inline int32_t dot(ssize_t n, const int8_t *x, const int8_t *y) {
+        __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+        ssize_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            acc0 = dot16(acc0, x + i, y + i);
+            acc1 = dot16(acc1, x + i + 16, y + i + 16);
+        }
+        if (i + 16 <= n) {
+            acc0 = dot16(acc0, x + i, y + i);
+            i += 16;
+        }
+        int32_t s = reduce(_mm256_add_epi32(acc0, acc1));
+        for (; i < n; ++i)
+            s += int32_t{x[i]} * y[i];
+        return s;
+    }
+    // four rows of w per pass, sharing every widened load of x
+    __attribute__((target("avx2,fma"))) inline void gemv(ssize_t rows, ssize_t n, const int8_t *w, ssize_t ldw, const int8_t *x, int32_t *y) {
+        ssize_t j = 0;
+        for (; j + 4 <= rows; j += 4) {
+            const int8_t *w0 = w + j * ldw, *w1 = w0 + ldw, *w2 = w1 + ldw, *w3 = w2 + ldw;
+            __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256(), acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+            ssize_t i = 0;
+            for (; i + 16 <= n; i += 16) {
+                const __m256i x16 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i)));
+                acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(x16, _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(w0 + i)))));
+                acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(x16, _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(w1 + i)))));
+                acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(x16, _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(w2 + i)))));
+                acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(x16, _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(w3 + i)))));
+            }
+            y[j] = reduce(acc0);
+            y[j + 1] = reduce(acc1);
+            y[j + 2] = reduce(acc2);
+            y[j + 3] = reduce(acc3);
+            for (; i < n; ++i) {
+                y[j] += int32_t{w0[i]} * x[i];
+                y[j + 1] += int32_t{w1[i]} * x[i];
+                y[j + 2] += int32_t{w2[i]} * x[i];
+                y[j + 3] += int32_t{w3[i]} * x[i];
+            }
+        }
+        for (; j < rows; ++j)
+            y[j] = dot(n, w + j * ldw, x);
+    }
+}
+
+namespace avx512 {
+    __attribute__((target("avx512f,avx512bw"))) inline __m512i dot32(__m512i acc, const int8_t *x, const int8_t *y) {
+        const __m512i x16 = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(x)));
+        const __m512i y16 = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(y)));
+        return _mm512_add_epi32(acc, _mm512_madd_epi16(x16, y16));
+    }
+    __attribute__((target("avx512f,avx512bw"))) inline int32_t dot(ssize_t n, const int8_t *x, const int8_t *y) {
+        __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+        ssize_t i = 0;
+        for (; i + 64 <= n; i += 64) {
+            acc0 = dot32(acc0, x + i, y + i);
+            acc1 = dot32(acc1, x + i + 32, y + i + 32);
+        }
+        if (i + 32 <= n) {
+            acc0 = dot32(acc0, x + i, y + i);
+            i += 32;
+        }
+        int32_t s = _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+        for (; i < n; ++i)
+            s += int32_t{x[i]} * y[i];
+        return s;
+    }
+    __attribute__((target("avx512f,avx512bw"))) inline void gemv(ssize_t rows, ssize_t n, const int8_t *w, ssize_t ldw, const int8_t *x, int32_t *y) {
+        ssize_t j = 0;
+        for (; j + 4 <= rows; j += 4) {
+            const int8_t *w0 = w + j * ldw, *w1 = w0 + ldw, *w2 = w1 + ldw, *w3 = w2 + ldw;
+            __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512(), acc2 = _mm512_setzero_si512(), acc3 = _mm512_setzero_si512();
+            ssize_t i = 0;
+            for (; i + 32 <= n; i += 32) {
+                const __m512i x16 = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i)));
+                acc0 = _mm512_add_epi32(acc0, _mm512_madd_epi16(x16, _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(w0 + i)))));
+                acc1 = _mm512_add_epi32(acc1, _mm512_madd_epi16(x16, _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(w1 + i)))));
+                acc2 = _mm512_add_epi32(acc2, _mm512_madd_epi16(x16, _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(w2 + i)))));
+                acc3 = _mm512_add_epi32(acc3, _mm512_madd_epi16(x16, _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(w3 + i)))));
+            }
+            y[j] = _mm512_reduce_add_epi32(acc0);
+            y[j + 1] = _mm512_reduce_add_epi32(acc1);
+            y[j + 2] = _mm512_reduce_add_epi32(acc2);
+            y[j + 3] = _mm512_reduce_add_epi32(acc3);
+            for (; i < n; ++i) {
+                y[j] += int32_t{w0[i]} * x[i];
+                y[j + 1] += int32_t{w1[i]} * x[i];
+                y[j + 2] += int32_t{w2[i]} * x[i];
+                y[j + 3] += int32_t{w3[i]} * x[i];
+            }
+        }
+        for (; j < rows; ++j)
+            y[j] = dot(n, w + j * ldw, x);
+    }
+}
+#endif
+
+#ifdef SIMD_NEON_
+namespace neon {
+    inline int32_t dot(ssize_t n, const int8_t *x, const int8_t *y) {
+        int32x4_t acc = vdupq_n_s32(0);
+        ssize_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const int8x16_t a = vld1q_s8(x + i);
+            const int8x16_t b = vld1q_s8(y + i);
+            acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(a), vget_low_s8(b)));
+            acc = vpadalq_s16(acc, vmull_high_s8(a, b));
+        }
+        int32_t s = vaddvq_s32(acc);
+        for (; i < n; ++i)
+            s += int32_t{x[i]} * y[i];
+        return s;
+    }
+}
+#endif
+
+inline const Int8Kernels& detectInt8Kernels() {
+#ifdef SIMD_X86_
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        static const Int8Kernels k{"avx512", avx512::dot, avx512::gemv};
+        return k;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        static const Int8Kernels k{"avx2", avx2::dot, avx2::gemv};
+        return k;
+    }
+#endif
+#ifdef SIMD_NEON_
+    static const Int8Kernels k{"neon", neon::dot, rowDots<neon::dot>};
+    return k;
+#endif
+    return scalarInt8Kernels();
+}
+
+inline const Int8Kernels *& activeInt8Kernels() {
+    static const Int8Kernels *k = &detectInt8Kernels();
+    return k;
+}
+
+inline const Int8Kernels& int8Kernels() {
+    return *activeInt8Kernels();
+}
+
+inline void useKernels(const Int8Kernels& k) {
+    activeInt8Kernels() = &k;
+}
+
+template <class T>
+T *data(std::valarray<T>& v) noexcept {
+    return v.size()? &v[0]: nullptr;
+}
+
+template <class T>
+const T *data(const std::valarray<T>& v) noexcept {
+    return v.size()? &v[0]: nullptr;
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+#include <valarray>
+#include <span>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cassert>
+#include <sys/types.h>
+#include "matrix.hpp"
+
+using namespace std::string_literals;
+
+// compressed sparse row (CSR) matrix: row i holds the values[offsets[i], offsets[i + 1]) at the columns of the same
+// range, e.g. a batch of bag-of-words inputs with a handful of non-zeros among cols features
+template <class T>
+class BasicSparseMatrix {
+    ssize_t colCounts{0};
+    std::vector<size_t> offsets{0};
+    std::vector<uint32_t> columnIndices;
+    std::vector<T> elements;
+public:
+    using value_type = T;
+    BasicSparseMatrix() = default;
+    // no rows yet, see addRow
+    explicit BasicSparseMatrix(ssize_t cols): colCounts(cols) {}
+    // the non-zeros of a dense matrix
+    explicit BasicSparseMatrix(const BasicMatrix<T>& dense): colCounts(dense.cols()) {
+        for (ssize_t i = 0; i < dense.rows(); ++i) {
+            const T *row = dense.rowData(i);
+            for (ssize_t j = 0; j < colCounts; ++j) {
+                if (row[j] != 0) {
+                    columnIndices.push_back(static_cast<uint32_t>(j));
+                    elements.push_back(row[j]);
+                }
+            }
+            offsets.push_back(elements.size());
+        }
+    }
+    explicit BasicSparseMatrix(const std::valarray<std::valarray<T>>& nested): BasicSparseMatrix(BasicMatrix<T>(nested)) {}
+
+    // appends a row with values at columns, which must be distinct
+    void addRow(std::span<const uint32_t> columns, std::span<const T> values) {
+        assert(columns.size() == values.size());      //assertion
+        for (uint32_t c: columns)
+            if (static_cast<ssize_t>(c) >= colCounts)
+                throw std::runtime_error{"column "s + std::to_string(c) + " is out of "s + std::to_string(colCounts) + " columns"s};
+        columnIndices.insert(columnIndices.end(), columns.begin(), columns.end());
+        elements.insert(elements.end(), values.begin(), values.end());
+        offsets.push_back(elements.size());
+    }
+    void clear() noexcept {
+        offsets.assign(1, 0);
+        columnIndices.clear();
+        elements.clear();
+    }
+    void reserve(size_t rows, size_t nonZeros) {
+        offsets.reserve(rows + 1);
+        columnIndices.reserve(nonZeros);
+        elements.reserve(nonZeros);
+    }
+
+    ssize_t rows() const noexcept {
+        return offsets.size() - 1;
+    }
+    ssize_t cols() const noexcept {
+        return colCounts;
+    }
+    size_t nonZeros() const noexcept {
+        return elements.size();
+    }
+    // of rows [rowBegin, rowEnd)
+    size_t nonZeros(ssize_t rowBegin, ssize_t rowEnd) const noexcept {
+        return offsets[rowEnd] - offsets[rowBegin];
+    }
+    std::span<const uint32_t> columns(ssize_t row) const noexcept {
+        return {columnIndices.data() + offsets[row], offsets[row + 1] - offsets[row]};
+    }
+    std::span<const T> values(ssize_t row) const noexcept {
+        return {elements.data() + offsets[row], offsets[row + 1] - offsets[row]};
+    }
+    BasicMatrix<T> toMatrix() const {
+        BasicMatrix<T> dense(rows(), colCounts);
+        for (ssize_t i = 0; i < rows(); ++i) {
+            const std::span<const uint32_t> c = columns(i);
+            const std::span<const T> v = values(i);
+            for (size_t k = 0; k < c.size(); ++k)
+                dense(i, c[k]) = v[k];
+        }
+        return dense;
+    }
+};
+
+using SparseMatrix = BasicSparseMatrix<double>;
@@ -0,0 +1,271 @@
+#pragma once
+#include <array>
+#include <tuple>
+#include <memory>
+#include <valarray>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <span>
+#include <cassert>
+#include "network.hpp"
+#include "checkpoint.hpp"
+#include "activation_functions.hpp"
+#include "simd.hpp"
+
+using namespace std::literals;
+
+template <size_t... Sizes>
+struct LayerSizes {};
+
+// the ActivationFunctions value a checkpoint stores for each activation function template; the deprecated ones have none
+template <template <class> class A>
+inline constexpr ActivationFunctions activationFunctionOf = ActivationFunctions::INVALID;
+template <> inline constexpr ActivationFunctions activationFunctionOf<Sigmoid> = ActivationFunctions::SIGMOID;
+template <> inline constexpr ActivationFunctions activationFunctionOf<Tanh> = ActivationFunctions::TANH;
+template <> inline constexpr ActivationFunctions activationFunctionOf<Relu> = ActivationFunctions::RELU;
+template <> inline constexpr ActivationFunctions activationFunctionOf<LeakyRelu> = ActivationFunctions::LEAKYRELU;
+template <> inline constexpr ActivationFunctions activationFunctionOf<PrRelu> = ActivationFunctions::PRRELU;
+template <> inline constexpr ActivationFunctions activationFunctionOf<Softmax> = ActivationFunctions::SOFTMAX;
+template <> inline constexpr ActivationFunctions activationFunctionOf<StableSoftmax> = ActivationFunctions::STABLE_SOFTMAX;
+template <> inline constexpr ActivationFunctions activationFunctionOf<StableSoftmaxV3> = ActivationFunctions::STABLE_SOFTMAX_V3;
+template <> inline constexpr ActivationFunctions activationFunctionOf<CubeRoot> = ActivationFunctions::CUBEROOT;
+template <> inline constexpr ActivationFunctions activationFunctionOf<SgnExp> = ActivationFunctions::SGNEXP;
+
+namespace static_kernels {
+    // out = biases + in * weights with In x Out row-major weights. Out is cut into tiles of tile accumulators that stay
+    // in registers over the whole of In, every size being a constant the loops unroll on
+    template <class T, size_t In, size_t Out, size_t tile>
+    __attribute__((always_inline)) inline void dense(const T *__restrict__ in, const T *__restrict__ weights, const T *__restrict__ biases, T *__restrict__ out) {
+        constexpr size_t width = std::min(tile, Out);
+        constexpr size_t fullTiles = Out / width;
+        constexpr size_t rest = Out % width;
+        for (size_t j0 = 0; j0 < fullTiles * width; j0 += width) {
+            T acc[width];
+            for (size_t t = 0; t < width; ++t)
+                acc[t] = biases[j0 + t];
+            for (size_t i = 0; i < In; ++i) {
+                const T x = in[i];
+                const T *__restrict__ row = weights + i * Out + j0;
+                for (size_t t = 0; t < width; ++t)
+                    acc[t] += x * row[t];
+            }
+            for (size_t t = 0; t < width; ++t)
+                out[j0 + t] = acc[t];
+        }
+        if constexpr (rest > 0) {
+            constexpr size_t j0 = fullTiles * width;
+            T acc[rest];
+            for (size_t t = 0; t < rest; ++t)
+                acc[t] = biases[j0 + t];
+            for (size_t i = 0; i < In; ++i) {
+                const T x = in[i];
+                const T *__restrict__ row = weights + i * Out + j0;
+                for (size_t t = 0; t < rest; ++t)
+                    acc[t] += x * row[t];
+            }
+            for (size_t t = 0; t < rest; ++t)
+                out[j0 + t] = acc[t];
+        }
+    }
+
+    // 128 bytes of accumulators (16 doubles or 32 floats), eight 128-bit registers on the baseline instruction set
+    template <class T, size_t In, size_t Out>
+    inline void scalarDense(const T *in, const T *weights, const T *biases, T *out) {
+        dense<T, In, Out, 32 / sizeof(T) * 4>(in, weights, biases, out);
+    }
+#ifdef SIMD_X86_
+    // 12 of the 16 ymm registers as accumulators
+    template <class T, size_t In, size_t Out>
+    __attribute__((target("avx2,fma"))) inline void avx2Dense(const T *in, const T *weights, const T *biases, T *out) {
+        dense<T, In, Out, 32 / sizeof(T) * 12>(in, weights, biases, out);
+    }
+    // 16 of the 32 zmm registers as accumulators
+    template <class T, size_t In, size_t Out>
+    __attribute__((target("avx512f"))) inline void avx512Dense(const T *in, const T *weights, const T *biases, T *out) {
+        dense<T, In, Out, 64 / sizeof(T) * 16>(in, weights, biases, out);
+    }
+#endif
+}
+
+// Inference network with its topology fixed at compile time, e.g.
+//   StaticNetwork<28*28, 128, 10, LeakyRelu, StableSoftmaxV3> n("mnist-v4.dat");
+// for the Network(28*28, 10, {128}, {LEAKYRELU}, STABLE_SOFTMAX_V3) of samples.hpp::mnist(). Layer sizes and activation
+// functions are template parameters: every dense layer is a kernel specialised on its constant sizes, the activations
+// are called without virtual dispatch, and the parameters sit in fixed-size, 64-byte aligned arrays. It loads from
+// the same files as loadNetwork, or copies a trained Network, and throws when their topology differs. Training stays
+// with Network. run() is const and keeps its intermediate values on the stack, sized by the widest hidden layer.
+template <class T, class Sizes, template <class> class... Activations>
+class BasicStaticNetwork;
+
+template <class T, size_t... Sizes, template <class> class... Activations>
+class BasicStaticNetwork<T, LayerSizes<Sizes...>, Activations...> {
+    static_assert(sizeof...(Sizes) >= 2 && sizeof...(Sizes) == sizeof...(Activations) + 1, "one activation function per layer after the input layer");
+public:
+    using value_type = T;
+    static constexpr size_t layerCounts = sizeof...(Sizes);
+    static constexpr std::array<size_t, layerCounts> sizes{Sizes...};
+    static constexpr size_t inputSize = sizes.front();
+    static constexpr size_t outputSize = sizes.back();
+private:
+    template <size_t In, size_t Out>
+    struct Dense {
+        alignas(64) std::array<T, In * Out> weights;
+        alignas(64) std::array<T, Out> biases;
+    };
+    template <size_t... K>
+    static auto parametersOf(std::index_sequence<K...>) -> std::tuple<Dense<sizes[K], sizes[K + 1]>...>;
+    using Parameters = decltype(parametersOf(std::make_index_sequence<layerCounts - 1>{}));
+    template <size_t K>
+    using Activation = std::tuple_element_t<K, std::tuple<Activations<T>...>>;
+    static constexpr std::array<ActivationFunctions, layerCounts - 1> activationFunctions{activationFunctionOf<Activations>...};
+    static constexpr size_t maxHiddenSize = [] {
+        size_t maxSize = 1;
+        for (size_t l = 1; l + 1 < layerCounts; ++l)
+            maxSize = std::max(maxSize, sizes[l]);
+        return maxSize;
+    }();
+
+    std::unique_ptr<Parameters> parameters{std::make_unique<Parameters>()};
+
+    // layer sizes(l) with weights into sizes(l + 1): l from 0, the input layer
+    template <class Size, class NextSize, class ActivationFunctionOf>
+    static void validate(size_t counts, Size&& size, NextSize&& nextSize, ActivationFunctionOf&& activation) {
+        bool matches = counts == layerCounts;
+        for (size_t l = 0; matches && l < layerCounts; ++l)
+            matches = size(l) == sizes[l] && nextSize(l) == ((l + 1 < layerCounts)? sizes[l + 1]: 0) && (!l || activation(l) == activationFunctions[l - 1]);
+        if (!matches)
+            throw std::runtime_error{"cannot build a StaticNetwork from a network of another topology"};
+    }
+    // copies layer K's weights and the biases of layer K + 1
+    template <size_t K = 0, class WeightsOf, class BiasesOf>
+    void assign(WeightsOf&& weightsOf, BiasesOf&& biasesOf) {
+        if constexpr (K + 1 < layerCounts) {
+            Dense<sizes[K], sizes[K + 1]>& dense = std::get<K>(*parameters);
+            weightsOf(K, dense.weights.data());
+            biasesOf(K + 1, dense.biases.data());
+            assign<K + 1>(weightsOf, biasesOf);
+        }
+    }
+    using DenseKernel = void (*)(const T *in, const T *weights, const T *biases, T *out);
+    // the In x Out kernel for the instruction set of the table called isa
+    template <size_t In, size_t Out>
+    static DenseKernel denseKernelOf(std::string_view isa) {
+#ifdef SIMD_X86_
+        if (isa == "avx512")
+            return &static_kernels::avx512Dense<T, In, Out>;
+        if (isa == "avx2")
+            return &static_kernels::avx2Dense<T, In, Out>;
+#endif
+        return &static_kernels::scalarDense<T, In, Out>;
+    }
+    // the kernel matching the table simd::kernels has now, so useKernels applies; while that is the detected table it
+    // costs one pointer compare, and only another table is looked up by name
+    template <size_t In, size_t Out>
+    static DenseKernel denseKernel() {
+        static const simd::BasicKernels<T> *const detected = &simd::detectKernels<T>();
+        static const DenseKernel detectedKernel = denseKernelOf<In, Out>(detected->name);
+        const simd::BasicKernels<T> *active = &simd::kernels<T>();
+        return (active == detected)? detectedKernel: denseKernelOf<In, Out>(active->name);
+    }
+    template <size_t K>
+    static void layerForward(const Dense<sizes[K], sizes[K + 1]>& dense, const T *in, T *out) {
+        constexpr size_t In = sizes[K];
+        constexpr size_t Out = sizes[K + 1];
+        const DenseKernel kernel = denseKernel<In, Out>();
+        kernel(in, dense.weights.data(), dense.biases.data(), out);
+        using A = Activation<K>;
+        A activation;
+        // qualified, so not a virtual call
+        activation.A::apply(std::span<const T>(out, Out), std::span<T>(out, Out));
+    }
+    // layers K.. of the network, ping-ponging between the two hidden buffers
+    template <size_t K>
+    void forward(const T *in, T *buffer, T *otherBuffer, T *output) const {
+        if constexpr (K + 2 == layerCounts) {
+            layerForward<K>(std::get<K>(*parameters), in, output);
+        } else {
+            layerForward<K>(std::get<K>(*parameters), in, buffer);
+            forward<K + 1>(buffer, otherBuffer, buffer, output);
+        }
+    }
+public:
+    BasicStaticNetwork() = default;
+    template <class M>
+    explicit BasicStaticNetwork(const BasicNetwork<T, M>& network) {
+        std::vector<const BasicLayer<T, M> *> layers{&network.inputLayer};
+        for (const BasicLayer<T, M>& hiddenLayer: network.hiddenLayers)
+            layers.push_back(&hiddenLayer);
+        layers.push_back(&network.outputLayer);
+        validate(layers.size(), [&](size_t l) { return size_t(layers[l]->layerSize); }, [&](size_t l) { return size_t(layers[l]->nextLayerSize); }, [&](size_t l) { return layers[l]->activationFunctionEnum; });
+        assign([&](size_t l, T *weights) {
+            std::copy(layers[l]->weights.data(), layers[l]->weights.data() + layers[l]->weights.size(), weights);
+        }, [&](size_t l, T *biases) {
+            std::copy(std::begin(layers[l]->biases), std::end(layers[l]->biases), biases);
+        });
+    }
+    // in either precision of the checkpoint
+    explicit BasicStaticNetwork(const Checkpoint& checkpoint) {
+        validate(checkpoint.layerCounts(), [&](size_t l) { return size_t(checkpoint.layerSize(l)); }, [&](size_t l) { return size_t(checkpoint.nextLayerSize(l)); }, [&](size_t l) { return checkpoint.activationFunction(l); });
+        const bool stored32 = checkpoint.dataType() == DataTypes::FLOAT32;
+        assign([&](size_t l, T *weights) {
+            const size_t n = checkpoint.layerSize(l) * checkpoint.nextLayerSize(l);
+            if (stored32)
+                std::copy(checkpoint.weights<float>(l), checkpoint.weights<float>(l) + n, weights);
+            else
+                std::copy(checkpoint.weights<double>(l), checkpoint.weights<double>(l) + n, weights);
+        }, [&](size_t l, T *biases) {
+            const size_t n = checkpoint.layerSize(l);
+            if (stored32)
+                std::copy(checkpoint.biases<float>(l), checkpoint.biases<float>(l) + n, biases);
+            else
+                std::copy(checkpoint.biases<double>(l), checkpoint.biases<double>(l) + n, biases);
+        });
+    }
+    // a binary checkpoint or the text format, as loadNetwork
+    explicit BasicStaticNetwork(const std::string& loc) {
+        if (Checkpoint::isCheckpoint(loc))
+            *this = BasicStaticNetwork(Checkpoint(loc));
+        else
+            *this = BasicStaticNetwork(loadNetwork<T>(loc));
+    }
+    BasicStaticNetwork(const BasicStaticNetwork& n): parameters(std::make_unique<Parameters>(*n.parameters)) {}
+    BasicStaticNetwork(BasicStaticNetwork&&) noexcept = default;
+    BasicStaticNetwork& operator=(const BasicStaticNetwork& n) {
+        // a moved-from network has no parameters left to copy into
+        if (parameters)
+            *parameters = *n.parameters;
+        else
+            parameters = std::make_unique<Parameters>(*n.parameters);
+        return *this;
+    }
+    BasicStaticNetwork& operator=(BasicStaticNetwork&&) noexcept = default;
+
+    void run(std::span<const T, inputSize> input, std::span<T, outputSize> output) const {
+        alignas(64) std::array<T, maxHiddenSize> buffer;
+        alignas(64) std::array<T, maxHiddenSize> otherBuffer;
+        forward<0>(input.data(), buffer.data(), otherBuffer.data(), output.data());
+    }
+    std::valarray<T> run(const std::valarray<T>& input) const {
+        assert(input.size() == inputSize);       //assertion
+        std::valarray<T> output(outputSize);
+        run(std::span<const T, inputSize>(simd::data(input), inputSize), std::span<T, outputSize>(simd::data(output), outputSize));
+        return output;
+    }
+    // same contract as Network::test
+    template <class _Actual, class _BiPred>
+    double test(const std::valarray<std::valarray<T>>& testInputs, _Actual&& testActual, _BiPred&& biPred) const {
+        ssize_t correctCounts = 0;
+        for (ssize_t i = 0; i < testInputs.size(); ++i) {
+            if (biPred(this->run(testInputs[i]), testActual[i]))
+                ++correctCounts;
+        }
+        return correctCounts / static_cast<double>(testInputs.size());
+    }
+};
+
+// the dense shape of samples.hpp::mnist(): StaticNetwork<784, 128, 10, LeakyRelu, StableSoftmaxV3>
+template <size_t In, size_t Hidden, size_t Out, template <class> class HiddenActivation, template <class> class OutputActivation, class T = double>
+using StaticNetwork = BasicStaticNetwork<T, LayerSizes<In, Hidden, Out>, HiddenActivation, OutputActivation>;
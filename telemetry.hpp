@@ -0,0 +1,188 @@
+#pragma once
+// Training telemetry, compiled in with -DNN_TELEMETRY; without it every macro below expands to nothing and its
+// arguments are not evaluated.
+//   TELEMETRY_SCOPE(name)                       times the enclosing scope as phase name, a string literal
+//   TELEMETRY_LAYER_SCOPE(name, layer, flops)   the same for layer number layer of a network, doing flops operations
+//   TELEMETRY_SAMPLES(counts)                   adds trained samples to the throughput counter
+//   TELEMETRY_SUMMARY(os)                       prints, then clears, the phases, samples/s and per-layer GFLOP/s
+// Phases are summed over every thread, so with a pool their times add up to more than the wall time.
+// telemetry::startTrace() additionally keeps every timed scope until telemetry::writeTrace(loc) writes them out as
+// Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+#ifdef NN_TELEMETRY
+#include <chrono>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdint>
+
+namespace telemetry {
+    using namespace std::string_literals;
+    using Clock = std::chrono::steady_clock;
+
+    struct Key {
+        const char *name;
+        // -1 for phases that are not about one layer
+        int layer;
+        // by text, as the same literal may have other addresses in other translation units
+        bool operator<(const Key& o) const noexcept {
+            return std::make_tuple(std::string_view(name), layer) < std::make_tuple(std::string_view(o.name), o.layer);
+        }
+    };
+    struct Stat {
+        size_t calls{0};
+        int64_t nanoseconds{0};
+        uint64_t flops{0};
+    };
+    struct Event {
+        Key key;
+        int64_t begin;
+        int64_t duration;
+        uint64_t flops;
+    };
+    // one per thread that ever timed a scope; its mutex is only contended while a summary or a trace is taken
+    struct ThreadRecord {
+        std::mutex mutex;
+        size_t id;
+        std::map<Key, Stat> stats;
+        std::vector<Event> events;
+    };
+
+    class Registry {
+    private:
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ThreadRecord>> records;
+        Clock::time_point start{Clock::now()};
+        const Clock::time_point origin{Clock::now()};
+    public:
+        std::atomic<uint64_t> samples{0};
+        std::atomic<bool> tracing{false};
+
+        ThreadRecord& threadRecord() {
+            thread_local std::shared_ptr<ThreadRecord> record = [this] {
+                auto record = std::make_shared<ThreadRecord>();
+                std::lock_guard lock(mutex);
+                record->id = records.size();
+                records.push_back(record);
+                return record;
+            }();
+            return *record;
+        }
+        int64_t sinceOrigin(Clock::time_point t) const noexcept {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin).count();
+        }
+        void summary(std::ostream& os) {
+            std::map<Key, Stat> stats;
+            {
+                std::lock_guard lock(mutex);
+                for (const auto& record: records) {
+                    std::lock_guard recordLock(record->mutex);
+                    for (const auto& [key, stat]: record->stats) {
+                        Stat& total = stats[key];
+                        total.calls += stat.calls;
+                        total.nanoseconds += stat.nanoseconds;
+                        total.flops += stat.flops;
+                    }
+                    record->stats.clear();
+                }
+            }
+            const auto now = Clock::now();
+            const double wall = std::chrono::duration<double>(now - start).count();
+            start = now;
+            const uint64_t trained = samples.exchange(0);
+            os << "telemetry over " << wall * 1e3 << " ms: " << trained << " samples, " << trained / wall << " samples/s" << "\r\n";
+            for (const auto& [key, stat]: stats) {
+                std::string name = key.name;
+                if (key.layer >= 0)
+                    name += "["s + std::to_string(key.layer) + "]"s;
+                const double ms = stat.nanoseconds / 1e6;
+                os << "  " << std::left << std::setw(28) << name << std::right << std::setw(10) << stat.calls << " calls "
+                    << std::setw(12) << ms << " thread-ms " << std::setw(8) << 100 * ms / (wall * 1e3) << "% ";
+                if (stat.flops)
+                    os << std::setw(10) << stat.flops / (stat.nanoseconds? stat.nanoseconds: 1.) << " GFLOP/s";
+                os << "\r\n";
+            }
+        }
+        void writeTrace(const std::string& loc) {
+            std::ofstream out(loc);
+            if (!out)
+                throw std::runtime_error{"can't open "s + loc + " to write the trace"s};
+            out << "{\"traceEvents\":[";
+            bool first = true;
+            std::lock_guard lock(mutex);
+            for (const auto& record: records) {
+                std::lock_guard recordLock(record->mutex);
+                for (const Event& event: record->events) {
+                    out << (first? "\n": ",\n") << "{\"name\":\"" << event.key.name << "\",\"cat\":\"nn\",\"ph\":\"X\",\"pid\":0,\"tid\":" << record->id
+                        << ",\"ts\":" << event.begin / 1e3 << ",\"dur\":" << event.duration / 1e3 << ",\"args\":{";
+                    if (event.key.layer >= 0)
+                        out << "\"layer\":" << event.key.layer << ",\"flops\":" << event.flops;
+                    out << "}}";
+                    first = false;
+                }
+                record->events.clear();
+            }
+            out << "\n]}\n";
+        }
+    };
+
+    inline Registry& registry() {
+        static Registry r;
+        return r;
+    }
+
+    class Scope {
+    private:
+        Key key;
+        uint64_t flops;
+        Clock::time_point begin;
+    public:
+        explicit Scope(const char *name, int layer = -1, uint64_t flops = 0) noexcept: key{name, layer}, flops(flops), begin(Clock::now()) {}
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope() {
+            const auto end = Clock::now();
+            const int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+            Registry& r = registry();
+            ThreadRecord& record = r.threadRecord();
+            std::lock_guard lock(record.mutex);
+            Stat& stat = record.stats[key];
+            ++stat.calls;
+            stat.nanoseconds += duration;
+            stat.flops += flops;
+            if (r.tracing.load(std::memory_order_relaxed))
+                record.events.push_back({key, r.sinceOrigin(begin), duration, flops});
+        }
+    };
+
+    // records every timed scope from now on, until writeTrace
+    inline void startTrace() {
+        registry().tracing = true;
+    }
+    // writes the scopes recorded since startTrace and stops recording
+    inline void writeTrace(const std::string& loc) {
+        registry().tracing = false;
+        registry().writeTrace(loc);
+    }
+}
+
+#define TELEMETRY_CONCAT_(a, b) a##b
+#define TELEMETRY_VARIABLE_(line) TELEMETRY_CONCAT_(telemetryScope, line)
+#define TELEMETRY_SCOPE(name) telemetry::Scope TELEMETRY_VARIABLE_(__LINE__){name}
+#define TELEMETRY_LAYER_SCOPE(name, layer, flops) telemetry::Scope TELEMETRY_VARIABLE_(__LINE__){name, static_cast<int>(layer), static_cast<uint64_t>(flops)}
+#define TELEMETRY_SAMPLES(counts) (telemetry::registry().samples += (counts))
+#define TELEMETRY_SUMMARY(os) telemetry::registry().summary(os)
+#else
+#define TELEMETRY_SCOPE(name) ((void)0)
+#define TELEMETRY_LAYER_SCOPE(name, layer, flops) ((void)0)
+#define TELEMETRY_SAMPLES(counts) ((void)0)
+#define TELEMETRY_SUMMARY(os) ((void)0)
+#endif
@@ -2,53 +2,432 @@
 #include <thread>
 #include <functional>
 #include <mutex>
+#include <condition_variable>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <atomic>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <new>
+#include <sys/types.h>
+#include "telemetry.hpp"
 
+// Work-stealing pool: every worker owns a deque it pushes to and pops from without locks, idle workers steal
+// from a random victim. Tasks added from threads outside the pool go through a locked injection queue.
 class ThreadPool {
+public:
+    // fixed 64-byte task record; trivially copyable callables up to 56 bytes are stored inline,
+    // anything else is boxed on the heap
+    class Task {
+        static constexpr size_t payloadSize = 56;
+        void (*invoke)(Task&){nullptr};
+        alignas(8) unsigned char payload[payloadSize];
+    public:
+        template <class C>
+        static Task make(C&& callable);
+        void operator()() {
+            invoke(*this);
+        }
+    };
 private:
+    // Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013)
+    // with a fixed power-of-two capacity; the fences of the paper are folded into seq_cst accesses to top and bottom,
+    // slots are relaxed atomic words so a losing thief reads stale, not torn, data
+    class WorkDeque {
+        static constexpr int64_t capacity = 1024;
+        static constexpr size_t slotWords = sizeof(Task) / sizeof(uint64_t);
+        struct Slot {
+            std::atomic<uint64_t> words[slotWords];
+        };
+        alignas(64) std::atomic<int64_t> top{0};
+        alignas(64) std::atomic<int64_t> bottom{0};
+        std::unique_ptr<Slot[]> slots{new Slot[capacity]};
+        inline void store(int64_t i, const Task& task);
+        inline void load(int64_t i, Task& task) const;
+    public:
+        // owner only; false when full
+        inline bool push(const Task& task);
+        // owner only
+        inline bool pop(Task& task);
+        // any thread
+        inline bool steal(Task& task);
+    };
+
     size_t threadCounts;
     std::vector<std::thread> threads{};
-    std::queue<std::function<void()>> tasks{};
+    std::unique_ptr<WorkDeque[]> deques;
 
-    std::mutex tasksMutex;
+    std::mutex injectionMutex;
+    std::deque<Task> injection{};
+
+    // tasks added but not yet taken by any thread, and tasks added but not yet finished
+    std::atomic<size_t> queuedTasks{0};
+    std::atomic<size_t> unfinishedTasks{0};
+
+    std::mutex sleepMutex;
     std::condition_variable cv;
+    std::atomic<size_t> sleepingWorkers{0};
+    std::mutex idleMutex;
+    std::condition_variable idleCv;
     std::atomic_bool stop{false};
+
+    static inline thread_local ThreadPool *currentPool{nullptr};
+    static inline thread_local size_t currentWorker{0};
+    static inline thread_local uint64_t randomState{0};
+
+    inline void submit(const Task& task);
+    inline bool takeInjected(Task& task, bool blocking);
+    inline bool findTask(Task& task);
+    inline void run(Task& task);
+    inline void workerLoop(size_t index);
+    // runs one queued task on the calling thread if there is any; used by waiting threads to help out
+    inline bool tryRunOne();
+    friend class TaskGroup;
 public:
     inline ThreadPool(size_t threadCounts);
 
+    // f and args are stored by value as with std::bind; std::ref/std::cref arguments unwrap on the call
     template <class F, class... Args>
     void addTasks(F&& f, Args&&... args);
 
+    // blocks until every task added so far has finished, running queued tasks on the calling thread meanwhile
+    inline void wait();
+
+    // splits [begin, end) into chunks of at most grain (0: one chunk per thread) and calls f(chunkBegin, chunkEnd);
+    // the calling thread runs the last chunk itself and returns once all chunks are done
+    template <class F>
+    void parallelFor(ssize_t begin, ssize_t end, ssize_t grain, F&& f);
+
     inline size_t getThreadCounts() const noexcept;
     inline size_t getWaitingTaskCounts() const noexcept;
 
     inline ~ThreadPool() noexcept;
 };
 
+// a set of tasks on a shared ThreadPool that can be waited for independently of the pool's other work
+class TaskGroup {
+private:
+    ThreadPool& threadPool;
+    std::atomic<size_t> pendingTasks{0};
+    std::mutex pendingMutex;
+    std::condition_variable cv;
+public:
+    inline explicit TaskGroup(ThreadPool& threadPool);
+
+    template <class F, class... Args>
+    void addTasks(F&& f, Args&&... args);
+
+    inline void wait();
+
+    inline ~TaskGroup() noexcept;
+};
+
+// the previous pool: one std::queue<std::function<void()>> behind one mutex, kept as the baseline of benchmarkThreadPools()
+class SharedQueueThreadPool {
+private:
+    size_t threadCounts;
+    std::vector<std::thread> threads{};
+    std::queue<std::function<void()>> tasks{};
+
+    std::mutex tasksMutex;
+    std::condition_variable cv;
+    std::condition_variable idleCv;
+    size_t unfinishedTasks{0};
+    std::atomic_bool stop{false};
+public:
+    inline SharedQueueThreadPool(size_t threadCounts);
+
+    template <class F, class... Args>
+    void addTasks(F&& f, Args&&... args);
+
+    inline void wait();
+
+    inline size_t getThreadCounts() const noexcept;
+
+    inline ~SharedQueueThreadPool() noexcept;
+};
+
 // ==============================
 //         Definition
 // ==============================
 
+template <class C>
+ThreadPool::Task ThreadPool::Task::make(C&& callable) {
+    using D = std::decay_t<C>;
+    Task task;
+    if constexpr (sizeof(D) <= payloadSize && alignof(D) <= alignof(uint64_t) && std::is_trivially_copyable_v<D>) {
+        new (task.payload) D(std::forward<C>(callable));
+        task.invoke = [](Task& t) {
+            (*std::launder(reinterpret_cast<D *>(t.payload)))();
+        };
+    } else {
+        D *boxed = new D(std::forward<C>(callable));
+        std::memcpy(task.payload, &boxed, sizeof(boxed));
+        task.invoke = [](Task& t) {
+            D *boxed;
+            std::memcpy(&boxed, t.payload, sizeof(boxed));
+            std::unique_ptr<D> owner(boxed);
+            (*owner)();
+        };
+    }
+    return task;
+}
+
+inline void ThreadPool::WorkDeque::store(int64_t i, const Task& task) {
+    uint64_t words[slotWords];
+    std::memcpy(words, &task, sizeof(Task));
+    Slot& slot = slots[i & (capacity - 1)];
+    for (size_t w = 0; w < slotWords; ++w)
+        slot.words[w].store(words[w], std::memory_order_relaxed);
+}
+
+inline void ThreadPool::WorkDeque::load(int64_t i, Task& task) const {
+    uint64_t words[slotWords];
+    const Slot& slot = slots[i & (capacity - 1)];
+    for (size_t w = 0; w < slotWords; ++w)
+        words[w] = slot.words[w].load(std::memory_order_relaxed);
+    std::memcpy(&task, words, sizeof(Task));
+}
+
+inline bool ThreadPool::WorkDeque::push(const Task& task) {
+    const int64_t b = bottom.load(std::memory_order_relaxed);
+    const int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= capacity)
+        return false;
+    store(b, task);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+inline bool ThreadPool::WorkDeque::pop(Task& task) {
+    const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_seq_cst);
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+    load(b, task);
+    if (t == b) {
+        // last task: race the thieves for it
+        const bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+inline bool ThreadPool::WorkDeque::steal(Task& task) {
+    int64_t t = top.load(std::memory_order_seq_cst);
+    const int64_t b = bottom.load(std::memory_order_seq_cst);
+    if (t >= b)
+        return false;
+    load(t, task);
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
 template <class F, class... Args>
 void ThreadPool::addTasks(F&& f, Args&&... args) {
+    submit(Task::make([f = std::forward<F>(f), ...args = std::forward<Args>(args)]() mutable {
+        std::invoke(f, static_cast<std::unwrap_reference_t<std::decay_t<decltype(args)>>&>(args)...);
+    }));
+}
+
+inline void ThreadPool::submit(const Task& task) {
+    unfinishedTasks.fetch_add(1);
+    if (!(currentPool == this && deques[currentWorker].push(task))) {
+        std::lock_guard<std::mutex> lock(injectionMutex);
+        injection.push_back(task);
+    }
+    queuedTasks.fetch_add(1);
+    if (sleepingWorkers.load() > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        cv.notify_one();
+    }
+}
+
+inline bool ThreadPool::takeInjected(Task& task, bool blocking) {
+    std::unique_lock<std::mutex> lock(injectionMutex, std::defer_lock);
+    if (blocking)
+        lock.lock();
+    else if (!lock.try_lock())
+        return false;
+    if (injection.empty())
+        return false;
+    task = injection.front();
+    injection.pop_front();
+    return true;
+}
+
+inline bool ThreadPool::findTask(Task& task) {
+    const bool isWorker = currentPool == this;
+    bool found = isWorker && deques[currentWorker].pop(task);
+    if (!found && queuedTasks.load(std::memory_order_relaxed) > 0) {
+        found = takeInjected(task, false);
+        if (!found) {
+            if (randomState == 0)
+                randomState = std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1;
+            randomState ^= randomState << 13;
+            randomState ^= randomState >> 7;
+            randomState ^= randomState << 17;
+            for (size_t i = 0; i < threadCounts && !found; ++i) {
+                const size_t victim = (randomState + i) % threadCounts;
+                found = !(isWorker && victim == currentWorker) && deques[victim].steal(task);
+            }
+        }
+        if (!found)
+            found = takeInjected(task, true);
+    }
+    if (found)
+        queuedTasks.fetch_sub(1);
+    return found;
+}
+
+inline void ThreadPool::run(Task& task) {
+    task();
+    if (unfinishedTasks.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idleCv.notify_all();
+    }
+}
+
+inline bool ThreadPool::tryRunOne() {
+    Task task;
+    if (!findTask(task))
+        return false;
+    run(task);
+    return true;
+}
+
+inline void ThreadPool::workerLoop(size_t index) {
+    static constexpr int spinCounts = 64;
+    currentPool = this;
+    currentWorker = index;
+    Task task;
+    while (true) {
+        bool found = false;
+        for (int spin = 0; spin < spinCounts && !(found = findTask(task)); ++spin)
+            std::this_thread::yield();
+        if (found) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers.fetch_add(1);
+        cv.wait(lock, [this](){
+            return this->stop || this->queuedTasks.load() > 0;
+        });
+        sleepingWorkers.fetch_sub(1);
+        if (stop && queuedTasks.load() == 0)
+            return;
+    }
+}
+
+inline void ThreadPool::wait() {
+    while (unfinishedTasks.load() > 0) {
+        if (tryRunOne())
+            continue;
+        std::unique_lock<std::mutex> lock(idleMutex);
+        idleCv.wait(lock, [this](){
+            return this->unfinishedTasks.load() == 0 || this->queuedTasks.load() > 0;
+        });
+    }
+}
+
+template <class F>
+void ThreadPool::parallelFor(ssize_t begin, ssize_t end, ssize_t grain, F&& f) {
+    if (begin >= end)
+        return;
+    if (grain <= 0)
+        grain = (end - begin + threadCounts - 1) / std::max<size_t>(threadCounts, 1);
+    TaskGroup group(*this);
+    ssize_t chunkBegin = begin;
+    for (; chunkBegin + grain < end; chunkBegin += grain) {
+        group.addTasks([&f](ssize_t chunkBegin, ssize_t chunkEnd) {
+            f(chunkBegin, chunkEnd);
+        }, chunkBegin, chunkBegin + grain);
+    }
+    f(chunkBegin, end);
+    // the caller's share is done: what remains is load imbalance and scheduling overhead
+    TELEMETRY_SCOPE("threadPool.wait");
+    group.wait();
+}
+
+inline size_t ThreadPool::getThreadCounts() const noexcept {
+    return threadCounts;
+}
+
+inline size_t ThreadPool::getWaitingTaskCounts() const noexcept {
+    return queuedTasks.load();
+}
+
+inline ThreadPool::ThreadPool(size_t threadCounts): threadCounts{threadCounts}, deques{new WorkDeque[std::max<size_t>(threadCounts, 1)]} {
+    for (size_t i = 0; i < threadCounts; ++i)
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+inline ThreadPool::~ThreadPool() noexcept {
+    {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (auto& _thread: threads)
+        _thread.join();
+}
+
+inline TaskGroup::TaskGroup(ThreadPool& threadPool): threadPool{threadPool} {}
+
+template <class F, class... Args>
+void TaskGroup::addTasks(F&& f, Args&&... args) {
+    pendingTasks.fetch_add(1);
+    threadPool.addTasks([this, f = std::forward<F>(f), ...args = std::forward<Args>(args)]() mutable {
+        std::invoke(f, static_cast<std::unwrap_reference_t<std::decay_t<decltype(args)>>&>(args)...);
+        std::lock_guard<std::mutex> lock(this->pendingMutex);
+        if (this->pendingTasks.fetch_sub(1) == 1)
+            this->cv.notify_all();
+    });
+}
+
+inline void TaskGroup::wait() {
+    while (pendingTasks.load() > 0 && threadPool.tryRunOne());
+    // the last task decrements under the lock, so holding it once here means no task still touches the group
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    cv.wait(lock, [this](){
+        return this->pendingTasks.load() == 0;
+    });
+}
+
+inline TaskGroup::~TaskGroup() noexcept {
+    wait();
+}
+
+template <class F, class... Args>
+void SharedQueueThreadPool::addTasks(F&& f, Args&&... args) {
     {
         std::unique_lock<std::mutex> lock(tasksMutex);
         tasks.emplace(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        ++unfinishedTasks;
     }
     cv.notify_one();
 }
 
-inline size_t ThreadPool::getThreadCounts() const noexcept {
-    return threadCounts;
+inline void SharedQueueThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(tasksMutex);
+    idleCv.wait(lock, [this](){
+        return this->unfinishedTasks == 0;
+    });
 }
 
-inline size_t ThreadPool::getWaitingTaskCounts() const noexcept {
-    return tasks.size();
+inline size_t SharedQueueThreadPool::getThreadCounts() const noexcept {
+    return threadCounts;
 }
 
-inline ThreadPool::ThreadPool(size_t threadCounts): threadCounts{threadCounts} {
+inline SharedQueueThreadPool::SharedQueueThreadPool(size_t threadCounts): threadCounts{threadCounts} {
     for (int i = 0; i < threadCounts; ++i) {
         threads.emplace_back([this](){
             std::function<void()> task;
@@ -63,15 +442,22 @@ inline ThreadPool::ThreadPool(size_t threadCounts): threadCounts{threadCounts} {
                     this->tasks.pop();
                 }
                 task();
+                {
+                    std::unique_lock<std::mutex> lock(this->tasksMutex);
+                    if (--this->unfinishedTasks == 0)
+                        this->idleCv.notify_all();
+                }
             }
         });
     }
 }
 
-inline ThreadPool::~ThreadPool() noexcept {
-    stop = true;
+inline SharedQueueThreadPool::~SharedQueueThreadPool() noexcept {
+    {
+        std::unique_lock<std::mutex> lock(tasksMutex);
+        stop = true;
+    }
     cv.notify_all();
     for (auto& _thread: threads)
         _thread.join();
 }
-
@@ -1,5 +1,7 @@
 #pragma once
 #include <valarray>
+#include <cstdint>
+#include <type_traits>
 
 template <class T>
 struct is_valarray: std::false_type {};
@@ -9,3 +11,13 @@ struct is_valarray<std::valarray<T>>: std::true_type {};
 
 template <class T>
 static constexpr bool is_valarray_v = is_valarray<T>::value;
+
+// scalar type of serialised tensors
+enum class DataTypes: uint32_t {
+    INVALID,
+    FLOAT64,
+    FLOAT32,
+};
+
+template <class T>
+static constexpr DataTypes dataTypeOf = std::is_same_v<T, double>? DataTypes::FLOAT64: std::is_same_v<T, float>? DataTypes::FLOAT32: DataTypes::INVALID;
@@ -6,6 +6,7 @@
 #include <valarray>
 #include <cassert>
 #include "network.hpp"
+#include "data_loader.hpp"
 
 template <template <typename> typename T, typename V,  class U = decltype("valarr"s)>
 static void printValarray(const T<V>& valarr, U&& name = "valarr"s) {
@@ -60,26 +61,27 @@ std::valarray<std::valarray<T>> batch(const std::valarray<T>& origin, size_t bat
     return batched;
 }
 
-template <class T1, class T2, class _BiPred>
-void train(Network& n, const std::valarray<std::valarray<double>>& trainInputs, const std::valarray<T1>& trainOutputs, double learningRate, size_t epoch, size_t batchSize, const std::valarray<std::valarray<double>>& testInputs, const std::valarray<T2>& testOutputs, _BiPred&& testBiPred, size_t threadCounts = 1) {
+template <class T, class M, class T1, class T2, class _BiPred>
+void train(BasicNetwork<T, M>& n, const std::valarray<std::valarray<T>>& trainInputs, const std::valarray<T1>& trainOutputs, double learningRate, size_t epoch, size_t batchSize, const std::valarray<std::valarray<T>>& testInputs, const std::valarray<T2>& testOutputs, _BiPred&& testBiPred, size_t threadCounts = 1) {
     assert(trainInputs.size() == trainOutputs.size());       //assertion
+    n.setThreadCounts(threadCounts);
+    // batch b + 1 is gathered in the background while batch b trains
+    BasicDataLoader<T> loader(trainInputs.size(), batchSize, gatherFrom(trainInputs, trainOutputs));
     for (size_t e = 0; e < epoch; ++e) {
         std::cout << "epoch " << e << "\r\n";
-        std::vector<size_t> indices = generateShuffledIndices(trainInputs.size());
-        auto shuffledInputs = reorder(trainInputs, indices);
-        auto shuffledOutputs = reorder(trainOutputs, indices);
-        auto batchedInputs = batch(shuffledInputs, batchSize);
-        auto batchedOutputs = batch(shuffledOutputs, batchSize);
+        loader.startEpoch();
+        const BasicMatrix<T> *batchInputs, *batchOutputs;
         size_t p = 0;
         std::cout << "training";
-        for (size_t b = 0; b < batchedInputs.size(); ++b) {
-            n.batchedTrain(batchedInputs[b], batchedOutputs[b], learningRate * batchSize, threadCounts);
+        for (size_t b = 0; loader.next(batchInputs, batchOutputs); ++b) {
+            n.batchedTrain(*batchInputs, *batchOutputs, learningRate * batchSize);
             if (b * batchSize > p) {
                 std::cout << '.';
-                p += indices.size() / 20;
+                p += trainInputs.size() / 20;
             }
         }
         std::cout << "\r\n" << "all batched data is trained" << "\r\n";
+        TELEMETRY_SUMMARY(std::cout);
         std::cout << "assessing accuracy: " << n.test(testInputs, testOutputs, testBiPred) << "\r\n";
     }
 }
\ No newline at end of file